@@ -0,0 +1,446 @@
+// Time zones for iCal times, without Arduino dependencies so the conversions
+// can be unit-tested on the host (pio test -e native).
+//
+// iCal times come as UTC ("...Z"), floating (device zone) or with a TZID.
+// Each zone is reduced to one yearly rule (POSIX TZ string, VTIMEZONE
+// block from the feed or the built-in name table) and expanded into a small
+// table of UTC offset changes for last year to two years ahead. Converting an
+// event time is then a binary search in that table instead of a
+// setenv/tzset/mktime round trip. Tables are cached per TZID and rebuilt when
+// the year or the device zone changes. Times outside the table use its first
+// or last offset.
+//
+// The including program defines the two hooks below: the device zone as a
+// POSIX TZ string (with a counter that changes whenever the string does) and
+// the year the tables are built around.
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <algorithm>
+
+const char *tzDeviceRule(uint32_t &generation);
+int tzCurrentYear();
+
+#define MAX_TZ_ZONES 8
+#define MAX_TZ_TRANSITIONS 8 // two per year, last year .. year after next
+#define TZID_LEN 40
+
+struct TzRuleDate {
+  uint8_t month; // 1..12
+  uint8_t week;  // 1..4, 5 = last
+  uint8_t wday;  // 0 = Sunday
+  int32_t time;  // seconds after local midnight, wall clock before the change
+};
+
+struct TzRule {
+  int32_t stdOffset = 0; // seconds east of UTC
+  int32_t dstOffset = 0;
+  bool hasDst = false;
+  TzRuleDate start = {};
+  TzRuleDate end = {};
+};
+
+struct TzTransition {
+  int64_t utc;
+  int32_t offset; // in effect from utc on
+};
+
+struct TzZone {
+  char tzid[TZID_LEN] = "";
+  TzRule rule;
+  int32_t baseOffset = 0; // before the first transition
+  uint8_t count = 0;
+  TzTransition transitions[MAX_TZ_TRANSITIONS];
+  int16_t year = 0;       // table built around this year
+  uint32_t lastUse = 0;
+};
+
+struct TzCache {
+  TzZone zones[MAX_TZ_ZONES];
+  uint8_t zoneCount = 0;
+  TzZone device;                // tzDeviceRule(), for floating times
+  uint32_t deviceGeneration = UINT32_MAX;
+  uint32_t useCounter = 0;
+  uint32_t builds = 0;
+  uint32_t vtimezones = 0;      // VTIMEZONE blocks taken from feeds
+  uint32_t unknownTzids = 0;    // fell back to the device zone
+};
+
+static TzCache tzCache; // one translation unit includes this header
+
+// Common TZIDs (IANA and the Windows names Outlook sends) as POSIX rules.
+static const char *const TZID_POSIX[][2] = {
+  {"UTC", "UTC0"}, {"Etc/UTC", "UTC0"}, {"GMT", "GMT0"}, {"Etc/GMT", "GMT0"},
+  {"Europe/Berlin", "CET-1CEST,M3.5.0,M10.5.0/3"}, {"Europe/Vienna", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Europe/Zurich", "CET-1CEST,M3.5.0,M10.5.0/3"}, {"Europe/Paris", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Europe/Amsterdam", "CET-1CEST,M3.5.0,M10.5.0/3"}, {"Europe/Brussels", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Europe/Rome", "CET-1CEST,M3.5.0,M10.5.0/3"}, {"Europe/Madrid", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Europe/Prague", "CET-1CEST,M3.5.0,M10.5.0/3"}, {"Europe/Warsaw", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Europe/Copenhagen", "CET-1CEST,M3.5.0,M10.5.0/3"}, {"Europe/Stockholm", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Europe/Oslo", "CET-1CEST,M3.5.0,M10.5.0/3"}, {"Europe/Luxembourg", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Europe/London", "GMT0BST,M3.5.0/1,M10.5.0"}, {"Europe/Dublin", "IST-1GMT0,M10.5.0,M3.5.0/1"},
+  {"Europe/Lisbon", "WET0WEST,M3.5.0/1,M10.5.0"}, {"Europe/Helsinki", "EET-2EEST,M3.5.0/3,M10.5.0/4"},
+  {"Europe/Athens", "EET-2EEST,M3.5.0/3,M10.5.0/4"}, {"Europe/Istanbul", "<+03>-3"}, {"Europe/Moscow", "MSK-3"},
+  {"America/New_York", "EST5EDT,M3.2.0,M11.1.0"}, {"America/Chicago", "CST6CDT,M3.2.0,M11.1.0"},
+  {"America/Denver", "MST7MDT,M3.2.0,M11.1.0"}, {"America/Phoenix", "MST7"},
+  {"America/Los_Angeles", "PST8PDT,M3.2.0,M11.1.0"}, {"Asia/Tokyo", "JST-9"}, {"Asia/Shanghai", "CST-8"},
+  {"Asia/Kolkata", "IST-5:30"}, {"Australia/Sydney", "AEST-10AEDT,M10.1.0,M4.1.0/3"},
+  {"W. Europe Standard Time", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Central Europe Standard Time", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Central European Standard Time", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Romance Standard Time", "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"GMT Standard Time", "GMT0BST,M3.5.0/1,M10.5.0"}, {"Greenwich Standard Time", "GMT0"},
+  {"UTC Standard Time", "UTC0"}, {"FLE Standard Time", "EET-2EEST,M3.5.0/3,M10.5.0/4"},
+  {"Eastern Standard Time", "EST5EDT,M3.2.0,M11.1.0"}, {"Central Standard Time", "CST6CDT,M3.2.0,M11.1.0"},
+  {"Mountain Standard Time", "MST7MDT,M3.2.0,M11.1.0"}, {"Pacific Standard Time", "PST8PDT,M3.2.0,M11.1.0"},
+};
+
+// Days since 1970-01-01 for a proleptic Gregorian date (no timegm() in newlib).
+inline int32_t daysFromCivil(int y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+inline int daysInMonth(int y, int m) {
+  static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+  return m == 2 && leap ? 29 : days[m - 1];
+}
+
+// Local midnight-relative seconds of a rule date in `year`, as days * 86400 + time.
+inline int64_t tzRuleLocalSeconds(const TzRuleDate &r, int year) {
+  int32_t first = daysFromCivil(year, r.month, 1);
+  int firstWday = (int)(((first % 7) + 11) % 7); // 1970-01-01 was a Thursday
+  int day = 1 + (r.wday - firstWday + 7) % 7 + (r.week - 1) * 7;
+  while (day > daysInMonth(year, r.month)) day -= 7;
+  return (int64_t)(first + day - 1) * 86400 + r.time;
+}
+
+// [+-]hh[:mm[:ss]]; returns chars consumed, 0 if none.
+inline int parseTzClock(const char *s, int32_t &out) {
+  const char *p = s;
+  int sign = 1;
+  if (*p == '+' || *p == '-') sign = *p++ == '-' ? -1 : 1;
+  if (!isdigit((unsigned char)*p)) return 0;
+  int32_t parts[3] = {0, 0, 0};
+  for (int i = 0; i < 3; ++i) {
+    if (i > 0) {
+      if (*p != ':' || !isdigit((unsigned char)p[1])) break;
+      p++;
+    }
+    while (isdigit((unsigned char)*p)) parts[i] = parts[i] * 10 + (*p++ - '0');
+  }
+  out = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+  return p - s;
+}
+
+inline int skipTzName(const char *s) {
+  const char *p = s;
+  if (*p == '<') {
+    while (*p && *p != '>') p++;
+    return *p ? p + 1 - s : 0;
+  }
+  while (isalpha((unsigned char)*p)) p++;
+  return p - s >= 3 ? p - s : 0;
+}
+
+inline bool parseTzRuleDate(const char *&p, TzRuleDate &d) {
+  int m, w, wd, n = 0;
+  if (sscanf(p, "M%d.%d.%d%n", &m, &w, &wd, &n) != 3 || m < 1 || m > 12 || w < 1 || w > 5 || wd < 0 || wd > 6) return false;
+  p += n;
+  d.month = m;
+  d.week = w;
+  d.wday = wd;
+  d.time = 2 * 3600;
+  if (*p == '/') {
+    int used = parseTzClock(p + 1, d.time);
+    if (!used) return false;
+    p += 1 + used;
+  }
+  return true;
+}
+
+// POSIX TZ ("CET-1CEST,M3.5.0,M10.5.0/3"); only M-form rules, as used by
+// every zone in practice. POSIX offsets count west, TzRule east.
+inline bool parsePosixTz(const char *s, TzRule &r) {
+  const char *p = s;
+  int n = skipTzName(p);
+  if (!n) return false;
+  p += n;
+  int32_t off;
+  if (!(n = parseTzClock(p, off))) return false;
+  p += n;
+  r = TzRule();
+  r.stdOffset = -off;
+  if (!*p) return true;
+  if (!(n = skipTzName(p))) return false;
+  p += n;
+  r.hasDst = true;
+  r.dstOffset = r.stdOffset + 3600;
+  if ((n = parseTzClock(p, off))) {
+    r.dstOffset = -off;
+    p += n;
+  }
+  if (*p != ',') { // no rule given: newlib's default (US)
+    r.start = {3, 2, 0, 7200};
+    r.end = {11, 1, 0, 7200};
+    return *p == 0;
+  }
+  p++;
+  if (!parseTzRuleDate(p, r.start) || *p++ != ',' || !parseTzRuleDate(p, r.end)) return false;
+  return *p == 0;
+}
+
+inline bool sameTzRuleDate(const TzRuleDate &a, const TzRuleDate &b) {
+  return a.month == b.month && a.week == b.week && a.wday == b.wday && a.time == b.time;
+}
+
+inline bool sameTzRule(const TzRule &a, const TzRule &b) {
+  return a.stdOffset == b.stdOffset && a.dstOffset == b.dstOffset && a.hasDst == b.hasDst &&
+         sameTzRuleDate(a.start, b.start) && sameTzRuleDate(a.end, b.end);
+}
+
+inline void buildTzTable(TzZone &z, int year) {
+  const TzRule &r = z.rule;
+  z.year = year;
+  z.count = 0;
+  z.baseOffset = r.stdOffset;
+  tzCache.builds++;
+  if (!r.hasDst) return;
+  for (int y = year - 1; y <= year + 2 && z.count + 2 <= MAX_TZ_TRANSITIONS; ++y) {
+    z.transitions[z.count++] = {tzRuleLocalSeconds(r.start, y) - r.stdOffset, r.dstOffset};
+    z.transitions[z.count++] = {tzRuleLocalSeconds(r.end, y) - r.dstOffset, r.stdOffset};
+  }
+  std::sort(z.transitions, z.transitions + z.count,
+            [](const TzTransition &a, const TzTransition &b) { return a.utc < b.utc; });
+  z.baseOffset = z.transitions[0].offset == r.dstOffset ? r.stdOffset : r.dstOffset;
+}
+
+inline int32_t tzOffsetAt(const TzZone &z, int64_t utc) {
+  int lo = 0, hi = z.count; // first transition after utc
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (z.transitions[mid].utc <= utc) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo == 0 ? z.baseOffset : z.transitions[lo - 1].offset;
+}
+
+// Wall-clock seconds (days * 86400 + time of day) in zone z to UTC. In the
+// autumn overlap the first occurrence wins; a time in the spring gap is read
+// with the offset before the change (02:30 becomes 03:30), like mktime().
+inline int64_t tzLocalToUtc(const TzZone &z, int64_t local) {
+  if (!z.rule.hasDst) return local - tzOffsetAt(z, local - z.baseOffset);
+  int32_t hi = std::max(z.rule.stdOffset, z.rule.dstOffset);
+  int32_t lo = std::min(z.rule.stdOffset, z.rule.dstOffset);
+  if (tzOffsetAt(z, local - hi) == hi) return local - hi;
+  return local - lo;
+}
+
+inline const TzZone &deviceTzZone() {
+  int year = tzCurrentYear();
+  uint32_t generation;
+  const char *posix = tzDeviceRule(generation);
+  if (tzCache.deviceGeneration != generation) {
+    tzCache.deviceGeneration = generation;
+    if (!parsePosixTz(posix, tzCache.device.rule)) tzCache.device.rule = TzRule();
+    tzCache.device.year = 0;
+  }
+  if (tzCache.device.year != year) buildTzTable(tzCache.device, year);
+  return tzCache.device;
+}
+
+inline TzZone *findTzZone(const char *tzid) {
+  for (int i = 0; i < tzCache.zoneCount; ++i) {
+    if (strcmp(tzCache.zones[i].tzid, tzid) == 0) return &tzCache.zones[i];
+  }
+  return nullptr;
+}
+
+// Adds or updates a zone; the least recently used one makes room.
+inline TzZone &storeTzZone(const char *tzid, const TzRule &rule) {
+  TzZone *z = findTzZone(tzid);
+  if (!z) {
+    if (tzCache.zoneCount < MAX_TZ_ZONES) {
+      z = &tzCache.zones[tzCache.zoneCount++];
+    } else {
+      z = &tzCache.zones[0];
+      for (int i = 1; i < MAX_TZ_ZONES; ++i) {
+        if (tzCache.zones[i].lastUse < z->lastUse) z = &tzCache.zones[i];
+      }
+    }
+    snprintf(z->tzid, sizeof(z->tzid), "%s", tzid);
+    z->year = 0;
+  }
+  if (!sameTzRule(z->rule, rule)) {
+    z->rule = rule;
+    z->year = 0;
+  }
+  z->lastUse = ++tzCache.useCounter;
+  return *z;
+}
+
+// Zone for a TZID: from a VTIMEZONE seen earlier, the name table, or the
+// device zone if unknown.
+inline const TzZone &tzZoneFor(const char *tzid) {
+  if (!tzid || !*tzid) return deviceTzZone();
+  TzZone *z = findTzZone(tzid);
+  if (!z) {
+    const char *posix = nullptr;
+    for (const auto &entry : TZID_POSIX) {
+      if (strcasecmp(entry[0], tzid) == 0) posix = entry[1];
+    }
+    TzRule rule;
+    if (!posix || !parsePosixTz(posix, rule)) {
+      tzCache.unknownTzids++;
+      return deviceTzZone();
+    }
+    z = &storeTzZone(tzid, rule);
+  }
+  z->lastUse = ++tzCache.useCounter;
+  int year = tzCurrentYear();
+  if (z->year != year) buildTzTable(*z, year);
+  return *z;
+}
+
+// iCalendar DATE or DATE-TIME value: "20250101" (midnight), "20250101T100000"
+// (in `tzid`, or the device zone if none) or "20250101T100000Z" (UTC).
+// 0 if malformed.
+inline time_t icalDateTimeToEpoch(const char *value, const char *tzid = nullptr) {
+  int y, mo, d, h = 0, mi = 0, s = 0;
+  size_t len = strlen(value);
+  if (len < 8 || sscanf(value, "%4d%2d%2d", &y, &mo, &d) != 3) return 0;
+  if (len >= 15 && value[8] == 'T' && sscanf(value + 9, "%2d%2d%2d", &h, &mi, &s) != 3) return 0;
+  if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 60) return 0;
+  int64_t wall = (int64_t)daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+  if (len >= 16 && value[15] == 'Z') return (time_t)wall;
+  int64_t utc = tzLocalToUtc(tzZoneFor(tzid), wall);
+  return utc > 0 ? (time_t)utc : 0;
+}
+
+// Collects one VTIMEZONE block of a feed into a TzRule: the latest STANDARD
+// and DAYLIGHT definitions by DTSTART. DST counts only if both repeat yearly
+// (RRULE); a zone that dropped DST ends with a one-off STANDARD.
+struct VtimezoneReader {
+  char tzid[TZID_LEN];
+  bool inComponent = false;
+  bool daylight = false;
+  int32_t offsetTo = 0;
+  TzRuleDate date = {};
+  bool hasRule = false;
+  char since[16];   // DTSTART of the current component
+  TzRule rule;
+  bool stdSeen = false, stdRule = false;
+  bool dstSeen = false, dstRule = false;
+  char stdSince[16];
+  char dstSince[16];
+
+  void reset() {
+    *this = VtimezoneReader();
+    tzid[0] = 0;
+    stdSince[0] = dstSince[0] = 0;
+  }
+
+  void beginComponent(bool isDaylight) {
+    inComponent = true;
+    daylight = isDaylight;
+    offsetTo = 0;
+    hasRule = false;
+    date = {};
+    since[0] = 0;
+  }
+
+  // "+0100" / "-0530" / "+013000"
+  static bool parseUtcOffset(const char *v, int32_t &out) {
+    int sign = *v == '-' ? -1 : 1;
+    if (*v != '+' && *v != '-') return false;
+    int hh, mm, ss = 0;
+    if (sscanf(v + 1, "%2d%2d%2d", &hh, &mm, &ss) < 2) return false;
+    out = sign * (hh * 3600 + mm * 60 + ss);
+    return true;
+  }
+
+  // RRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=-1SU (or BYMONTHDAY=8,..,14;BYDAY=SU)
+  void parseRrule(const char *v) {
+    static const char *const DAYS[7] = {"SU", "MO", "TU", "WE", "TH", "FR", "SA"};
+    if (!strstr(v, "FREQ=YEARLY")) return;
+    const char *month = strstr(v, "BYMONTH=");
+    const char *byday = strstr(v, "BYDAY=");
+    const char *monthday = strstr(v, "BYMONTHDAY=");
+    if (!month || !byday) return;
+    date.month = atoi(month + 8);
+    byday += 6;
+    int week = 0;
+    if (*byday == '-' || *byday == '+' || isdigit((unsigned char)*byday)) week = strtol(byday, (char **)&byday, 10);
+    if (week < 0 || week > 4) week = 5;
+    if (week == 0) week = monthday ? (atoi(monthday + 11) - 1) / 7 + 1 : 1;
+    date.week = week;
+    date.wday = 7;
+    for (int i = 0; i < 7; ++i) {
+      if (strncmp(byday, DAYS[i], 2) == 0) date.wday = i;
+    }
+    hasRule = date.month >= 1 && date.month <= 12 && date.wday < 7;
+  }
+
+  // One unfolded content line ("NAME;PARAMS:VALUE").
+  void handleProperty(const char *line) {
+    const char *colon = strchr(line, ':');
+    if (!colon) return;
+    const char *v = colon + 1;
+    if (strncmp(line, "TZID", 4) == 0) {
+      snprintf(tzid, sizeof(tzid), "%s", v);
+    } else if (!inComponent) {
+      return;
+    } else if (strncmp(line, "TZOFFSETTO", 10) == 0) {
+      parseUtcOffset(v, offsetTo);
+    } else if (strncmp(line, "DTSTART", 7) == 0) {
+      snprintf(since, sizeof(since), "%s", v);
+      int h = 0, m = 0, s = 0;
+      if (strlen(v) >= 15) sscanf(v + 9, "%2d%2d%2d", &h, &m, &s);
+      date.time = h * 3600 + m * 60 + s;
+    } else if (strncmp(line, "RRULE", 5) == 0) {
+      parseRrule(v);
+    }
+  }
+
+  void endComponent() {
+    inComponent = false;
+    char *latest = daylight ? dstSince : stdSince;
+    if ((daylight ? dstSeen : stdSeen) && strcmp(since, latest) < 0) return; // an older definition
+    snprintf(latest, sizeof(stdSince), "%s", since);
+    if (daylight) {
+      dstSeen = true;
+      dstRule = hasRule;
+      rule.dstOffset = offsetTo;
+      rule.start = date;
+    } else {
+      stdSeen = true;
+      stdRule = hasRule;
+      rule.stdOffset = offsetTo;
+      rule.end = date;
+    }
+  }
+
+  // Registers the zone; false if the block was unusable.
+  bool finish() {
+    if (!tzid[0] || !stdSeen) return false;
+    rule.hasDst = dstSeen && dstRule && stdRule;
+    if (!rule.hasDst) {
+      rule.dstOffset = 0;
+      rule.start = rule.end = {};
+    }
+    storeTzZone(tzid, rule);
+    tzCache.vtimezones++;
+    return true;
+  }
+};
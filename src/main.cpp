@@ -7,14 +7,41 @@
 #include <LittleFS.h>
 #include <ArduinoJson.h>
 #include <FastLED.h>
+#include <lwip/sockets.h>
+#include <esp_rom_crc.h>
+#include <esp_sntp.h>
+#include <sys/time.h>
+#include <limits>
+#include <Preferences.h>
+#include <PubSubClient.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <esp32/rom/miniz.h>
+#include "ical_tz.h"
+#ifdef __XTENSA__
+#include <esp_debug_helpers.h>
+#include <freertos/xtensa_context.h>
+#include <soc/soc_memory_layout.h>
+#endif
+#ifdef CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
 
 // --------- Hardware configuration ---------
 #define LED_PIN 5
 #define DEFAULT_LED_COUNT 12
 #define DEFAULT_APPOINT_COLOR "00ffff"
-#define FILE_CONFIG "/config.json"
+#define FILE_CONFIG "/config.json" // legacy, migrated to FILE_CONFIG_BIN on first boot
+#define FILE_CONFIG_BIN "/config.bin"
+#define FILE_LAYOUT "/layout.json"
 #define MAX_APPOINTMENTS 10
 #define MAX_ICALS 5
+#define MAX_SCENES 8
+#define DEFAULT_POWER_BUDGET_MA 2000
+#define REALTIME_DEFAULT_TIMEOUT_MS 2500
+#define DEFAULT_MQTT_TOPIC "agentur-led"
+#define LED_MA_PER_CHANNEL 20 // WS2812B: ~20 mA per color channel at full duty
+#define LED_IDLE_MA 1         // quiescent draw per LED, even when black
 static const char *FW_VERSION = "v0.7.7";
 
 // --------- LED and effect settings ---------
@@ -35,6 +62,24 @@ struct IcalSource {
   String color; // hex RGB
 };
 
+// SCENE_SET_* bits: which settings a scene overrides.
+#define SCENE_SET_MODE 0x01
+#define SCENE_SET_BRIGHTNESS 0x02
+#define SCENE_SET_EFFECT 0x04
+#define SCENE_DAY_SEC 86400UL
+#define SCENE_WEEK_SEC 604800UL
+
+struct SceneRule {
+  String name;
+  uint8_t days = 0x7f;   // bit per weekday, bit 0 = Sunday (tm_wday)
+  uint32_t startSec = 0; // seconds after local midnight
+  int32_t endSec = -1;   // -1 = open-ended, lasts until the next open-ended scene starts
+  uint8_t sets = 0;
+  String mode;
+  uint8_t brightness = 0;
+  String effect;
+};
+
 struct DeviceConfig {
   int ledCount = DEFAULT_LED_COUNT;
   uint8_t brightness = 96;
@@ -53,12 +98,62 @@ struct DeviceConfig {
   String openColor = "00ff00";
   String closedColor = "ff0000";
   String clockColor = "ffffff";
+  String clockStyle = "fill"; // fill | hand
   String effect = "rainbow";
   String effectColor = "ffffff";
   uint8_t effectSpeed = 4; // increment per frame for rainbow
+  uint16_t powerBudgetMa = DEFAULT_POWER_BUDGET_MA; // 0 = unlimited
+  uint16_t transitionMs = 600; // crossfade between scenes, 0 = hard cut
+  bool realtimeEnabled = false; // accept E1.31/DDP pixel data over UDP
+  uint16_t realtimeUniverse = 1; // E1.31 universe (DDP has none)
+  uint16_t realtimeTimeoutMs = REALTIME_DEFAULT_TIMEOUT_MS; // back to the configured mode after this much silence
+  String syncMode = "off"; // off | leader | follower: share the effect clock with other signs
+  uint8_t syncGroup = 1;   // followers only lock to a leader of the same group
+  bool mqttEnabled = false;
+  String mqttHost = "";
+  uint16_t mqttPort = 1883;
+  String mqttUser = "";
+  String mqttPassword = ""; // write-only over the API
+  String mqttTopic = DEFAULT_MQTT_TOPIC; // base topic, e.g. agentur-led/status/open
+  SceneRule scenes[MAX_SCENES]; // later rules win where they overlap
+  uint8_t sceneCount = 0;
   DayWindow hours[7];
 };
 
+struct PowerState {
+  uint32_t channelSum = 0;  // sum of all channel values of the last changed frame
+  uint32_t requestedMa = 0; // estimated draw at configured brightness
+  uint32_t drawMa = 0;      // estimated draw after limiting
+  uint8_t limitScale = 255; // smoothed limiter factor on top of brightness
+  uint8_t appliedBrightness = 0;
+  unsigned long estimateUs = 0;
+};
+
+enum RealtimeSource : uint8_t { RT_NONE, RT_E131, RT_DDP };
+static const char *RT_SOURCE_NAMES[] = {"none", "e131", "ddp"};
+
+struct RealtimeState {
+  int e131Fd = -1;
+  int ddpFd = -1;
+  uint32_t generation = UINT32_MAX; // config the sockets were opened for
+  RealtimeSource source = RT_NONE;  // set while realtime data owns the strip
+  unsigned long lastPacketMs = 0;
+  unsigned long lastFrameUs = 0;    // arrival of the newest complete frame
+  unsigned long lastShowUs = 0;
+  bool framePending = false;        // leds[] holds a frame not shown yet
+  uint8_t e131Seq = 0;
+  uint8_t ddpSeq = 0;
+  uint32_t packets = 0;
+  uint32_t frames = 0;     // complete frames received
+  uint32_t shown = 0;
+  uint32_t dropped = 0;    // frames overwritten before the strip could take them
+  uint32_t outOfOrder = 0; // late or duplicate packets, discarded
+  uint32_t lost = 0;       // gaps in the sequence numbers
+  uint32_t invalid = 0;
+  float intervalUs = 0;    // smoothed time between shown frames
+  float jitterUs = 0;      // smoothed deviation from that interval
+};
+
 DeviceConfig configState;
 WebServer server(80);
 unsigned long lastNtpSync = 0;
@@ -67,6 +162,664 @@ time_t nextIcalTimes[MAX_ICALS] = {0};
 WiFiManager *wmPortal = nullptr;
 bool portalActive = false;
 bool tzInitialized = false;
+bool wifiConnecting = false;
+unsigned long wifiConnectStartMs = 0;
+bool serverStarted = false;
+uint32_t configGeneration = 0; // bumped on every saveConfig(), lets caches notice edits
+
+// Parts of the config with derived state of their own. applyConfigDoc()
+// reports which ones an edit touched; saveConfig() bumps only their
+// generations, so e.g. a color change does not reconnect MQTT.
+enum ConfigArea : uint8_t {
+  CFG_AREA_GENERAL,      // read directly while rendering; caches use configGeneration
+  CFG_AREA_APPOINTMENTS,
+  CFG_AREA_ICAL,         // fetched times
+  CFG_AREA_TZ,           // TZ env, iCal times, scene timeline position
+  CFG_AREA_REALTIME,     // UDP sockets
+  CFG_AREA_MQTT,         // broker connection
+  CFG_AREA_SCENES,       // compiled timeline
+  CFG_AREA_SYNC,         // beacon socket, follower clock
+  CFG_AREA_COUNT
+};
+static const char *const CFG_AREA_NAMES[CFG_AREA_COUNT] = {"general", "appointments", "ical", "tz", "realtime", "mqtt", "scenes", "sync"};
+#define CFG_CHANGED(area) (1UL << (area))
+#define CFG_CHANGED_ALL ((1UL << CFG_AREA_COUNT) - 1)
+uint32_t areaGeneration[CFG_AREA_COUNT] = {0};
+PowerState powerState;
+RealtimeState realtime;
+
+// Shared with the MQTT task (see the MQTT section).
+struct MqttStats {
+  volatile bool connected = false;
+  volatile bool needFullPublish = false; // set by the task after (re)connecting
+  volatile uint32_t connects = 0;
+  volatile uint32_t failures = 0;
+  volatile uint32_t published = 0;
+  volatile uint32_t backoffMs = 0;
+  uint32_t dropped = 0;  // outgoing, queue full
+  uint32_t commands = 0;
+  volatile uint32_t commandsDropped = 0;
+};
+MqttStats mqttStats;
+
+// Outcome of the last firmware/filesystem update (see the OTA section).
+struct OtaStats {
+  const char *lastKind = "";  // "full", "delta" or "fs"
+  bool lastOk = false;
+  uint32_t lastBytes = 0;     // downloaded
+  uint32_t lastImageBytes = 0;
+  uint32_t lastMs = 0;
+  uint32_t deltaFallbacks = 0;
+};
+OtaStats otaStats;
+
+// --------- Metrics ---------
+// Latency histograms for hot paths and API handlers, timed with the CPU cycle
+// counter. Buckets are log-linear (exact below 8 us, then 4 per power of two,
+// <= 25% relative error) so percentiles come from a fixed 208-byte table per
+// metric. Counts are halved when one saturates, which keeps recent behaviour
+// weighted without unbounded counters.
+#define HIST_EXACT 8
+#define HIST_SUB_BITS 2
+#define HIST_MAX_EXP 26 // ~67 s; longer durations land in the last bucket
+#define HIST_BUCKETS (HIST_EXACT + (HIST_MAX_EXP - 2) * (1 << HIST_SUB_BITS))
+
+enum MetricId : uint8_t {
+  M_LOOP,
+  M_HANDLE_LEDS,
+  M_LED_SHOW,
+  M_HANDLE_CLIENT,
+  M_ICAL_FETCH,
+  M_SAVE_CONFIG,
+  M_API_CONFIG_GET,
+  M_API_CONFIG_POST,
+  M_API_CONFIG_PATCH,
+  M_API_STATUS,
+  M_API_LAYOUT,
+  M_API_FRAMES_STREAM,
+  M_API_CAPTURE_START,
+  M_API_CAPTURE_GET,
+  M_API_UPDATE,
+  M_API_UPDATE_FS,
+  M_API_UPDATE_BUNDLE,
+  M_API_APPOINTMENTS_GET,
+  M_API_APPOINTMENTS_POST,
+  M_API_APPOINTMENTS_DELETE,
+  M_API_APPOINTMENTS_IMPORT,
+  M_API_APPOINTMENTS_EXPORT,
+  M_API_WIFI_RESET,
+  M_API_METRICS,
+  M_API_STALLS,
+  M_WAKE_RESPONSE,
+  M_REALTIME_LATENCY,
+  METRIC_COUNT
+};
+
+// Label values, in MetricId order. Entries starting with "api_" are handlers.
+static const char *const METRIC_NAMES[METRIC_COUNT] = {
+  "loop", "handle_leds", "fastled_show", "handle_client", "ical_fetch", "save_config",
+  "api_config_get", "api_config_post", "api_config_patch", "api_status", "api_layout", "api_frames_stream",
+  "api_capture_start", "api_capture_get", "api_update", "api_update_fs", "api_update_bundle",
+  "api_appointments_get", "api_appointments_post", "api_appointments_delete",
+  "api_appointments_import", "api_appointments_export", "api_wifi_reset",
+  "api_metrics", "api_stalls",
+  "wake_response",
+  "realtime_latency"
+};
+
+struct LatencyHistogram {
+  uint16_t buckets[HIST_BUCKETS];
+  uint32_t count = 0;   // monotonic, for Prometheus _count
+  uint64_t sumUs = 0;   // monotonic, for Prometheus _sum
+  uint32_t maxUs = 0;
+};
+
+struct RuntimeStats {
+  uint32_t loopIterations = 0;
+  uint32_t minLargestBlock = UINT32_MAX;
+  unsigned long lastHeapSampleMs = 0;
+};
+
+LatencyHistogram latencyHist[METRIC_COUNT];
+RuntimeStats runtimeStats;
+
+uint8_t histBucket(uint32_t us) {
+  if (us < HIST_EXACT) return us;
+  int e = 31 - __builtin_clz(us);
+  if (e > HIST_MAX_EXP) return HIST_BUCKETS - 1;
+  uint32_t m = (us >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+  return HIST_EXACT + (e - 3) * (1 << HIST_SUB_BITS) + m;
+}
+
+uint32_t histBucketUpperUs(uint8_t idx) {
+  if (idx < HIST_EXACT) return idx;
+  uint32_t k = idx - HIST_EXACT;
+  uint32_t e = 3 + (k >> HIST_SUB_BITS);
+  uint32_t m = k & ((1 << HIST_SUB_BITS) - 1);
+  return (((1u << HIST_SUB_BITS) + m + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void recordLatency(MetricId id, uint32_t us) {
+  LatencyHistogram &h = latencyHist[id];
+  uint8_t b = histBucket(us);
+  if (h.buckets[b] == UINT16_MAX) {
+    for (int i = 0; i < HIST_BUCKETS; ++i) h.buckets[i] >>= 1;
+  }
+  h.buckets[b]++;
+  h.count++;
+  h.sumUs += us;
+  if (us > h.maxUs) h.maxUs = us;
+}
+
+uint32_t histPercentileUs(const LatencyHistogram &h, uint8_t percent) {
+  uint32_t total = 0;
+  for (int i = 0; i < HIST_BUCKETS; ++i) total += h.buckets[i];
+  if (total == 0) return 0;
+  uint32_t rank = (total * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; ++i) {
+    seen += h.buckets[i];
+    if (seen >= rank) return min(histBucketUpperUs(i), h.maxUs);
+  }
+  return h.maxUs;
+}
+
+// Innermost MetricScope of the loop task, sampled by the stall watch.
+struct LoopPhase {
+  volatile uint8_t id = M_LOOP;
+  volatile uint32_t renderStartUs = 0; // outermost handle_leds/fastled_show scope
+};
+
+LoopPhase loopPhase;
+
+inline bool IRAM_ATTR isRenderPhase(uint8_t id) {
+  return id == M_HANDLE_LEDS || id == M_LED_SHOW;
+}
+
+// Times the enclosing block. The cycle counter wraps after ~17 s at 240 MHz,
+// so long operations (iCal fetch, OTA) fall back to micros().
+struct MetricScope {
+  MetricId id;
+  uint8_t outerPhase;
+  uint32_t startCycles;
+  unsigned long startUs;
+  uint32_t startMhz;
+  explicit MetricScope(MetricId metric)
+      : id(metric), outerPhase(loopPhase.id), startCycles(ESP.getCycleCount()), startUs(micros()), startMhz(getCpuFrequencyMhz()) {
+    if (isRenderPhase(metric) && !isRenderPhase(outerPhase)) loopPhase.renderStartUs = (uint32_t)esp_timer_get_time();
+    loopPhase.id = metric;
+  }
+  ~MetricScope() {
+    loopPhase.id = outerPhase;
+    unsigned long elapsedUs = micros() - startUs;
+    // Cycle counts are only meaningful if the clock did not change in between.
+    bool useMicros = elapsedUs > 1000000UL || getCpuFrequencyMhz() != startMhz;
+    uint32_t us = useMicros ? elapsedUs : (ESP.getCycleCount() - startCycles) / startMhz;
+    recordLatency(id, us);
+  }
+};
+
+bool powerWake();
+
+// Wraps an API handler so its latency lands in its histogram. Requests that
+// arrive while the power manager is idle also count towards wake_response.
+WebServer::THandlerFunction timedHandler(MetricId id, void (*handler)()) {
+  return [id, handler]() {
+    unsigned long startUs = micros();
+    bool woke = powerWake();
+    {
+      MetricScope scope(id);
+      handler();
+    }
+    if (woke) recordLatency(M_WAKE_RESPONSE, micros() - startUs);
+  };
+}
+
+void sampleHeap() {
+  unsigned long nowMs = millis();
+  if (nowMs - runtimeStats.lastHeapSampleMs < 1000) return;
+  runtimeStats.lastHeapSampleMs = nowMs;
+  runtimeStats.minLargestBlock = min(runtimeStats.minLargestBlock, ESP.getMaxAllocHeap());
+}
+
+// --------- Power manager ---------
+// When no frame has changed and no HTTP request came in for a few seconds
+// (static modes, the clock between minutes) the CPU drops to 80 MHz, WLAN
+// goes to max modem sleep and the loop stretches its period up to the next
+// deadline. Any API request or frame change switches back at once. With
+// CONFIG_PM_ENABLE builds the frequency is left to esp_pm (plus automatic
+// light sleep if tickless idle is on) and a lock holds it at max while active.
+// Currents are datasheet estimates for the ESP32 module, not measurements.
+#define POWER_IDLE_AFTER_MS 3000
+#define POWER_ACTIVE_CPU_MHZ 240
+#define POWER_IDLE_CPU_MHZ 80
+#define LOOP_FRAME_MS 30       // loop period while active
+#define POWER_IDLE_LOOP_MS 100 // longest loop period while idle; bounds HTTP wake latency
+#define ESP_MA_ACTIVE 70       // 240 MHz + WLAN min modem sleep (DTIM 1)
+#define ESP_MA_IDLE 33         // 80 MHz + WLAN max modem sleep (listen interval 3)
+#define WIFI_WAKE_ACTIVE_MS 102 // worst-case wait for the AP's next beacon, DTIM 1
+#define WIFI_WAKE_IDLE_MS 307   // listen interval 3
+
+enum PowerLevel : uint8_t { POWER_ACTIVE, POWER_IDLE };
+static const char *POWER_LEVEL_NAMES[] = {"active", "idle"};
+
+struct PowerManager {
+  PowerLevel level = POWER_ACTIVE;
+  unsigned long lastFrameChangeMs = 0;
+  unsigned long lastActivityMs = 0;
+  unsigned long lastAccountMs = 0;
+  uint64_t activeMs = 0;
+  uint64_t idleMs = 0;
+  uint64_t chargeMaMs = 0; // integrated estimated module current
+  uint32_t wakeups = 0;
+  uint32_t lastSwitchUs = 0; // cost of the last level change
+};
+
+PowerManager powerMgr;
+#ifdef CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t cpuMaxLock = nullptr;
+#endif
+
+// Pure decision, shared with the simulation in the bench env.
+PowerLevel powerTargetLevel(unsigned long nowMs, unsigned long lastFrameChangeMs, unsigned long lastActivityMs, bool busy) {
+  if (busy) return POWER_ACTIVE;
+  if (nowMs - lastFrameChangeMs < POWER_IDLE_AFTER_MS) return POWER_ACTIVE;
+  if (nowMs - lastActivityMs < POWER_IDLE_AFTER_MS) return POWER_ACTIVE;
+  return POWER_IDLE;
+}
+
+uint16_t powerLevelMa(PowerLevel level) {
+  return level == POWER_ACTIVE ? ESP_MA_ACTIVE : ESP_MA_IDLE;
+}
+
+// Idle loops sleep until the next minute boundary (clock deadline), capped
+// so requests are still picked up quickly.
+unsigned long powerLoopDelayMs(PowerLevel level, unsigned long msIntoMinute) {
+  if (level == POWER_ACTIVE) return LOOP_FRAME_MS;
+  unsigned long toDeadline = 60000UL - msIntoMinute;
+  return constrain(toDeadline, (unsigned long)LOOP_FRAME_MS, (unsigned long)POWER_IDLE_LOOP_MS);
+}
+
+void accountPower(unsigned long nowMs) {
+  unsigned long dt = nowMs - powerMgr.lastAccountMs;
+  powerMgr.lastAccountMs = nowMs;
+  if (powerMgr.level == POWER_ACTIVE) powerMgr.activeMs += dt; else powerMgr.idleMs += dt;
+  powerMgr.chargeMaMs += (uint64_t)powerLevelMa(powerMgr.level) * dt;
+}
+
+uint32_t averageEspMa() {
+  accountPower(millis());
+  uint64_t total = powerMgr.activeMs + powerMgr.idleMs;
+  return total ? (uint32_t)(powerMgr.chargeMaMs / total) : powerLevelMa(powerMgr.level);
+}
+
+void beginPowerManager() {
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pm = {};
+  pm.max_freq_mhz = POWER_ACTIVE_CPU_MHZ;
+  pm.min_freq_mhz = POWER_IDLE_CPU_MHZ;
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  pm.light_sleep_enable = true;
+#endif
+  esp_pm_configure(&pm);
+  esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "ledsign", &cpuMaxLock);
+  esp_pm_lock_acquire(cpuMaxLock);
+#endif
+  powerMgr.lastFrameChangeMs = powerMgr.lastActivityMs = powerMgr.lastAccountMs = millis();
+}
+
+void applyPowerLevel(PowerLevel level) {
+  if (level == powerMgr.level) return;
+  accountPower(millis());
+  unsigned long startUs = micros();
+#ifdef CONFIG_PM_ENABLE
+  if (level == POWER_ACTIVE) esp_pm_lock_acquire(cpuMaxLock); else esp_pm_lock_release(cpuMaxLock);
+#else
+  setCpuFrequencyMhz(level == POWER_ACTIVE ? POWER_ACTIVE_CPU_MHZ : POWER_IDLE_CPU_MHZ);
+#endif
+  // Only a plain station can sleep; the setup portal's AP must stay awake.
+  if (WiFi.getMode() == WIFI_STA && WiFi.isConnected()) {
+    WiFi.setSleep(level == POWER_ACTIVE ? WIFI_PS_MIN_MODEM : WIFI_PS_MAX_MODEM);
+  }
+  powerMgr.lastSwitchUs = micros() - startUs;
+  if (level == POWER_ACTIVE) powerMgr.wakeups++;
+  powerMgr.level = level;
+}
+
+// HTTP traffic: back to full speed before the handler runs. True if we were idle.
+bool powerWake() {
+  powerMgr.lastActivityMs = millis();
+  if (powerMgr.level == POWER_ACTIVE) return false;
+  applyPowerLevel(POWER_ACTIVE);
+  return true;
+}
+
+void noteFrameChanged() {
+  powerMgr.lastFrameChangeMs = millis();
+}
+
+void servicePower(bool busy) {
+  unsigned long nowMs = millis();
+  applyPowerLevel(powerTargetLevel(nowMs, powerMgr.lastFrameChangeMs, powerMgr.lastActivityMs, busy));
+  accountPower(nowMs);
+}
+
+// --------- Fast boot ---------
+// The last shown frame is mirrored into RTC memory, which survives soft resets
+// (OTA reboot, WLAN reset, watchdog). setup() pushes it to the strip before
+// the filesystem is even mounted; after a power cycle the first frame comes
+// from the freshly loaded config instead. WLAN, NTP and the web server start
+// in the background from loopWork().
+#define BOOT_CACHE_MAGIC 0x4c424331 // "LBC1"
+#define BOOT_HOLD_MAX_MS 60000      // keep the cached frame at most this long while the clock is unset
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+
+struct BootFrameCache {
+  uint32_t magic;
+  uint8_t brightness; // brightness after power limiting, safe to replay as is
+  uint8_t count;
+  uint8_t pixels[DEFAULT_LED_COUNT * 3];
+  uint32_t checksum;
+};
+
+struct BootTimings {
+  unsigned long firstFrameMs = 0;  // since app start; bootloader time not included
+  unsigned long configMs = 0;      // config and layout loaded
+  unsigned long wifiMs = 0;        // first WLAN connection
+  unsigned long httpReadyMs = 0;   // web server listening
+  bool cachedFrame = false;        // first frame came from the RTC cache
+};
+
+RTC_NOINIT_ATTR BootFrameCache bootCache;
+BootTimings bootTimings;
+bool bootHoldFrame = false; // cached frame stays up until the clock can be rendered
+
+uint32_t bootCacheChecksum(const BootFrameCache &c) {
+  uint32_t h = 2166136261u ^ c.magic ^ ((uint32_t)c.brightness << 8) ^ c.count;
+  for (size_t i = 0; i < sizeof(c.pixels); ++i) {
+    h ^= c.pixels[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Called for every frame that reaches the strip; a 40-byte copy.
+void cacheBootFrame(uint8_t brightness) {
+  if (bootTimings.firstFrameMs == 0) bootTimings.firstFrameMs = millis();
+  bootCache.magic = BOOT_CACHE_MAGIC;
+  bootCache.brightness = brightness;
+  bootCache.count = (uint8_t)configState.ledCount;
+  memcpy(bootCache.pixels, leds, sizeof(bootCache.pixels));
+  bootCache.checksum = bootCacheChecksum(bootCache);
+}
+
+// Show the frame from before the reset, if RTC memory still holds a valid one.
+bool showCachedBootFrame() {
+  if (bootCache.magic != BOOT_CACHE_MAGIC || bootCache.checksum != bootCacheChecksum(bootCache)) return false;
+  if (esp_reset_reason() == ESP_RST_POWERON) return false;
+  memcpy(leds, bootCache.pixels, sizeof(bootCache.pixels));
+  FastLED.setBrightness(bootCache.brightness);
+  FastLED.show();
+  bootTimings.firstFrameMs = millis();
+  bootTimings.cachedFrame = true;
+  return true;
+}
+
+bool clockIsSet(time_t now) {
+  return now > 1600000000; // anything before Sep 2020 means SNTP has not answered yet
+}
+
+// --------- Stall watch ---------
+// A hardware timer interrupt on the loop task's core checks on every loop
+// pass that runs long. Once a pass is over STALL_LOOP_MS, or a render scope
+// (handle_leds/fastled_show) over STALL_RENDER_MS, it records the innermost
+// MetricScope and a backtrace of the loop task into a ring in RTC memory. A
+// long stall is sampled again at every doubling (250, 500, 1000 ms ...), so
+// the ring shows where it went on to. The ring survives soft resets
+// (watchdog, panic, OTA) and is served at /api/stalls. The timer only runs
+// while a pass does, so the idle wait is not woken up. It is not an IRAM
+// interrupt: during a flash operation it waits, so a stall in LittleFS or
+// Update is sampled between two flash operations.
+#define STALL_MAGIC 0x4c535431 // "LST1"
+#define STALL_RING 24
+#define STALL_DEPTH 8
+#define STALL_LOOP_MS 250
+#define STALL_RENDER_MS 60     // two frames
+#define STALL_TICK_US 10000    // timer period while a pass runs
+
+enum StallKind : uint8_t { STALL_LOOP, STALL_RENDER };
+static const char *const STALL_KIND_NAMES[] = {"loop", "render"};
+
+struct StallSample {
+  uint32_t seq;       // samples recorded before this one, across boots
+  uint32_t unixTime;  // 0 while the clock was not set
+  uint32_t uptimeMs;
+  uint32_t stalledMs; // how long the pass (loop) or render scope had been running
+  uint16_t boot;
+  uint8_t kind;
+  uint8_t phase;      // MetricId
+  uint32_t pc[STALL_DEPTH]; // call sites, innermost first, 0 after the last
+};
+
+struct StallRing {
+  uint32_t magic;
+  uint16_t boot; // soft resets since the last power-on
+  uint16_t head; // next slot
+  uint32_t seq;
+  StallSample samples[STALL_RING];
+};
+
+struct StallWatch {
+  hw_timer_t *timer = nullptr;
+  TaskHandle_t task = nullptr;
+  uintptr_t stackLo = 0, stackHi = 0; // the loop task's stack
+  volatile bool busy = false;
+  volatile bool renderSampled = false;
+  volatile uint32_t passStartUs = 0;
+  volatile uint32_t nextSampleMs = STALL_LOOP_MS;
+  volatile uint32_t wallOffsetS = 0; // unix time minus uptime, 0 while the clock is unset
+  uint32_t count[2] = {0, 0};        // stalls (not samples) this boot, per StallKind
+  uint32_t maxMs = 0;
+  esp_reset_reason_t resetReason = ESP_RST_UNKNOWN;
+};
+
+RTC_NOINIT_ATTR StallRing stallRing;
+StallWatch stallWatch;
+
+// Return address of a windowed call to the address of the call, as the
+// panic handler prints it.
+inline uint32_t IRAM_ATTR stallCallSite(uint32_t ret) {
+  if (ret & 0x80000000) ret = (ret & 0x3fffffff) | 0x40000000;
+  return ret - 3;
+}
+
+// The loop task is not running while the interrupt is, so its saved frame is
+// stable: pxTopOfStack (the first TCB member) points at the interrupt frame if
+// the timer hit the loop task itself, or at the frame it left when it blocked
+// (solicited, exit == 0) or was preempted. The frame pointer is checked
+// against the task's stack and the walk stops at the first implausible stack
+// pointer, as esp_backtrace_print_from_frame() does.
+inline bool IRAM_ATTR stallFrameOnStack(const void *frame, size_t size) {
+  uintptr_t p = (uintptr_t)frame;
+  return p >= stallWatch.stackLo && p + size <= stallWatch.stackHi;
+}
+
+void IRAM_ATTR stallBacktrace(uint32_t *out) {
+  for (int i = 0; i < STALL_DEPTH; ++i) out[i] = 0;
+#ifdef __XTENSA__
+  const XtExcFrame *exc = *(const XtExcFrame *const *)stallWatch.task;
+  if (!stallFrameOnStack(exc, sizeof(XtSolFrame))) return;
+  esp_backtrace_frame_t f;
+  if (exc->exit) {
+    if (!stallFrameOnStack(exc, sizeof(XtExcFrame))) return;
+    f = {(uint32_t)exc->pc, (uint32_t)exc->a1, (uint32_t)exc->a0, exc};
+  } else {
+    const XtSolFrame *sol = (const XtSolFrame *)exc;
+    f = {(uint32_t)sol->pc, (uint32_t)sol->a1, (uint32_t)sol->a0, sol};
+  }
+  out[0] = stallCallSite(f.pc);
+  for (int i = 1; i < STALL_DEPTH && f.next_pc && esp_stack_ptr_is_sane(f.sp) && esp_backtrace_get_next_frame(&f); ++i) {
+    out[i] = stallCallSite(f.pc);
+  }
+#endif
+}
+
+void IRAM_ATTR recordStall(StallKind kind, uint32_t stalledMs) {
+  uint32_t uptimeMs = (uint32_t)(esp_timer_get_time() / 1000);
+  StallSample &s = stallRing.samples[stallRing.head];
+  s.seq = stallRing.seq++;
+  s.unixTime = stallWatch.wallOffsetS ? stallWatch.wallOffsetS + uptimeMs / 1000 : 0;
+  s.uptimeMs = uptimeMs;
+  s.stalledMs = stalledMs;
+  s.boot = stallRing.boot;
+  s.kind = kind;
+  s.phase = loopPhase.id;
+  stallBacktrace(s.pc);
+  stallRing.head = (stallRing.head + 1) % STALL_RING;
+  if (stalledMs > stallWatch.maxMs) stallWatch.maxMs = stalledMs;
+}
+
+void IRAM_ATTR stallTimerIsr() {
+  StallWatch &w = stallWatch;
+  if (!w.busy) return;
+  uint32_t nowUs = (uint32_t)esp_timer_get_time();
+  if (!w.renderSampled && isRenderPhase(loopPhase.id)) {
+    uint32_t renderMs = (nowUs - loopPhase.renderStartUs) / 1000;
+    if (renderMs >= STALL_RENDER_MS) {
+      w.renderSampled = true;
+      w.count[STALL_RENDER]++;
+      recordStall(STALL_RENDER, renderMs);
+      return;
+    }
+  }
+  uint32_t passMs = (nowUs - w.passStartUs) / 1000;
+  if (passMs >= w.nextSampleMs) {
+    if (w.nextSampleMs == STALL_LOOP_MS) w.count[STALL_LOOP]++;
+    recordStall(STALL_LOOP, passMs);
+    w.nextSampleMs *= 2;
+  }
+}
+
+// Runs in setup(), i.e. in the loop task, so the interrupt lands on its core.
+void beginStallWatch() {
+  stallWatch.resetReason = esp_reset_reason();
+  if (stallRing.magic != STALL_MAGIC || stallRing.head >= STALL_RING || stallWatch.resetReason == ESP_RST_POWERON) {
+    memset(&stallRing, 0, sizeof(stallRing));
+    stallRing.magic = STALL_MAGIC;
+  } else {
+    stallRing.boot++;
+  }
+  stallWatch.task = xTaskGetCurrentTaskHandle();
+  stallWatch.stackLo = (uintptr_t)pxTaskGetStackStart(stallWatch.task);
+  stallWatch.stackHi = stallWatch.stackLo + getArduinoLoopTaskStackSize();
+  stallWatch.timer = timerBegin(0, 80, true); // 1 us ticks from the 80 MHz APB clock
+  timerAttachInterrupt(stallWatch.timer, stallTimerIsr, false);
+  timerAlarmWrite(stallWatch.timer, STALL_TICK_US, true);
+}
+
+void stallPassBegin() {
+  stallWatch.passStartUs = (uint32_t)esp_timer_get_time();
+  stallWatch.nextSampleMs = STALL_LOOP_MS;
+  stallWatch.renderSampled = false;
+  stallWatch.busy = true;
+  if (!stallWatch.timer) return;
+  timerWrite(stallWatch.timer, 0);
+  timerAlarmEnable(stallWatch.timer);
+}
+
+void stallPassEnd(time_t now) {
+  stallWatch.busy = false;
+  if (stallWatch.timer) timerAlarmDisable(stallWatch.timer);
+  stallWatch.wallOffsetS = clockIsSet(now) ? (uint32_t)(now - (time_t)(esp_timer_get_time() / 1000000)) : 0;
+}
+
+const char *resetReasonName(esp_reset_reason_t r) {
+  switch (r) {
+    case ESP_RST_POWERON: return "poweron";
+    case ESP_RST_EXT: return "external";
+    case ESP_RST_SW: return "software";
+    case ESP_RST_PANIC: return "panic";
+    case ESP_RST_INT_WDT: return "int_wdt";
+    case ESP_RST_TASK_WDT: return "task_wdt";
+    case ESP_RST_WDT: return "wdt";
+    case ESP_RST_DEEPSLEEP: return "deepsleep";
+    case ESP_RST_BROWNOUT: return "brownout";
+    case ESP_RST_SDIO: return "sdio";
+    default: return "unknown";
+  }
+}
+
+// --------- Power budget ---------
+// Sum of all channel values; one pass over the frame, no multiplications.
+uint32_t sumFrameChannels(const CRGB *frame, int count) {
+  uint32_t sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += frame[i].r;
+    sum += frame[i].g;
+    sum += frame[i].b;
+  }
+  return sum;
+}
+
+// Estimated strip current in mA for a channel sum shown at the given brightness.
+uint32_t estimateMilliamps(uint32_t channelSum, int count, uint8_t brightness) {
+  uint32_t scaled = channelSum * brightness / 255; // <= 765 * count * 255
+  return (uint32_t)count * LED_IDLE_MA + scaled * LED_MA_PER_CHANNEL / 255;
+}
+
+uint8_t activeBrightness();
+
+// Pick the largest brightness scale that keeps the frame within the budget.
+// Reductions apply immediately to protect the supply, recovery is eased in
+// over a few frames so the limiter does not visibly pump. The channel sum is
+// only recomputed when the frame content changed.
+void updatePowerLimiter(const CRGB *frame, int count, bool frameChanged) {
+  unsigned long startUs = micros();
+  if (frameChanged) powerState.channelSum = sumFrameChannels(frame, count);
+  uint32_t sum = powerState.channelSum;
+  uint8_t brightness = activeBrightness();
+  powerState.requestedMa = estimateMilliamps(sum, count, brightness);
+
+  uint8_t target = 255;
+  uint32_t idleMa = (uint32_t)count * LED_IDLE_MA;
+  uint32_t budget = configState.powerBudgetMa;
+  if (budget > 0 && powerState.requestedMa > budget) {
+    uint32_t dynamicMa = powerState.requestedMa - idleMa;
+    uint32_t allowedMa = budget > idleMa ? budget - idleMa : 0;
+    target = dynamicMa > 0 ? (uint8_t)min<uint32_t>(255, allowedMa * 255 / dynamicMa) : 255;
+  }
+
+  if (target < powerState.limitScale) {
+    powerState.limitScale = target;
+  } else if (target > powerState.limitScale) {
+    uint8_t step = max<uint8_t>(1, (target - powerState.limitScale) / 8);
+    powerState.limitScale = qadd8(powerState.limitScale, step);
+    if (powerState.limitScale > target) powerState.limitScale = target;
+  }
+
+  uint8_t applied = scale8(brightness, powerState.limitScale);
+  powerState.drawMa = estimateMilliamps(sum, count, applied);
+  powerState.appliedBrightness = applied;
+  FastLED.setBrightness(applied);
+  powerState.estimateUs = micros() - startUs;
+}
+
+void onFrameShown();
+
+// Single exit point for frames: enforce the power budget, then push to the strip.
+// Unchanged frames at unchanged brightness are not pushed again.
+void showFrame(bool frameChanged = true) {
+  uint8_t previous = powerState.appliedBrightness;
+  updatePowerLimiter(leds, configState.ledCount, frameChanged);
+  if (!frameChanged && powerState.appliedBrightness == previous) return;
+  if (frameChanged) noteFrameChanged();
+  {
+    MetricScope scope(M_LED_SHOW);
+    FastLED.show();
+  }
+  cacheBootFrame(powerState.appliedBrightness);
+  onFrameShown();
+}
 
 void showOtaProgress(size_t written, int total, bool isFs) {
   int half = configState.ledCount / 2;
@@ -95,13 +848,404 @@ void showOtaProgress(size_t written, int total, bool isFs) {
       leds[idx].nscale8_video(80);
     }
   }
-  FastLED.setBrightness(configState.brightness);
-  FastLED.show();
+  showFrame();
 }
 
 // Forward declarations
-void saveConfig();
+void saveConfig(uint32_t changed = CFG_CHANGED_ALL);
 void loadConfig();
+uint32_t effectInputKey();
+
+// --------- Timekeeping ---------
+// SNTP answers are applied here instead of inside lwIP: small offsets are
+// slewed with adjtime() so the clock fill never jumps, the first sync and
+// large offsets step. Whatever offset is left after a sync interval is the
+// residual drift of the system clock; it is pre-compensated in small slews
+// between syncs, so the clock keeps time while the internet is down. The last
+// good epoch and the drift estimate live in NVS for the next boot.
+#define TIME_SLEW_MAX_US 30000000LL // larger offsets are stepped
+#define TIME_DRIFT_MIN_INTERVAL_S 1800 // shorter intervals are dominated by network jitter
+#define TIME_DRIFT_MAX_PPM 500.0f
+#define TIME_COMPENSATE_INTERVAL_MS 60000UL
+#define TIME_PERSIST_INTERVAL_MS (15UL * 60UL * 1000UL)
+#define TIME_REJECTS_BEFORE_ACCEPT 3 // servers that agree this often win over the stored epoch
+
+enum TimeSource : uint8_t { TIME_NONE, TIME_RTC, TIME_RESTORED, TIME_NTP };
+static const char *TIME_SOURCE_NAMES[] = {"none", "rtc", "restored", "ntp"};
+
+struct TimeSyncStats {
+  TimeSource source = TIME_NONE;
+  uint32_t syncs = 0;
+  uint32_t steps = 0;
+  uint32_t slews = 0;
+  uint32_t rejected = 0;
+  uint8_t rejectStreak = 0;
+  int64_t lastOffsetUs = 0;    // NTP minus local clock at the last accepted sync
+  time_t lastSyncEpoch = 0;
+  unsigned long lastSyncMs = 0;
+  float driftPpm = 0;          // positive: the local clock runs slow
+  time_t lastGoodEpoch = 0;    // as persisted
+};
+
+struct PendingSync {
+  volatile bool ready = false;
+  struct timeval ntp;
+  struct timeval local; // local clock when the answer arrived
+};
+
+TimeSyncStats timeStats;
+static PendingSync pendingSync;
+static portMUX_TYPE timeSyncMux = portMUX_INITIALIZER_UNLOCKED;
+static Preferences timePrefs;
+unsigned long lastCompensateMs = 0;
+unsigned long lastTimePersistMs = 0;
+
+int64_t timevalUs(const struct timeval &tv) {
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+struct timeval usToTimeval(int64_t us) {
+  struct timeval tv;
+  tv.tv_sec = (time_t)(us / 1000000LL);
+  tv.tv_usec = (suseconds_t)(us % 1000000LL);
+  if (tv.tv_usec < 0) {
+    tv.tv_sec -= 1;
+    tv.tv_usec += 1000000;
+  }
+  return tv;
+}
+
+// Replaces lwIP's weak default. Runs in the tcpip task, so only hand the
+// sample over; serviceTimekeeping() applies it from the loop.
+extern "C" void sntp_sync_time(struct timeval *tv) {
+  struct timeval local;
+  gettimeofday(&local, nullptr);
+  taskENTER_CRITICAL(&timeSyncMux);
+  pendingSync.ntp = *tv;
+  pendingSync.local = local;
+  pendingSync.ready = true;
+  taskEXIT_CRITICAL(&timeSyncMux);
+  sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+}
+
+void persistTime() {
+  lastTimePersistMs = millis();
+  time_t now = time(nullptr);
+  if (!clockIsSet(now)) return;
+  timeStats.lastGoodEpoch = now;
+  timePrefs.putLong64("epoch", (int64_t)now);
+  timePrefs.putFloat("drift", timeStats.driftPpm);
+}
+
+void beginTimekeeping() {
+  // Local time is needed for the first frame, long before configTzTime() runs.
+  setenv("TZ", configState.tz.c_str(), 1);
+  tzset();
+  timePrefs.begin("time", false);
+  timeStats.lastGoodEpoch = (time_t)timePrefs.getLong64("epoch", 0);
+  timeStats.driftPpm = constrain(timePrefs.getFloat("drift", 0), -TIME_DRIFT_MAX_PPM, TIME_DRIFT_MAX_PPM);
+
+  if (clockIsSet(time(nullptr))) {
+    timeStats.source = TIME_RTC; // system time survives soft resets
+  } else if (clockIsSet(timeStats.lastGoodEpoch)) {
+    struct timeval tv = {timeStats.lastGoodEpoch, 0};
+    settimeofday(&tv, nullptr);
+    timeStats.source = TIME_RESTORED;
+  }
+  Serial.printf("[TIME] source %s, drift %.1f ppm\n", TIME_SOURCE_NAMES[timeStats.source], timeStats.driftPpm);
+}
+
+void applyTimeSync(const struct timeval &ntp, const struct timeval &local) {
+  // A server must not move us to before the last epoch we knew was good,
+  // unless it keeps insisting (the stored epoch could itself be wrong).
+  bool beforeKnown = timeStats.lastGoodEpoch > 0 && ntp.tv_sec < timeStats.lastGoodEpoch - 86400;
+  if (!clockIsSet(ntp.tv_sec) || (beforeKnown && timeStats.rejectStreak < TIME_REJECTS_BEFORE_ACCEPT)) {
+    timeStats.rejected++;
+    timeStats.rejectStreak++;
+    Serial.printf("[TIME] rejected NTP time %ld\n", (long)ntp.tv_sec);
+    return;
+  }
+  timeStats.rejectStreak = 0;
+
+  int64_t offsetUs = timevalUs(ntp) - timevalUs(local);
+  bool wasSynced = timeStats.source == TIME_NTP;
+  if (!wasSynced || llabs(offsetUs) > TIME_SLEW_MAX_US) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    struct timeval target = usToTimeval(timevalUs(now) + offsetUs);
+    settimeofday(&target, nullptr);
+    timeStats.steps++;
+  } else {
+    // The part of the offset that an outstanding slew does not already cover
+    // accumulated since the last sync: that is the residual drift.
+    struct timeval outstanding;
+    adjtime(nullptr, &outstanding);
+    int64_t residualUs = offsetUs - timevalUs(outstanding);
+    time_t intervalS = ntp.tv_sec - timeStats.lastSyncEpoch;
+    if (intervalS >= TIME_DRIFT_MIN_INTERVAL_S) {
+      float residualPpm = (float)residualUs / (float)intervalS;
+      timeStats.driftPpm = constrain(timeStats.driftPpm + residualPpm * 0.5f, -TIME_DRIFT_MAX_PPM, TIME_DRIFT_MAX_PPM);
+    }
+    struct timeval delta = usToTimeval(offsetUs);
+    adjtime(&delta, nullptr);
+    timeStats.slews++;
+  }
+  timeStats.source = TIME_NTP;
+  timeStats.syncs++;
+  timeStats.lastOffsetUs = offsetUs;
+  timeStats.lastSyncEpoch = ntp.tv_sec;
+  timeStats.lastSyncMs = millis();
+  persistTime();
+}
+
+void serviceTimekeeping() {
+  if (pendingSync.ready) {
+    struct timeval ntp, local;
+    taskENTER_CRITICAL(&timeSyncMux);
+    ntp = pendingSync.ntp;
+    local = pendingSync.local;
+    pendingSync.ready = false;
+    taskEXIT_CRITICAL(&timeSyncMux);
+    applyTimeSync(ntp, local);
+  }
+
+  unsigned long nowMs = millis();
+  if (nowMs - lastCompensateMs >= TIME_COMPENSATE_INTERVAL_MS) {
+    // ppm * ms / 1000 = us; added on top of any slew still in progress.
+    int64_t correctionUs = (int64_t)(timeStats.driftPpm * (float)(nowMs - lastCompensateMs) / 1000.0f);
+    lastCompensateMs = nowMs;
+    if (correctionUs != 0 && timeStats.source != TIME_NONE) {
+      struct timeval outstanding;
+      adjtime(nullptr, &outstanding);
+      struct timeval delta = usToTimeval(timevalUs(outstanding) + correctionUs);
+      adjtime(&delta, nullptr);
+    }
+  }
+  if (nowMs - lastTimePersistMs >= TIME_PERSIST_INTERVAL_MS) persistTime();
+}
+
+// --------- Effect sync ---------
+// Signs in one room play their effects in step. Effects are computed from an
+// effect clock alone (effectMillis(), see renderEffect()), so sharing that
+// clock is enough: the leader multicasts a beacon with its clock every
+// ~500 ms and followers phase-lock to it; there is no per-frame traffic.
+// Group-addressed Wi-Fi frames wait at the AP for the next DTIM beacon, so a
+// beacon can arrive ~100 ms late, but never early. Each window of SYNC_WINDOW
+// beacons therefore keeps only its least delayed sample (the largest error)
+// and feeds that to a PI loop: 1/4 of the phase error, 1/128 of it as a
+// frequency correction. tools/sync_sim.py runs the same loop with simulated
+// signs and reports the accuracy; keep both in step.
+#define SYNC_GROUP_ADDR 0xefff4c53UL // 239.255.76.83
+#define SYNC_PORT 5570
+#define SYNC_MAGIC 0x5953534c // "LSSY"
+#define SYNC_VERSION 1
+#define SYNC_INTERVAL_MS 500
+#define SYNC_INTERVAL_JITTER_MS 100 // spread the beacons so they do not beat against the DTIM period
+#define SYNC_WINDOW 32
+#define SYNC_STEP_US 50000    // larger window errors (new leader, leader reboot) jump
+#define SYNC_MAX_PPB 500000
+#define SYNC_LOST_MS 5000     // leader silent this long: free-run, accept another leader
+#define SYNC_LOCK_US 2000
+
+enum SyncMode : uint8_t { SYNC_OFF, SYNC_LEADER, SYNC_FOLLOWER };
+static const char *SYNC_MODE_NAMES[] = {"off", "leader", "follower"};
+
+struct __attribute__((packed)) SyncBeacon {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t group;
+  uint16_t seq;
+  uint32_t leaderId;  // low MAC bytes of the leader
+  uint64_t effectUs;  // leader's effect clock when the beacon was sent
+  uint32_t effectKey; // effectInputKey() of the leader, to spot mismatched settings
+};
+
+struct EffectSync {
+  SyncMode mode = SYNC_OFF;
+  int fd = -1;
+  uint32_t generation = UINT32_MAX; // config the socket was opened for
+  uint16_t seq = 0;
+  unsigned long nextBeaconMs = 0;
+  // Follower clock: effect = anchorEffectUs + d + d * freqPpb / 1e9, d = local - anchorLocalUs
+  bool hasAnchor = false;
+  int64_t anchorLocalUs = 0;
+  int64_t anchorEffectUs = 0;
+  int32_t freqPpb = 0;
+  uint8_t windowCount = 0;
+  int64_t windowBestUs = 0;
+  int64_t windowStartUs = 0;
+  int64_t lastBeaconUs = 0;
+  int64_t lastErrUs = 0; // least delayed error of the last window
+  bool locked = false;
+  uint32_t leaderId = 0;
+  uint32_t leaderKey = 0;
+  uint32_t sent = 0;
+  uint32_t received = 0;
+  uint32_t ignored = 0; // other group, other leader or malformed
+  uint32_t steps = 0;
+  uint32_t corrections = 0;
+};
+
+EffectSync effectSync;
+
+int syncModeFromName(const char *name) {
+  for (int m = SYNC_OFF; m <= SYNC_FOLLOWER; ++m) {
+    if (strcmp(name, SYNC_MODE_NAMES[m]) == 0) return m;
+  }
+  return -1;
+}
+
+int64_t syncClockAt(int64_t localUs) {
+  if (!effectSync.hasAnchor) return localUs;
+  int64_t d = localUs - effectSync.anchorLocalUs;
+  return effectSync.anchorEffectUs + d + d * effectSync.freqPpb / 1000000000LL;
+}
+
+int64_t effectClockUs() {
+  int64_t nowUs = esp_timer_get_time();
+  return effectSync.mode == SYNC_FOLLOWER ? syncClockAt(nowUs) : nowUs;
+}
+
+// Time base of all animations; the same on every synced sign.
+uint32_t effectMillis() {
+  return (uint32_t)(effectClockUs() / 1000);
+}
+
+void rebaseSyncClock(int64_t localUs, int64_t effectUs) {
+  effectSync.anchorLocalUs = localUs;
+  effectSync.anchorEffectUs = effectUs;
+  effectSync.windowStartUs = localUs;
+  effectSync.windowCount = 0;
+}
+
+void applySyncBeacon(int64_t localUs, int64_t leaderUs) {
+  effectSync.lastBeaconUs = localUs;
+  if (!effectSync.hasAnchor) {
+    effectSync.hasAnchor = true;
+    rebaseSyncClock(localUs, leaderUs);
+    effectSync.steps++;
+    return;
+  }
+  int64_t errUs = leaderUs - syncClockAt(localUs);
+  effectSync.windowBestUs = effectSync.windowCount == 0 ? errUs : max(effectSync.windowBestUs, errUs);
+  if (++effectSync.windowCount < SYNC_WINDOW) return;
+
+  int64_t bestUs = effectSync.windowBestUs;
+  effectSync.lastErrUs = bestUs;
+  if (llabs(bestUs) > SYNC_STEP_US) {
+    rebaseSyncClock(localUs, syncClockAt(localUs) + bestUs); // keep the learned frequency
+    effectSync.steps++;
+    effectSync.locked = false;
+    Serial.printf("[SYNC] stepped %lld ms\n", (long long)(bestUs / 1000));
+    return;
+  }
+  int64_t spanUs = localUs - effectSync.windowStartUs;
+  int64_t freq = effectSync.freqPpb + bestUs * 7812500LL / spanUs; // 1e9 / 128
+  effectSync.freqPpb = (int32_t)constrain(freq, (int64_t)-SYNC_MAX_PPB, (int64_t)SYNC_MAX_PPB);
+  rebaseSyncClock(localUs, syncClockAt(localUs) + bestUs / 4);
+  effectSync.locked = llabs(bestUs) < SYNC_LOCK_US;
+  effectSync.corrections++;
+}
+
+void closeSyncSocket() {
+  if (effectSync.fd >= 0) close(effectSync.fd);
+  effectSync.fd = -1;
+  effectSync.generation = UINT32_MAX;
+}
+
+void openSyncSocket() {
+  closeSyncSocket();
+  effectSync = EffectSync(); // a new role or group starts from scratch
+  effectSync.mode = (SyncMode)max(0, syncModeFromName(configState.syncMode.c_str()));
+  effectSync.generation = areaGeneration[CFG_AREA_SYNC];
+  if (effectSync.mode == SYNC_OFF) return;
+  effectSync.fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (effectSync.fd < 0) return;
+  if (effectSync.mode == SYNC_FOLLOWER) {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SYNC_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    struct ip_mreq mreq = {};
+    mreq.imr_multiaddr.s_addr = htonl(SYNC_GROUP_ADDR);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (bind(effectSync.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        setsockopt(effectSync.fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+      close(effectSync.fd);
+      effectSync.fd = -1;
+    }
+  } else {
+    uint8_t ttl = 1;
+    setsockopt(effectSync.fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  }
+  Serial.printf("[SYNC] %s, group %u: %s\n", SYNC_MODE_NAMES[effectSync.mode], configState.syncGroup,
+                effectSync.fd >= 0 ? "ok" : "socket failed");
+}
+
+// Called right after the loop wakes on the socket, so the receive time is
+// close to the arrival; anything later only looks like network delay.
+void receiveSyncBeacons() {
+  SyncBeacon b;
+  for (;;) {
+    ssize_t n = recv(effectSync.fd, &b, sizeof(b), MSG_DONTWAIT);
+    if (n < 0) break;
+    int64_t localUs = esp_timer_get_time();
+    if (n != sizeof(b) || b.magic != SYNC_MAGIC || b.version != SYNC_VERSION || b.group != configState.syncGroup) {
+      effectSync.ignored++;
+      continue;
+    }
+    // One leader per group; another one is only taken once the current one went silent.
+    bool leaderLost = localUs - effectSync.lastBeaconUs > SYNC_LOST_MS * 1000LL;
+    if (b.leaderId != effectSync.leaderId && effectSync.hasAnchor && !leaderLost) {
+      effectSync.ignored++;
+      continue;
+    }
+    if (b.leaderId != effectSync.leaderId) Serial.printf("[SYNC] following leader %06x\n", (unsigned)b.leaderId);
+    effectSync.leaderId = b.leaderId;
+    effectSync.leaderKey = b.effectKey;
+    effectSync.received++;
+    applySyncBeacon(localUs, (int64_t)b.effectUs);
+  }
+}
+
+void sendSyncBeacon() {
+  struct sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(SYNC_PORT);
+  to.sin_addr.s_addr = htonl(SYNC_GROUP_ADDR);
+  SyncBeacon b;
+  b.magic = SYNC_MAGIC;
+  b.version = SYNC_VERSION;
+  b.group = configState.syncGroup;
+  b.seq = effectSync.seq++;
+  b.leaderId = (uint32_t)(ESP.getEfuseMac() >> 24) & 0xffffff; // device-specific MAC bytes; the low ones are the vendor OUI
+  b.effectKey = effectInputKey();
+  b.effectUs = (uint64_t)effectClockUs(); // last, as close to the send as possible
+  if (sendto(effectSync.fd, &b, sizeof(b), 0, (struct sockaddr *)&to, sizeof(to)) == sizeof(b)) effectSync.sent++;
+}
+
+void serviceSync() {
+  bool wanted = configState.syncMode != "off" && WiFi.isConnected() && !portalActive;
+  if (!wanted) {
+    if (effectSync.fd >= 0 || effectSync.mode != SYNC_OFF) {
+      closeSyncSocket();
+      effectSync.mode = SYNC_OFF;
+    }
+    return;
+  }
+  if (effectSync.generation != areaGeneration[CFG_AREA_SYNC]) openSyncSocket();
+  if (effectSync.fd < 0) return;
+  if (effectSync.mode == SYNC_LEADER) {
+    unsigned long nowMs = millis();
+    if ((long)(nowMs - effectSync.nextBeaconMs) >= 0) {
+      sendSyncBeacon();
+      effectSync.nextBeaconMs = nowMs + SYNC_INTERVAL_MS - SYNC_INTERVAL_JITTER_MS / 2 + esp_random() % (SYNC_INTERVAL_JITTER_MS + 1);
+    }
+  } else if (effectSync.locked && esp_timer_get_time() - effectSync.lastBeaconUs > SYNC_LOST_MS * 1000LL) {
+    effectSync.locked = false; // free-run on the learned frequency
+    Serial.println("[SYNC] leader lost");
+  }
+}
 
 // --------- Helpers ---------
 uint32_t parseHexColor(const String &hex) {
@@ -144,61 +1288,435 @@ struct AppointmentHit {
   String color;
 };
 
-AppointmentHit nextManualAppointment(time_t nowLocal) {
-  AppointmentHit hit;
-  for (int i = 0; i < configState.appointmentCount; ++i) {
-    time_t cand;
-    if (!parseAppointmentTime(configState.appointments[i].time, cand)) continue;
-    if (difftime(cand, nowLocal) < 0) continue; // past
-    if (hit.when == 0 || cand < hit.when) {
-      hit.when = cand;
-      hit.color = configState.appointments[i].color;
-    }
-  }
-  // legacy single appointment
-  time_t legacy;
-  if (parseAppointmentTime(configState.appointmentTime, legacy)) {
-    if (difftime(legacy, nowLocal) >= 0 && (hit.when == 0 || legacy < hit.when)) {
-      hit.when = legacy;
-      hit.color = DEFAULT_APPOINT_COLOR;
-    }
-  }
-  return hit;
+// --------- Time zones (iCal) ---------
+// Rules, offset tables and the zone cache are in ical_tz.h (host tests in
+// test/test_tz); the firmware supplies the device zone and the year.
+const char *tzDeviceRule(uint32_t &generation) {
+  generation = areaGeneration[CFG_AREA_TZ];
+  return configState.tz.c_str();
 }
 
-AppointmentHit nextAnyAppointment(time_t nowLocal) {
-  AppointmentHit manual = nextManualAppointment(nowLocal);
-  AppointmentHit merged = manual;
-  for (int i = 0; i < configState.icalCount; ++i) {
-    time_t cand = nextIcalTimes[i];
-    if (cand > 0 && difftime(cand, nowLocal) >= 0) {
-      if (merged.when == 0 || cand < merged.when) {
-        merged.when = cand;
-        merged.color = configState.icals[i].color.length() == 6 ? configState.icals[i].color : configState.icalColor;
-      }
-    }
-  }
-  return merged;
+int tzCurrentYear() {
+  time_t now = time(nullptr);
+  return clockIsSet(now) ? 1970 + (int)(now / 31556952L) : 2025;
 }
 
-bool addAppointment(const String &val, const String &color) {
-  if (configState.appointmentCount >= MAX_APPOINTMENTS) return false;
-  time_t t;
-  if (!parseAppointmentTime(val, t)) return false;
-  configState.appointments[configState.appointmentCount].time = val;
-  configState.appointments[configState.appointmentCount].color = color.length() == 6 ? color : DEFAULT_APPOINT_COLOR;
-  configState.appointmentCount++;
-  saveConfig();
-  return true;
+// --------- Appointment store ---------
+// Manual appointments live in /appointments.bin, apart from the config: a
+// CRC-checked header and up to MAX_STORED_APPOINTMENTS 8-byte records sorted
+// by time, mirrored in RAM. Edits are staged behind the visible entries and
+// committed together (sort, dedupe, prune, one write), so an import of
+// hundreds of entries costs one flash write. The frame path keeps a cursor on
+// the first entry not yet past: it only moves forward with time, so finding
+// the next appointment is O(1); a binary search re-seeks after edits or when
+// the clock went backwards.
+#define FILE_APPOINTMENTS "/appointments.bin"
+#define APPT_STORE_MAGIC 0x5041534c // "LSAP"
+#define APPT_STORE_VERSION 1
+#define MAX_STORED_APPOINTMENTS 512
+#define APPT_KEEP_PAST_S (24L * 3600L)   // past entries stay listed for a day
+#define APPT_PRUNE_CHECK_MS (60UL * 60UL * 1000UL)
+
+struct StoredAppointment {
+  uint32_t when; // epoch seconds
+  uint8_t r, g, b;
+  uint8_t reserved;
+};
+
+struct AppointmentStoreHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t crc; // CRC32 over the records
+};
+
+struct AppointmentStore {
+  StoredAppointment entries[MAX_STORED_APPOINTMENTS]; // [0, count) sorted, then `staged` pending ones
+  uint16_t count = 0;
+  uint16_t staged = 0;
+  uint16_t cursor = 0;    // first entry with when >= cursorTime
+  time_t cursorTime = -1; // -1 = seek on next lookup
+  String cursorColor;     // hex color of entries[cursor], cached for the frame path
+  uint32_t writes = 0;
+  uint32_t pruned = 0;
+  uint32_t rejected = 0;  // full or invalid on import
+  unsigned long lastCommitUs = 0;
+  unsigned long lastPruneCheckMs = 0;
+};
+
+static AppointmentStore apptStore; // ~4 KB
+
+uint32_t storedColor(const StoredAppointment &a) {
+  return ((uint32_t)a.r << 16) | ((uint32_t)a.g << 8) | a.b;
 }
 
-bool deleteAppointment(int index) {
-  if (index < 0 || index >= configState.appointmentCount) return false;
-  for (int i = index; i < configState.appointmentCount - 1; ++i) {
-    configState.appointments[i] = configState.appointments[i + 1];
+int compareStoredAppointments(const void *pa, const void *pb) {
+  const StoredAppointment *a = (const StoredAppointment *)pa;
+  const StoredAppointment *b = (const StoredAppointment *)pb;
+  if (a->when != b->when) return a->when < b->when ? -1 : 1;
+  return (int)storedColor(*a) - (int)storedColor(*b);
+}
+
+String formatLocalTime(time_t when) {
+  struct tm t;
+  localtime_r(&when, &t);
+  char buf[20];
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &t);
+  return String(buf);
+}
+
+bool writeAppointmentStore() {
+  AppointmentStoreHeader h = {APPT_STORE_MAGIC, APPT_STORE_VERSION, apptStore.count, 0};
+  size_t bytes = (size_t)apptStore.count * sizeof(StoredAppointment);
+  h.crc = esp_rom_crc32_le(0, (const uint8_t *)apptStore.entries, bytes);
+  File f = LittleFS.open(FILE_APPOINTMENTS ".tmp", "w");
+  if (!f) {
+    Serial.println("Failed to open appointment store for writing");
+    return false;
+  }
+  size_t written = f.write((const uint8_t *)&h, sizeof(h));
+  written += f.write((const uint8_t *)apptStore.entries, bytes);
+  f.close();
+  if (written != sizeof(h) + bytes) {
+    Serial.println("Appointment store write incomplete");
+    LittleFS.remove(FILE_APPOINTMENTS ".tmp");
+    return false;
+  }
+  apptStore.writes++;
+  return LittleFS.rename(FILE_APPOINTMENTS ".tmp", FILE_APPOINTMENTS);
+}
+
+bool loadAppointmentStore() {
+  apptStore.count = 0;
+  apptStore.staged = 0;
+  apptStore.cursorTime = -1;
+  File f = LittleFS.open(FILE_APPOINTMENTS, "r");
+  if (!f) return false;
+  AppointmentStoreHeader h;
+  bool ok = f.read((uint8_t *)&h, sizeof(h)) == sizeof(h) && h.magic == APPT_STORE_MAGIC &&
+            h.version == APPT_STORE_VERSION && h.count <= MAX_STORED_APPOINTMENTS;
+  size_t bytes = ok ? (size_t)h.count * sizeof(StoredAppointment) : 0;
+  ok = ok && f.read((uint8_t *)apptStore.entries, bytes) == bytes &&
+       esp_rom_crc32_le(0, (const uint8_t *)apptStore.entries, bytes) == h.crc;
+  f.close();
+  if (!ok) {
+    Serial.println("Appointment store invalid, starting empty");
+    return false;
+  }
+  apptStore.count = h.count;
+  return true;
+}
+
+// Queues an entry for the next commit; false if the store is full.
+bool stageAppointment(time_t when, uint32_t color) {
+  if (when <= 0 || apptStore.count + apptStore.staged >= MAX_STORED_APPOINTMENTS) {
+    apptStore.rejected++;
+    return false;
+  }
+  StoredAppointment &a = apptStore.entries[apptStore.count + apptStore.staged++];
+  a.when = (uint32_t)when;
+  a.r = color >> 16;
+  a.g = color >> 8;
+  a.b = color;
+  a.reserved = 0;
+  return true;
+}
+
+// Starts a batch of edits. Replacing hides the stored entries right away;
+// they are only gone from flash once the batch is committed.
+void beginAppointmentBatch(bool replace) {
+  apptStore.staged = 0;
+  if (replace) apptStore.count = 0;
+  apptStore.cursorTime = -1;
+}
+
+// Drops the staged entries and restores what is on flash.
+void discardAppointmentBatch() {
+  loadAppointmentStore();
+}
+
+// Merges the staged entries, drops duplicates and entries past the keep
+// window, and writes once.
+bool commitAppointments(time_t now) {
+  unsigned long startUs = micros();
+  StoredAppointment *e = apptStore.entries;
+  int n = apptStore.count + apptStore.staged;
+  if (apptStore.staged > 0) qsort(e, n, sizeof(StoredAppointment), compareStoredAppointments);
+  time_t keepFrom = clockIsSet(now) ? now - APPT_KEEP_PAST_S : 0;
+  int out = 0;
+  for (int i = 0; i < n; ++i) {
+    if ((time_t)e[i].when < keepFrom) {
+      apptStore.pruned++;
+      continue;
+    }
+    if (out > 0 && compareStoredAppointments(&e[out - 1], &e[i]) == 0) continue;
+    e[out++] = e[i];
+  }
+  apptStore.count = out;
+  apptStore.staged = 0;
+  apptStore.cursorTime = -1;
+  bool ok = writeAppointmentStore();
+  apptStore.lastCommitUs = micros() - startUs;
+  return ok;
+}
+
+// Index of the first entry at or after `when`.
+int lowerBoundAppointment(time_t when) {
+  int lo = 0, hi = apptStore.count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if ((time_t)apptStore.entries[mid].when < when) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Removes [from, to) by index; writes unless the caller batches more edits.
+void removeAppointments(int from, int to, bool write) {
+  from = constrain(from, 0, (int)apptStore.count);
+  to = constrain(to, from, (int)apptStore.count);
+  if (to == from) return;
+  memmove(&apptStore.entries[from], &apptStore.entries[to],
+          (apptStore.count + apptStore.staged - to) * sizeof(StoredAppointment));
+  apptStore.count -= to - from;
+  apptStore.cursorTime = -1;
+  if (write) writeAppointmentStore();
+}
+
+// Next entry at or after now; amortized O(1) per frame.
+const StoredAppointment *nextStoredAppointment(time_t now) {
+  uint16_t before = apptStore.cursor;
+  if (apptStore.cursorTime < 0 || now < apptStore.cursorTime) {
+    apptStore.cursor = lowerBoundAppointment(now);
+    before = UINT16_MAX;
+  }
+  while (apptStore.cursor < apptStore.count && (time_t)apptStore.entries[apptStore.cursor].when < now) {
+    apptStore.cursor++;
+  }
+  apptStore.cursorTime = now;
+  if (apptStore.cursor >= apptStore.count) return nullptr;
+  const StoredAppointment &a = apptStore.entries[apptStore.cursor];
+  if (apptStore.cursor != before) {
+    char hex[7];
+    snprintf(hex, sizeof(hex), "%02x%02x%02x", a.r, a.g, a.b);
+    apptStore.cursorColor = hex;
+  }
+  return &a;
+}
+
+// Moves appointments still held in the config (older firmware, POST /api/config)
+// into the store, then prunes hourly.
+void serviceAppointments(time_t now) {
+  if (configState.appointmentCount > 0 || configState.appointmentTime.length() > 0) {
+    time_t t;
+    for (int i = 0; i < configState.appointmentCount; ++i) {
+      if (parseAppointmentTime(configState.appointments[i].time, t)) {
+        stageAppointment(t, parseHexColor(configState.appointments[i].color));
+      }
+    }
+    if (parseAppointmentTime(configState.appointmentTime, t)) stageAppointment(t, parseHexColor(DEFAULT_APPOINT_COLOR));
+    commitAppointments(now);
+    configState.appointmentCount = 0;
+    configState.appointmentTime = "";
+    saveConfig(CFG_CHANGED(CFG_AREA_APPOINTMENTS));
+    Serial.printf("Moved config appointments to %s (%u stored)\n", FILE_APPOINTMENTS, apptStore.count);
+  }
+  if (millis() - apptStore.lastPruneCheckMs < APPT_PRUNE_CHECK_MS && apptStore.lastPruneCheckMs != 0) return;
+  apptStore.lastPruneCheckMs = millis();
+  if (clockIsSet(now) && apptStore.count > 0 && (time_t)apptStore.entries[0].when < now - APPT_KEEP_PAST_S) {
+    commitAppointments(now);
+  }
+}
+
+// Time of a DTSTART-like property line, honouring a TZID parameter:
+// DTSTART;TZID="Europe/Berlin":20250301T100000 or DTSTART:20250301T090000Z.
+time_t icalPropertyTime(const String &line) {
+  char tzid[TZID_LEN] = "";
+  bool quoted = false;
+  int colon = -1;
+  for (int i = 0; i < (int)line.length() && colon < 0; ++i) {
+    char c = line[i];
+    if (c == '"') quoted = !quoted;
+    else if (c == ':' && !quoted) colon = i;
+    else if (c == ';' && !quoted && line.substring(i + 1, i + 6).equalsIgnoreCase("TZID=")) {
+      int start = i + 6, end = start;
+      if (start < (int)line.length() && line[start] == '"') {
+        end = line.indexOf('"', ++start);
+      } else {
+        while (end < (int)line.length() && line[end] != ';' && line[end] != ':') end++;
+      }
+      if (end > start) strlcpy(tzid, line.substring(start, end).c_str(), sizeof(tzid));
+    }
+  }
+  if (colon < 0) return 0;
+  return icalDateTimeToEpoch(line.c_str() + colon + 1, tzid[0] ? tzid : nullptr);
+}
+
+// Streaming iCalendar reader for feeds and imports: fed raw chunks, unfolds
+// lines, registers VTIMEZONE blocks and resolves the DTSTART of every
+// VEVENT (stage = true puts them into the appointment store). Recurrences
+// (RRULE) are not expanded. X-LEDSIGN-COLOR (written by the export)
+// restores the per-entry color. A TZID is resolved when its event is read,
+// so a VTIMEZONE after the events only helps for the next fetch.
+struct IcsImport {
+  String physical;  // current line as received
+  String logical;   // unfolded line waiting for a possible continuation
+  bool inEvent = false;
+  bool inTimezone = false;
+  bool stage = true;
+  VtimezoneReader *vtz = nullptr; // only while inside a VTIMEZONE
+  time_t dtstart = 0;
+  uint32_t color = 0;      // default for events without X-LEDSIGN-COLOR
+  uint32_t eventColor = 0;
+  uint16_t events = 0;
+  uint16_t staged = 0;
+  time_t after = 0;        // nextAfter = first event at or after this
+  time_t nextAfter = 0;
+  time_t earliest = 0;
+
+  void reset(uint32_t c, bool stageEvents = true, time_t from = 0) {
+    physical = "";
+    logical = "";
+    inEvent = false;
+    inTimezone = false;
+    stage = stageEvents;
+    dtstart = 0;
+    color = c;
+    events = 0;
+    staged = 0;
+    after = from;
+    nextAfter = 0;
+    earliest = 0;
   }
-  configState.appointmentCount--;
-  saveConfig();
+
+  void feed(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+      char ch = (char)data[i];
+      if (ch == '\r') continue;
+      if (ch != '\n') {
+        if (physical.length() < 512) physical += ch; // longer lines carry nothing we use
+        continue;
+      }
+      endPhysicalLine();
+    }
+  }
+
+  void finish() {
+    if (physical.length() > 0) endPhysicalLine();
+    if (logical.length() > 0) handleLine(logical);
+    logical = "";
+    delete vtz;
+    vtz = nullptr;
+  }
+
+  void endPhysicalLine() {
+    if (physical.startsWith(" ") || physical.startsWith("\t")) {
+      if (logical.length() < 512) logical += physical.substring(1);
+    } else {
+      if (logical.length() > 0) handleLine(logical);
+      logical = physical;
+    }
+    physical = "";
+  }
+
+  void handleTimezoneLine(const String &line) {
+    if (line.equalsIgnoreCase("END:VTIMEZONE")) {
+      vtz->finish();
+      delete vtz;
+      vtz = nullptr;
+      inTimezone = false;
+    } else if (line.equalsIgnoreCase("BEGIN:STANDARD") || line.equalsIgnoreCase("BEGIN:DAYLIGHT")) {
+      vtz->beginComponent(line.equalsIgnoreCase("BEGIN:DAYLIGHT"));
+    } else if (line.equalsIgnoreCase("END:STANDARD") || line.equalsIgnoreCase("END:DAYLIGHT")) {
+      vtz->endComponent();
+    } else {
+      vtz->handleProperty(line.c_str());
+    }
+  }
+
+  void handleLine(const String &line) {
+    if (inTimezone) {
+      handleTimezoneLine(line);
+    } else if (line.equalsIgnoreCase("BEGIN:VTIMEZONE")) {
+      if (!vtz) vtz = new (std::nothrow) VtimezoneReader();
+      if (vtz) {
+        vtz->reset();
+        inTimezone = true;
+      }
+    } else if (line.equalsIgnoreCase("BEGIN:VEVENT")) {
+      inEvent = true;
+      dtstart = 0;
+      eventColor = color;
+    } else if (line.equalsIgnoreCase("END:VEVENT")) {
+      if (inEvent && dtstart > 0) {
+        events++;
+        if (dtstart >= after && (nextAfter == 0 || dtstart < nextAfter)) nextAfter = dtstart;
+        if (earliest == 0 || dtstart < earliest) earliest = dtstart;
+        if (stage && stageAppointment(dtstart, eventColor)) staged++;
+      }
+      inEvent = false;
+    } else if (inEvent && (line.startsWith("DTSTART:") || line.startsWith("DTSTART;"))) {
+      dtstart = icalPropertyTime(line);
+    } else if (inEvent && line.startsWith("X-LEDSIGN-COLOR:") && line.length() == 22) {
+      eventColor = parseHexColor(line.substring(16));
+    }
+  }
+};
+
+// Stages one {"time":"YYYY-MM-DD HH:MM"|"when":epoch,"color":"RRGGBB"} entry.
+bool stageAppointmentJson(JsonVariantConst v, uint32_t defaultColor) {
+  time_t when = v["when"] | 0L;
+  const char *timeStr = v["time"];
+  if (when <= 0 && timeStr && !parseAppointmentTime(timeStr, when)) when = 0;
+  const char *c = v["color"];
+  uint32_t color = c && strlen(c) == 6 ? parseHexColor(c) : defaultColor;
+  return when > 0 && stageAppointment(when, color);
+}
+
+// Stages the entries of a JSON array of such entries.
+int stageAppointmentsJson(JsonArrayConst arr, uint32_t defaultColor, int &invalid) {
+  int staged = 0;
+  for (JsonVariantConst v : arr) {
+    if (stageAppointmentJson(v, defaultColor)) staged++;
+    else invalid++;
+  }
+  return staged;
+}
+
+AppointmentHit nextManualAppointment(time_t nowLocal) {
+  AppointmentHit hit;
+  if (const StoredAppointment *a = nextStoredAppointment(nowLocal)) {
+    hit.when = a->when;
+    hit.color = apptStore.cursorColor;
+  }
+  return hit;
+}
+
+AppointmentHit nextAnyAppointment(time_t nowLocal) {
+  AppointmentHit manual = nextManualAppointment(nowLocal);
+  AppointmentHit merged = manual;
+  for (int i = 0; i < configState.icalCount; ++i) {
+    time_t cand = nextIcalTimes[i];
+    if (cand > 0 && difftime(cand, nowLocal) >= 0) {
+      if (merged.when == 0 || cand < merged.when) {
+        merged.when = cand;
+        merged.color = configState.icals[i].color.length() == 6 ? configState.icals[i].color : configState.icalColor;
+      }
+    }
+  }
+  return merged;
+}
+
+bool addAppointment(const String &val, const String &color) {
+  time_t t;
+  if (!parseAppointmentTime(val, t)) return false;
+  if (!stageAppointment(t, parseHexColor(color.length() == 6 ? color : DEFAULT_APPOINT_COLOR))) return false;
+  return commitAppointments(time(nullptr));
+}
+
+bool deleteAppointment(int index) {
+  if (index < 0 || index >= apptStore.count) return false;
+  removeAppointments(index, index + 1, true);
   return true;
 }
 
@@ -212,79 +1730,332 @@ bool isOpenNow(time_t nowLocal) {
   return minutesNow >= startM && minutesNow <= endM;
 }
 
-void saveConfig() {
-  DynamicJsonDocument doc(2048);
-  doc["brightness"] = configState.brightness;
-  doc["mode"] = configState.mode;
-  doc["tz"] = configState.tz;
-  doc["icalUrl"] = configState.icalUrl;
-  doc["icalColor"] = configState.icalColor;
-  JsonArray icalsSave = doc["icals"].to<JsonArray>();
-  for (int i = 0; i < configState.icalCount; ++i) {
-    JsonObject ic = icalsSave.add<JsonObject>();
-    ic["url"] = configState.icals[i].url;
-    ic["color"] = configState.icals[i].color;
+// --------- Config snapshot ---------
+// The runtime config lives in /config.bin: a fixed header plus a POD image of
+// DeviceConfig, loaded with a single read and checked by CRC32. JSON stays the
+// API format (buildConfigJson/applyConfigJson); /config.json is only read
+// once to migrate from older firmware. The image is append-only: new fields
+// go at the end, CONFIG_SNAPSHOT_VERSION is bumped and migrateConfigSnapshot()
+// fills them for older files, whose shorter body is read into a zeroed struct.
+#define CONFIG_SNAPSHOT_MAGIC 0x4643534c // "LSCF"
+#define CONFIG_SNAPSHOT_VERSION 5
+#define CFG_URL_LEN 256
+#define CFG_TZ_LEN 64
+#define CFG_NAME_LEN 16
+#define CFG_COLOR_LEN 7     // RRGGBB + NUL
+#define CFG_HM_LEN 6        // HH:MM + NUL
+#define CFG_DATETIME_LEN 17 // YYYY-MM-DD HH:MM + NUL
+#define CFG_HOST_LEN 64
+#define CFG_SECRET_LEN 64
+#define CFG_TOPIC_LEN 48
+
+struct SceneSnapshot {
+  char name[CFG_NAME_LEN];
+  char mode[CFG_NAME_LEN];
+  char effect[CFG_NAME_LEN];
+  uint32_t startSec;
+  int32_t endSec;
+  uint8_t days;
+  uint8_t sets;
+  uint8_t brightness;
+};
+
+struct ConfigSnapshot {
+  // v1
+  uint8_t brightness;
+  uint8_t effectSpeed;
+  uint8_t enableAppointments;
+  uint8_t enableOpenHours;
+  uint8_t icalCount;
+  uint8_t appointmentCount;
+  uint16_t notifyMinutesBefore;
+  uint16_t powerBudgetMa;
+  uint16_t transitionMs;
+  char mode[CFG_NAME_LEN];
+  char tz[CFG_TZ_LEN];
+  char icalUrl[CFG_URL_LEN];
+  char icalColor[CFG_COLOR_LEN];
+  char icalUrls[MAX_ICALS][CFG_URL_LEN];
+  char icalColors[MAX_ICALS][CFG_COLOR_LEN];
+  char appointmentTime[CFG_DATETIME_LEN];
+  char appointmentTimes[MAX_APPOINTMENTS][CFG_DATETIME_LEN];
+  char appointmentColors[MAX_APPOINTMENTS][CFG_COLOR_LEN];
+  char openColor[CFG_COLOR_LEN];
+  char closedColor[CFG_COLOR_LEN];
+  char clockColor[CFG_COLOR_LEN];
+  char clockStyle[CFG_NAME_LEN];
+  char effect[CFG_NAME_LEN];
+  char effectColor[CFG_COLOR_LEN];
+  char hoursStart[7][CFG_HM_LEN];
+  char hoursEnd[7][CFG_HM_LEN];
+  // v2
+  uint8_t realtimeEnabled;
+  uint16_t realtimeUniverse;
+  uint16_t realtimeTimeoutMs;
+  // v3
+  uint8_t mqttEnabled;
+  uint16_t mqttPort;
+  char mqttHost[CFG_HOST_LEN];
+  char mqttUser[CFG_NAME_LEN * 2];
+  char mqttPassword[CFG_SECRET_LEN];
+  char mqttTopic[CFG_TOPIC_LEN];
+  // v4
+  uint8_t sceneCount;
+  SceneSnapshot scenes[MAX_SCENES];
+  // v5
+  char syncMode[CFG_NAME_LEN];
+  uint8_t syncGroup;
+};
+
+struct ConfigSnapshotFile {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size; // bytes of ConfigSnapshot that follow, as written
+  uint32_t crc;  // CRC32 over those bytes
+  ConfigSnapshot data;
+};
+
+static ConfigSnapshotFile configImage; // ~2 KB, keep it off the loop task stack
+
+// Copies with NUL termination; false if the value did not fit.
+bool copyField(char *dst, size_t size, const String &src) {
+  size_t n = min(src.length(), size - 1);
+  memcpy(dst, src.c_str(), n);
+  dst[n] = '\0';
+  return src.length() < size;
+}
+
+bool snapshotFromConfig(const DeviceConfig &c, ConfigSnapshot &s) {
+  memset(&s, 0, sizeof(s));
+  s.brightness = c.brightness;
+  s.effectSpeed = c.effectSpeed;
+  s.enableAppointments = c.enableAppointments;
+  s.enableOpenHours = c.enableOpenHours;
+  s.icalCount = c.icalCount;
+  s.appointmentCount = c.appointmentCount;
+  s.notifyMinutesBefore = c.notifyMinutesBefore;
+  s.powerBudgetMa = c.powerBudgetMa;
+  s.transitionMs = c.transitionMs;
+  s.realtimeEnabled = c.realtimeEnabled;
+  s.realtimeUniverse = c.realtimeUniverse;
+  s.realtimeTimeoutMs = c.realtimeTimeoutMs;
+  s.mqttEnabled = c.mqttEnabled;
+  s.mqttPort = c.mqttPort;
+  bool ok = copyField(s.mode, sizeof(s.mode), c.mode);
+  ok &= copyField(s.tz, sizeof(s.tz), c.tz);
+  ok &= copyField(s.icalUrl, sizeof(s.icalUrl), c.icalUrl);
+  ok &= copyField(s.icalColor, sizeof(s.icalColor), c.icalColor);
+  for (int i = 0; i < c.icalCount; ++i) {
+    ok &= copyField(s.icalUrls[i], CFG_URL_LEN, c.icals[i].url);
+    ok &= copyField(s.icalColors[i], CFG_COLOR_LEN, c.icals[i].color);
   }
-  doc["appointmentTime"] = configState.appointmentTime;
-  doc["notifyMinutesBefore"] = configState.notifyMinutesBefore;
-  JsonArray appointments = doc["appointments"].to<JsonArray>();
-  for (int i = 0; i < configState.appointmentCount; ++i) {
-    JsonObject a = appointments.add<JsonObject>();
-    a["time"] = configState.appointments[i].time;
-    a["color"] = configState.appointments[i].color;
+  ok &= copyField(s.appointmentTime, sizeof(s.appointmentTime), c.appointmentTime);
+  for (int i = 0; i < c.appointmentCount; ++i) {
+    ok &= copyField(s.appointmentTimes[i], CFG_DATETIME_LEN, c.appointments[i].time);
+    ok &= copyField(s.appointmentColors[i], CFG_COLOR_LEN, c.appointments[i].color);
   }
-  doc["openColor"] = configState.openColor;
-  doc["closedColor"] = configState.closedColor;
-  doc["clockColor"] = configState.clockColor;
-  doc["effect"] = configState.effect;
-  doc["effectColor"] = configState.effectColor;
-  doc["effectSpeed"] = configState.effectSpeed;
-  doc["icalColor"] = configState.icalColor;
-  doc["enableAppointments"] = configState.enableAppointments;
-  doc["enableOpenHours"] = configState.enableOpenHours;
+  ok &= copyField(s.openColor, sizeof(s.openColor), c.openColor);
+  ok &= copyField(s.closedColor, sizeof(s.closedColor), c.closedColor);
+  ok &= copyField(s.clockColor, sizeof(s.clockColor), c.clockColor);
+  ok &= copyField(s.clockStyle, sizeof(s.clockStyle), c.clockStyle);
+  ok &= copyField(s.effect, sizeof(s.effect), c.effect);
+  ok &= copyField(s.effectColor, sizeof(s.effectColor), c.effectColor);
+  for (int i = 0; i < 7; ++i) {
+    ok &= copyField(s.hoursStart[i], CFG_HM_LEN, c.hours[i].start);
+    ok &= copyField(s.hoursEnd[i], CFG_HM_LEN, c.hours[i].end);
+  }
+  ok &= copyField(s.mqttHost, sizeof(s.mqttHost), c.mqttHost);
+  ok &= copyField(s.mqttUser, sizeof(s.mqttUser), c.mqttUser);
+  ok &= copyField(s.mqttPassword, sizeof(s.mqttPassword), c.mqttPassword);
+  ok &= copyField(s.mqttTopic, sizeof(s.mqttTopic), c.mqttTopic);
+  s.sceneCount = c.sceneCount;
+  for (int i = 0; i < c.sceneCount; ++i) {
+    const SceneRule &r = c.scenes[i];
+    SceneSnapshot &ss = s.scenes[i];
+    ss.startSec = r.startSec;
+    ss.endSec = r.endSec;
+    ss.days = r.days;
+    ss.sets = r.sets;
+    ss.brightness = r.brightness;
+    ok &= copyField(ss.name, CFG_NAME_LEN, r.name);
+    ok &= copyField(ss.mode, CFG_NAME_LEN, r.mode);
+    ok &= copyField(ss.effect, CFG_NAME_LEN, r.effect);
+  }
+  ok &= copyField(s.syncMode, sizeof(s.syncMode), c.syncMode);
+  s.syncGroup = c.syncGroup;
+  return ok;
+}
 
-  JsonArray hours = doc["hours"].to<JsonArray>();
+void configFromSnapshot(const ConfigSnapshot &s, DeviceConfig &c) {
+  c.brightness = s.brightness;
+  c.effectSpeed = constrain(s.effectSpeed, 1, 20);
+  c.enableAppointments = s.enableAppointments;
+  c.enableOpenHours = s.enableOpenHours;
+  c.icalCount = min((int)s.icalCount, MAX_ICALS);
+  c.appointmentCount = min((int)s.appointmentCount, MAX_APPOINTMENTS);
+  c.notifyMinutesBefore = s.notifyMinutesBefore;
+  c.powerBudgetMa = s.powerBudgetMa;
+  c.transitionMs = s.transitionMs;
+  c.realtimeEnabled = s.realtimeEnabled;
+  c.realtimeUniverse = s.realtimeUniverse;
+  c.realtimeTimeoutMs = s.realtimeTimeoutMs;
+  c.mqttEnabled = s.mqttEnabled;
+  c.mqttPort = s.mqttPort;
+  c.mqttHost = s.mqttHost;
+  c.mqttUser = s.mqttUser;
+  c.mqttPassword = s.mqttPassword;
+  c.mqttTopic = s.mqttTopic;
+  c.syncMode = s.syncMode;
+  c.syncGroup = s.syncGroup;
+  c.sceneCount = min((int)s.sceneCount, MAX_SCENES);
+  for (int i = 0; i < c.sceneCount; ++i) {
+    const SceneSnapshot &ss = s.scenes[i];
+    SceneRule &r = c.scenes[i];
+    r.name = ss.name;
+    r.mode = ss.mode;
+    r.effect = ss.effect;
+    r.startSec = ss.startSec % SCENE_DAY_SEC;
+    r.endSec = ss.endSec < 0 ? -1 : (int32_t)(ss.endSec % SCENE_DAY_SEC);
+    r.days = ss.days & 0x7f;
+    r.sets = ss.sets;
+    r.brightness = ss.brightness;
+  }
+  c.mode = s.mode;
+  c.tz = s.tz;
+  c.icalUrl = s.icalUrl;
+  c.icalColor = s.icalColor;
+  for (int i = 0; i < c.icalCount; ++i) {
+    c.icals[i].url = s.icalUrls[i];
+    c.icals[i].color = s.icalColors[i];
+  }
+  c.appointmentTime = s.appointmentTime;
+  for (int i = 0; i < c.appointmentCount; ++i) {
+    c.appointments[i].time = s.appointmentTimes[i];
+    c.appointments[i].color = s.appointmentColors[i];
+  }
+  c.openColor = s.openColor;
+  c.closedColor = s.closedColor;
+  c.clockColor = s.clockColor;
+  c.clockStyle = s.clockStyle;
+  c.effect = s.effect;
+  c.effectColor = s.effectColor;
   for (int i = 0; i < 7; ++i) {
-    JsonObject h = hours.add<JsonObject>();
-    h["start"] = configState.hours[i].start;
-    h["end"] = configState.hours[i].end;
+    c.hours[i].start = s.hoursStart[i];
+    c.hours[i].end = s.hoursEnd[i];
+  }
+}
+
+// Bring an image written by an older firmware up to CONFIG_SNAPSHOT_VERSION.
+// Fields the old version did not have are zero; give them their defaults here,
+// one case per version step, falling through to the newest.
+void migrateConfigSnapshot(ConfigSnapshot &s, uint16_t fromVersion) {
+  switch (fromVersion) {
+    case 1:
+      s.realtimeEnabled = 0;
+      s.realtimeUniverse = 1;
+      s.realtimeTimeoutMs = REALTIME_DEFAULT_TIMEOUT_MS;
+      // fall through
+    case 2:
+      s.mqttPort = 1883;
+      strcpy(s.mqttTopic, DEFAULT_MQTT_TOPIC);
+      // fall through
+    case 3:
+      s.sceneCount = 0;
+      // fall through
+    case 4:
+      strcpy(s.syncMode, "off");
+      s.syncGroup = 1;
+      // fall through
+    default:
+      break;
+  }
+}
+
+bool writeConfigSnapshot() {
+  if (!snapshotFromConfig(configState, configImage.data)) {
+    Serial.println("Config value too long for snapshot, truncated");
   }
+  configImage.magic = CONFIG_SNAPSHOT_MAGIC;
+  configImage.version = CONFIG_SNAPSHOT_VERSION;
+  configImage.size = sizeof(ConfigSnapshot);
+  configImage.crc = esp_rom_crc32_le(0, (const uint8_t *)&configImage.data, configImage.size);
 
-  File f = LittleFS.open(FILE_CONFIG, "w");
+  // Write to a temp file and rename, so a reset mid-write keeps the old snapshot.
+  File f = LittleFS.open(FILE_CONFIG_BIN ".tmp", "w");
   if (!f) {
     Serial.println("Failed to open config for writing");
-    return;
+    return false;
   }
-  serializeJson(doc, f);
+  size_t written = f.write((const uint8_t *)&configImage, sizeof(configImage));
   f.close();
+  if (written != sizeof(configImage)) {
+    Serial.println("Config write incomplete");
+    LittleFS.remove(FILE_CONFIG_BIN ".tmp");
+    return false;
+  }
+  return LittleFS.rename(FILE_CONFIG_BIN ".tmp", FILE_CONFIG_BIN);
 }
 
-void loadConfig() {
-  // LED count is fixed and not configurable
-  configState.ledCount = DEFAULT_LED_COUNT;
+bool readConfigSnapshot() {
+  File f = LittleFS.open(FILE_CONFIG_BIN, "r");
+  if (!f) return false;
+  memset(&configImage, 0, sizeof(configImage));
+  size_t n = f.read((uint8_t *)&configImage, sizeof(configImage));
+  f.close();
 
-  if (!LittleFS.exists(FILE_CONFIG)) {
-    Serial.println("Config file missing, using defaults.");
-    // default opening hours 08:00-16:00 Mon-Fri
-    for (int i = 0; i < 7; ++i) {
-      configState.hours[i].start = (i == 0 || i == 6) ? "00:00" : "08:00";
-      configState.hours[i].end = (i == 0 || i == 6) ? "00:00" : "16:00";
-    }
-    saveConfig();
-    return;
+  const size_t headerSize = offsetof(ConfigSnapshotFile, data);
+  if (n < headerSize || configImage.magic != CONFIG_SNAPSHOT_MAGIC) {
+    Serial.println("Config snapshot invalid");
+    return false;
+  }
+  if (configImage.version > CONFIG_SNAPSHOT_VERSION || configImage.size > sizeof(ConfigSnapshot)) {
+    Serial.printf("Config snapshot v%u is newer than this firmware\n", configImage.version);
+    return false;
+  }
+  if (n != headerSize + configImage.size ||
+      esp_rom_crc32_le(0, (const uint8_t *)&configImage.data, configImage.size) != configImage.crc) {
+    Serial.println("Config snapshot CRC mismatch");
+    return false;
+  }
+  if (configImage.version < CONFIG_SNAPSHOT_VERSION) {
+    migrateConfigSnapshot(configImage.data, configImage.version);
+  }
+  configFromSnapshot(configImage.data, configState);
+  return true;
+}
+
+// Persists the config and invalidates the derived state of the changed areas.
+void saveConfig(uint32_t changed) {
+  if (changed == 0) return; // nothing differs, skip the flash write
+  MetricScope scope(M_SAVE_CONFIG);
+  configGeneration++;
+  for (int a = 0; a < CFG_AREA_COUNT; ++a) {
+    if (changed & CFG_CHANGED(a)) areaGeneration[a]++;
+  }
+  if (changed & CFG_CHANGED(CFG_AREA_TZ)) {
+    setenv("TZ", configState.tz.c_str(), 1);
+    tzset();
   }
+  if (changed & (CFG_CHANGED(CFG_AREA_ICAL) | CFG_CHANGED(CFG_AREA_TZ))) {
+    for (int i = 0; i < MAX_ICALS; ++i) nextIcalTimes[i] = 0;
+    lastIcalFetch = 0;
+  }
+  writeConfigSnapshot();
+}
 
-  File f = LittleFS.open(FILE_CONFIG, "r");
+// Reads the legacy JSON config; only used when no valid snapshot exists.
+bool loadConfigJson(const char *path = FILE_CONFIG) {
+  File f = LittleFS.open(path, "r");
   if (!f) {
     Serial.println("Failed to open config, using defaults");
-    return;
+    return false;
   }
   DynamicJsonDocument doc(2048);
   DeserializationError err = deserializeJson(doc, f);
   f.close();
   if (err) {
     Serial.println("Failed to parse config, using defaults");
-    return;
+    return false;
   }
   configState.brightness = doc["brightness"] | 96;
   if (const char *v = doc["mode"]) configState.mode = v; else configState.mode = "clock";
@@ -310,8 +2081,6 @@ void loadConfig() {
     configState.icals[0].color = configState.icalColor;
     configState.icalCount = 1;
   }
-  for (int i = 0; i < MAX_ICALS; ++i) nextIcalTimes[i] = 0;
-  lastIcalFetch = 0;
   configState.enableAppointments = doc["enableAppointments"].is<bool>() ? doc["enableAppointments"].as<bool>() : true;
   configState.enableOpenHours = doc["enableOpenHours"].is<bool>() ? doc["enableOpenHours"].as<bool>() : true;
   if (const char *v = doc["appointmentTime"]) configState.appointmentTime = v; else configState.appointmentTime = "";
@@ -333,66 +2102,398 @@ void loadConfig() {
   if (const char *v = doc["openColor"]) configState.openColor = v; else configState.openColor = "00ff00";
   if (const char *v = doc["closedColor"]) configState.closedColor = v; else configState.closedColor = "ff0000";
   if (const char *v = doc["clockColor"]) configState.clockColor = v; else configState.clockColor = "ffffff";
+  if (const char *v = doc["clockStyle"]) configState.clockStyle = v; else configState.clockStyle = "fill";
   if (const char *v = doc["effect"]) configState.effect = v; else configState.effect = "rainbow";
   if (const char *v = doc["effectColor"]) configState.effectColor = v; else configState.effectColor = "ffffff";
   configState.effectSpeed = doc["effectSpeed"] | 4;
   configState.effectSpeed = constrain(configState.effectSpeed, 1, 20);
+  configState.powerBudgetMa = doc["powerBudgetMa"] | DEFAULT_POWER_BUDGET_MA;
+  configState.transitionMs = doc["transitionMs"] | 600;
+  configState.realtimeEnabled = doc["realtimeEnabled"] | false;
+  configState.realtimeUniverse = doc["realtimeUniverse"] | 1;
+  configState.realtimeTimeoutMs = doc["realtimeTimeoutMs"] | REALTIME_DEFAULT_TIMEOUT_MS;
+  if (const char *v = doc["syncMode"]) configState.syncMode = v; else configState.syncMode = "off";
+  configState.syncGroup = doc["syncGroup"] | 1;
+  configState.mqttEnabled = doc["mqttEnabled"] | false;
+  if (const char *v = doc["mqttHost"]) configState.mqttHost = v; else configState.mqttHost = "";
+  configState.mqttPort = doc["mqttPort"] | 1883;
+  if (const char *v = doc["mqttUser"]) configState.mqttUser = v; else configState.mqttUser = "";
+  if (const char *v = doc["mqttPassword"]) configState.mqttPassword = v; else configState.mqttPassword = "";
+  if (const char *v = doc["mqttTopic"]) configState.mqttTopic = v; else configState.mqttTopic = DEFAULT_MQTT_TOPIC;
 
   JsonArray hours = doc["hours"].as<JsonArray>();
   for (int i = 0; i < 7 && i < hours.size(); ++i) {
     if (const char *s = hours[i]["start"]) configState.hours[i].start = s; else configState.hours[i].start = "00:00";
     if (const char *e = hours[i]["end"]) configState.hours[i].end = e; else configState.hours[i].end = "00:00";
   }
+  return true;
 }
 
-void sendJsonErrorTo(WebServer &ws, const String &msg) {
-  DynamicJsonDocument doc(128);
-  doc["error"] = msg;
-  String out;
-  serializeJson(doc, out);
-  ws.send(400, "application/json", out);
-}
+void loadConfig() {
+  // LED count is fixed and not configurable
+  configState.ledCount = DEFAULT_LED_COUNT;
+  for (int i = 0; i < MAX_ICALS; ++i) nextIcalTimes[i] = 0;
+  lastIcalFetch = 0;
 
-void sendJsonError(const String &msg) {
-  sendJsonErrorTo(server, msg);
-}
+  if (readConfigSnapshot()) return;
 
-String buildConfigJson() {
-  DynamicJsonDocument doc(2048);
-  doc["brightness"] = configState.brightness;
-  doc["mode"] = configState.mode;
-  doc["tz"] = configState.tz;
-  doc["icalUrl"] = configState.icalUrl;
-  doc["icalColor"] = configState.icalColor;
-  JsonArray icalsConfig = doc["icals"].to<JsonArray>();
-  for (int i = 0; i < configState.icalCount; ++i) {
-    JsonObject ic = icalsConfig.add<JsonObject>();
-    ic["url"] = configState.icals[i].url;
-    ic["color"] = configState.icals[i].color;
+  if (!LittleFS.exists(FILE_CONFIG)) {
+    Serial.println("Config file missing, using defaults.");
+    // default opening hours 08:00-16:00 Mon-Fri
+    for (int i = 0; i < 7; ++i) {
+      configState.hours[i].start = (i == 0 || i == 6) ? "00:00" : "08:00";
+      configState.hours[i].end = (i == 0 || i == 6) ? "00:00" : "16:00";
+    }
+    saveConfig();
+    return;
   }
-  doc["appointmentTime"] = configState.appointmentTime;
-  doc["enableAppointments"] = configState.enableAppointments;
-  doc["enableOpenHours"] = configState.enableOpenHours;
-  doc["notifyMinutesBefore"] = configState.notifyMinutesBefore;
-  doc["openColor"] = configState.openColor;
-  doc["closedColor"] = configState.closedColor;
-  doc["clockColor"] = configState.clockColor;
-  doc["effect"] = configState.effect;
-  doc["effectColor"] = configState.effectColor;
-  doc["effectSpeed"] = configState.effectSpeed;
-  JsonArray hours = doc["hours"].to<JsonArray>();
-  for (int i = 0; i < 7; ++i) {
-    JsonObject h = hours.add<JsonObject>();
-    h["start"] = configState.hours[i].start;
-    h["end"] = configState.hours[i].end;
+  if (loadConfigJson()) {
+    Serial.println("Migrated config.json to binary snapshot");
+    saveConfig();
   }
-  String out;
-  serializeJson(doc, out);
-  return out;
 }
 
-String buildStatusJson() {
-  DynamicJsonDocument doc(256);
+// --------- Scenes ---------
+// Time-based overrides of mode, brightness and effect. The rules are compiled
+// into one week of segments, each holding which rule supplies which setting;
+// boundaries are every occurrence start and end, so a segment's winners are
+// fixed until the next boundary. At runtime the current segment and the epoch
+// of its end are cached: a frame only compares time(nullptr) against that
+// range, and the binary search runs on a transition, at the full hour (to
+// pick up DST changes) or after the clock jumped. (Unrelated to SceneKind,
+// which is what the renderer is presenting.)
+#define SCENE_RULE_NONE 0xff
+#define MAX_SCENE_SEGMENTS (MAX_SCENES * 7 * 2 + 1)
+
+struct SceneSegment {
+  uint32_t start; // second of the week, 0 = Sunday 00:00 local time
+  uint8_t mode;   // index of the rule supplying each setting, SCENE_RULE_NONE = base config
+  uint8_t brightness;
+  uint8_t effect;
+  uint8_t name;   // highest-priority active rule, for status
+};
+
+struct SceneState {
+  SceneSegment segments[MAX_SCENE_SEGMENTS];
+  uint8_t count = 0;
+  int16_t current = -1;             // segment in effect, -1 = none (no rules or clock unset)
+  uint32_t generation = UINT32_MAX; // scenes generation the segments were compiled from
+  uint32_t tzGeneration = 0;
+  time_t resolvedAt = 0;
+  time_t validUntil = 0;            // re-resolve once now reaches this
+  time_t nextChange = 0;            // epoch of the next segment boundary
+  uint32_t transitions = 0;
+  uint32_t resolves = 0;
+  unsigned long compileUs = 0;
+};
+
+SceneState sceneState;
+
+const SceneSegment *activeSceneSegment() {
+  if (sceneState.current < 0) return nullptr;
+  return &sceneState.segments[sceneState.current];
+}
+
+// Accepts HH:MM or HH:MM:SS, result in seconds after midnight.
+bool parseTimeHMS(const char *val, uint32_t &seconds) {
+  int h = -1, m = -1, sec = 0;
+  size_t len = val ? strlen(val) : 0;
+  if (len == 5 && sscanf(val, "%2d:%2d", &h, &m) != 2) return false;
+  if (len == 8 && sscanf(val, "%2d:%2d:%2d", &h, &m, &sec) != 3) return false;
+  if ((len != 5 && len != 8) || h < 0 || h > 23 || m < 0 || m > 59 || sec < 0 || sec > 59) return false;
+  seconds = (uint32_t)h * 3600 + m * 60 + sec;
+  return true;
+}
+
+String formatTimeHMS(uint32_t seconds) {
+  char buf[9];
+  if (seconds % 60) snprintf(buf, sizeof(buf), "%02u:%02u:%02u", seconds / 3600, seconds / 60 % 60, seconds % 60);
+  else snprintf(buf, sizeof(buf), "%02u:%02u", seconds / 3600, seconds / 60 % 60);
+  return String(buf);
+}
+
+bool parseSceneJson(JsonVariant v, SceneRule &out, String &errOut) {
+  out = SceneRule();
+  const char *name = v["name"] | "";
+  if (strlen(name) >= CFG_NAME_LEN) {
+    errOut = "scene name too long";
+    return false;
+  }
+  out.name = name;
+  if (!parseTimeHMS(v["start"].as<const char *>(), out.startSec)) {
+    errOut = "scene start must be HH:MM or HH:MM:SS";
+    return false;
+  }
+  if (const char *end = v["end"].as<const char *>()) {
+    uint32_t endSec = 0;
+    if (strlen(end) > 0) {
+      if (!parseTimeHMS(end, endSec)) {
+        errOut = "scene end must be HH:MM or HH:MM:SS";
+        return false;
+      }
+      out.endSec = endSec;
+    }
+  }
+  JsonArray days = v["days"].as<JsonArray>();
+  if (!days.isNull()) {
+    out.days = 0;
+    for (JsonVariant d : days) {
+      int day = d.as<int>();
+      if (day >= 0 && day <= 6) out.days |= 1 << day;
+    }
+  }
+  if (out.days == 0) {
+    errOut = "scene has no days";
+    return false;
+  }
+  if (const char *mode = v["mode"].as<const char *>()) {
+    out.mode = mode;
+    out.sets |= SCENE_SET_MODE;
+  }
+  if (v["brightness"].is<int>()) {
+    out.brightness = constrain(v["brightness"].as<int>(), 0, 255);
+    out.sets |= SCENE_SET_BRIGHTNESS;
+  }
+  if (const char *effect = v["effect"].as<const char *>()) {
+    out.effect = effect;
+    out.sets |= SCENE_SET_EFFECT;
+    // An effect scene without an explicit mode means "show this effect".
+    if (!(out.sets & SCENE_SET_MODE)) {
+      out.mode = "effect";
+      out.sets |= SCENE_SET_MODE;
+    }
+  }
+  if (out.mode.length() >= CFG_NAME_LEN || out.effect.length() >= CFG_NAME_LEN) {
+    errOut = "scene setting too long";
+    return false;
+  }
+  if (out.sets == 0) {
+    errOut = "scene sets nothing";
+    return false;
+  }
+  return true;
+}
+
+void sceneToJson(const SceneRule &rule, JsonObject out) {
+  out["name"] = rule.name;
+  JsonArray days = out["days"].to<JsonArray>();
+  for (int d = 0; d < 7; ++d) {
+    if (rule.days & (1 << d)) days.add(d);
+  }
+  out["start"] = formatTimeHMS(rule.startSec);
+  if (rule.endSec >= 0) out["end"] = formatTimeHMS(rule.endSec);
+  if (rule.sets & SCENE_SET_MODE) out["mode"] = rule.mode;
+  if (rule.sets & SCENE_SET_BRIGHTNESS) out["brightness"] = rule.brightness;
+  if (rule.sets & SCENE_SET_EFFECT) out["effect"] = rule.effect;
+}
+
+void compileScenes() {
+  unsigned long startUs = micros();
+  const int maxOcc = MAX_SCENES * 7;
+  uint32_t occStart[maxOcc];
+  uint32_t occLen[maxOcc];
+  uint8_t occRule[maxOcc];
+  int occ = 0;
+  for (int r = 0; r < configState.sceneCount; ++r) {
+    for (int d = 0; d < 7; ++d) {
+      if (!(configState.scenes[r].days & (1 << d))) continue;
+      occStart[occ] = d * SCENE_DAY_SEC + configState.scenes[r].startSec;
+      occRule[occ] = r;
+      occ++;
+    }
+  }
+  // Windows end at their end time (next day if it is not after the start);
+  // open-ended scenes run until the next open-ended start.
+  for (int i = 0; i < occ; ++i) {
+    const SceneRule &rule = configState.scenes[occRule[i]];
+    if (rule.endSec >= 0) {
+      uint32_t len = ((uint32_t)rule.endSec + SCENE_DAY_SEC - rule.startSec) % SCENE_DAY_SEC;
+      occLen[i] = len ? len : SCENE_DAY_SEC;
+      continue;
+    }
+    occLen[i] = SCENE_WEEK_SEC;
+    for (int j = 0; j < occ; ++j) {
+      if (configState.scenes[occRule[j]].endSec >= 0) continue;
+      uint32_t dist = (occStart[j] + SCENE_WEEK_SEC - occStart[i]) % SCENE_WEEK_SEC;
+      if (dist > 0 && dist < occLen[i]) occLen[i] = dist;
+    }
+  }
+
+  // Sorted, unique boundaries; 0 is always one so every second has a segment.
+  uint32_t bounds[MAX_SCENE_SEGMENTS];
+  int nb = 0;
+  auto addBound = [&](uint32_t b) {
+    int i = nb;
+    while (i > 0 && bounds[i - 1] > b) i--;
+    if (i > 0 && bounds[i - 1] == b) return;
+    memmove(&bounds[i + 1], &bounds[i], (nb - i) * sizeof(uint32_t));
+    bounds[i] = b;
+    nb++;
+  };
+  addBound(0);
+  for (int i = 0; i < occ; ++i) {
+    addBound(occStart[i]);
+    addBound((occStart[i] + occLen[i]) % SCENE_WEEK_SEC);
+  }
+
+  sceneState.count = 0;
+  for (int b = 0; b < nb; ++b) {
+    SceneSegment seg = {bounds[b], SCENE_RULE_NONE, SCENE_RULE_NONE, SCENE_RULE_NONE, SCENE_RULE_NONE};
+    for (int i = 0; i < occ; ++i) {
+      if ((bounds[b] + SCENE_WEEK_SEC - occStart[i]) % SCENE_WEEK_SEC >= occLen[i]) continue;
+      uint8_t r = occRule[i];
+      uint8_t sets = configState.scenes[r].sets;
+      if (seg.name == SCENE_RULE_NONE || r > seg.name) seg.name = r;
+      if ((sets & SCENE_SET_MODE) && (seg.mode == SCENE_RULE_NONE || r > seg.mode)) seg.mode = r;
+      if ((sets & SCENE_SET_BRIGHTNESS) && (seg.brightness == SCENE_RULE_NONE || r > seg.brightness)) seg.brightness = r;
+      if ((sets & SCENE_SET_EFFECT) && (seg.effect == SCENE_RULE_NONE || r > seg.effect)) seg.effect = r;
+    }
+    if (sceneState.count > 0) {
+      const SceneSegment &prev = sceneState.segments[sceneState.count - 1];
+      if (prev.mode == seg.mode && prev.brightness == seg.brightness && prev.effect == seg.effect && prev.name == seg.name) {
+        continue;
+      }
+    }
+    sceneState.segments[sceneState.count++] = seg;
+  }
+  sceneState.current = -1;
+  sceneState.validUntil = 0;
+  sceneState.compileUs = micros() - startUs;
+}
+
+// Segment containing the given second of the week (segments[0].start == 0).
+int findSceneSegment(uint32_t weekSec) {
+  int lo = 0, hi = sceneState.count - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (sceneState.segments[mid].start <= weekSec) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+void resolveScene(time_t now) {
+  struct tm tmNow;
+  localtime_r(&now, &tmNow);
+  uint32_t weekSec = tmNow.tm_wday * SCENE_DAY_SEC + tmNow.tm_hour * 3600 + tmNow.tm_min * 60 + tmNow.tm_sec;
+  int seg = findSceneSegment(weekSec);
+  uint32_t segEnd = seg + 1 < sceneState.count ? sceneState.segments[seg + 1].start : SCENE_WEEK_SEC;
+  sceneState.nextChange = now + (segEnd - weekSec);
+  time_t nextHour = now - now % 3600 + 3600;
+  sceneState.validUntil = min(sceneState.nextChange, nextHour);
+  sceneState.resolvedAt = now;
+  sceneState.resolves++;
+  if (seg == sceneState.current) return;
+  const SceneSegment &next = sceneState.segments[seg];
+  const SceneSegment *prev = activeSceneSegment();
+  sceneState.current = seg;
+  // Segments that only differ by position (e.g. across the week wrap) are not a transition.
+  if (prev && prev->mode == next.mode && prev->brightness == next.brightness && prev->effect == next.effect &&
+      prev->name == next.name) {
+    return;
+  }
+  sceneState.transitions++;
+  Serial.printf("[SCENE] %s\n", next.name == SCENE_RULE_NONE ? "(base config)" : configState.scenes[next.name].name.c_str());
+}
+
+// Called once per loop pass with the current time; O(1) unless a boundary was reached.
+void serviceScenes(time_t now) {
+  if (sceneState.generation != areaGeneration[CFG_AREA_SCENES]) {
+    compileScenes();
+    sceneState.generation = areaGeneration[CFG_AREA_SCENES];
+  }
+  if (sceneState.tzGeneration != areaGeneration[CFG_AREA_TZ]) {
+    sceneState.validUntil = 0; // same timeline, different local time
+    sceneState.tzGeneration = areaGeneration[CFG_AREA_TZ];
+  }
+  if (configState.sceneCount == 0 || !clockIsSet(now)) {
+    sceneState.current = -1;
+    return;
+  }
+  if (now >= sceneState.validUntil || now < sceneState.resolvedAt) resolveScene(now);
+}
+
+const String &activeMode() {
+  const SceneSegment *s = activeSceneSegment();
+  return s && s->mode != SCENE_RULE_NONE ? configState.scenes[s->mode].mode : configState.mode;
+}
+
+uint8_t activeBrightness() {
+  const SceneSegment *s = activeSceneSegment();
+  return s && s->brightness != SCENE_RULE_NONE ? configState.scenes[s->brightness].brightness : configState.brightness;
+}
+
+const String &activeEffect() {
+  const SceneSegment *s = activeSceneSegment();
+  return s && s->effect != SCENE_RULE_NONE ? configState.scenes[s->effect].effect : configState.effect;
+}
+
+void sendJsonErrorTo(WebServer &ws, const String &msg, int code = 400) {
+  DynamicJsonDocument doc(128);
+  doc["error"] = msg;
+  String out;
+  serializeJson(doc, out);
+  ws.send(code, "application/json", out);
+}
+
+void sendJsonError(const String &msg) {
+  sendJsonErrorTo(server, msg);
+}
+
+String buildConfigJson() {
+  DynamicJsonDocument doc(2048);
+  doc["brightness"] = configState.brightness;
+  doc["mode"] = configState.mode;
+  doc["tz"] = configState.tz;
+  doc["icalUrl"] = configState.icalUrl;
+  doc["icalColor"] = configState.icalColor;
+  JsonArray icalsConfig = doc["icals"].to<JsonArray>();
+  for (int i = 0; i < configState.icalCount; ++i) {
+    JsonObject ic = icalsConfig.add<JsonObject>();
+    ic["url"] = configState.icals[i].url;
+    ic["color"] = configState.icals[i].color;
+  }
+  doc["appointmentTime"] = configState.appointmentTime;
+  doc["enableAppointments"] = configState.enableAppointments;
+  doc["enableOpenHours"] = configState.enableOpenHours;
+  doc["notifyMinutesBefore"] = configState.notifyMinutesBefore;
+  doc["openColor"] = configState.openColor;
+  doc["closedColor"] = configState.closedColor;
+  doc["clockColor"] = configState.clockColor;
+  doc["clockStyle"] = configState.clockStyle;
+  doc["effect"] = configState.effect;
+  doc["effectColor"] = configState.effectColor;
+  doc["effectSpeed"] = configState.effectSpeed;
+  doc["powerBudgetMa"] = configState.powerBudgetMa;
+  doc["transitionMs"] = configState.transitionMs;
+  doc["realtimeEnabled"] = configState.realtimeEnabled;
+  doc["realtimeUniverse"] = configState.realtimeUniverse;
+  doc["realtimeTimeoutMs"] = configState.realtimeTimeoutMs;
+  doc["syncMode"] = configState.syncMode;
+  doc["syncGroup"] = configState.syncGroup;
+  doc["mqttEnabled"] = configState.mqttEnabled;
+  doc["mqttHost"] = configState.mqttHost;
+  doc["mqttPort"] = configState.mqttPort;
+  doc["mqttUser"] = configState.mqttUser;
+  doc["mqttPasswordSet"] = configState.mqttPassword.length() > 0;
+  doc["mqttTopic"] = configState.mqttTopic;
+  JsonArray scenes = doc["scenes"].to<JsonArray>();
+  for (int i = 0; i < configState.sceneCount; ++i) {
+    sceneToJson(configState.scenes[i], scenes.add<JsonObject>());
+  }
+  JsonArray hours = doc["hours"].to<JsonArray>();
+  for (int i = 0; i < 7; ++i) {
+    JsonObject h = hours.add<JsonObject>();
+    h["start"] = configState.hours[i].start;
+    h["end"] = configState.hours[i].end;
+  }
+  String out;
+  serializeJson(doc, out);
+  return out;
+}
+
+String buildStatusJson() {
+  DynamicJsonDocument doc(1024);
   time_t nowLocal = time(nullptr);
   AppointmentHit next = nextAnyAppointment(nowLocal);
   doc["wifi"] = WiFi.isConnected();
@@ -411,410 +2512,2066 @@ String buildStatusJson() {
   }
   doc["notifyMinutesBefore"] = configState.notifyMinutesBefore;
   doc["notifyActive"] = (next.when > 0) && (difftime(next.when, nowLocal) <= configState.notifyMinutesBefore * 60);
+  doc["powerMa"] = powerState.drawMa;
+  doc["powerRequestedMa"] = powerState.requestedMa;
+  doc["powerBudgetMa"] = configState.powerBudgetMa;
+  doc["powerLimited"] = powerState.limitScale < 255;
+  JsonObject boot = doc["boot"].to<JsonObject>();
+  boot["firstFrameMs"] = bootTimings.firstFrameMs;
+  boot["cachedFrame"] = bootTimings.cachedFrame;
+  boot["configMs"] = bootTimings.configMs;
+  boot["wifiMs"] = bootTimings.wifiMs;
+  boot["httpReadyMs"] = bootTimings.httpReadyMs;
+  JsonObject rt = doc["realtime"].to<JsonObject>();
+  rt["enabled"] = configState.realtimeEnabled;
+  rt["active"] = realtime.source != RT_NONE;
+  rt["source"] = RT_SOURCE_NAMES[realtime.source];
+  rt["fps"] = realtime.intervalUs > 0 ? 1000000.0f / realtime.intervalUs : 0.0f;
+  rt["jitterUs"] = (uint32_t)realtime.jitterUs;
+  rt["frames"] = realtime.frames;
+  rt["shown"] = realtime.shown;
+  rt["dropped"] = realtime.dropped;
+  rt["outOfOrder"] = realtime.outOfOrder;
+  rt["lost"] = realtime.lost;
+  rt["invalid"] = realtime.invalid;
+  JsonObject syncObj = doc["sync"].to<JsonObject>();
+  syncObj["mode"] = SYNC_MODE_NAMES[effectSync.mode];
+  syncObj["group"] = configState.syncGroup;
+  if (effectSync.mode == SYNC_LEADER) {
+    syncObj["sent"] = effectSync.sent;
+  } else if (effectSync.mode == SYNC_FOLLOWER) {
+    char leader[8];
+    snprintf(leader, sizeof(leader), "%06x", (unsigned)effectSync.leaderId);
+    syncObj["leader"] = leader;
+    syncObj["locked"] = effectSync.locked;
+    syncObj["errorUs"] = (int32_t)effectSync.lastErrUs;
+    syncObj["freqPpm"] = effectSync.freqPpb / 1000.0f;
+    syncObj["lastBeaconAgeMs"] = effectSync.received ? (uint32_t)((esp_timer_get_time() - effectSync.lastBeaconUs) / 1000) : 0;
+    syncObj["sameEffect"] = effectSync.received > 0 && effectSync.leaderKey == effectInputKey();
+    syncObj["received"] = effectSync.received;
+    syncObj["ignored"] = effectSync.ignored;
+    syncObj["steps"] = effectSync.steps;
+    syncObj["corrections"] = effectSync.corrections;
+  }
+  JsonObject esp = doc["esp"].to<JsonObject>();
+  esp["level"] = POWER_LEVEL_NAMES[powerMgr.level];
+  esp["cpuMhz"] = getCpuFrequencyMhz();
+  esp["avgMa"] = averageEspMa();
+  uint64_t tracked = powerMgr.activeMs + powerMgr.idleMs;
+  esp["idlePct"] = tracked ? (uint8_t)(powerMgr.idleMs * 100 / tracked) : 0;
+  esp["wakeups"] = powerMgr.wakeups;
+  JsonObject timeObj = doc["time"].to<JsonObject>();
+  timeObj["source"] = TIME_SOURCE_NAMES[timeStats.source];
+  timeObj["syncs"] = timeStats.syncs;
+  timeObj["lastSyncAgeS"] = timeStats.syncs ? (millis() - timeStats.lastSyncMs) / 1000UL : 0;
+  timeObj["lastOffsetMs"] = (int32_t)(timeStats.lastOffsetUs / 1000);
+  timeObj["driftPpm"] = timeStats.driftPpm;
+  timeObj["steps"] = timeStats.steps;
+  timeObj["slews"] = timeStats.slews;
+  timeObj["rejected"] = timeStats.rejected;
+  JsonObject sc = doc["scene"].to<JsonObject>();
+  const SceneSegment *seg = activeSceneSegment();
+  sc["active"] = seg && seg->name != SCENE_RULE_NONE;
+  if (seg && seg->name != SCENE_RULE_NONE) sc["name"] = configState.scenes[seg->name].name;
+  sc["mode"] = activeMode();
+  sc["brightness"] = activeBrightness();
+  sc["effect"] = activeEffect();
+  sc["nextChange"] = seg ? (uint32_t)sceneState.nextChange : 0;
+  sc["segments"] = sceneState.count;
+  sc["transitions"] = sceneState.transitions;
+  JsonObject itz = doc["icalTz"].to<JsonObject>();
+  itz["zones"] = tzCache.zoneCount;
+  itz["vtimezones"] = tzCache.vtimezones;
+  itz["unknownTzids"] = tzCache.unknownTzids;
+  itz["tableBuilds"] = tzCache.builds;
+  JsonObject ota = doc["ota"].to<JsonObject>();
+  ota["lastKind"] = otaStats.lastKind;
+  ota["lastOk"] = otaStats.lastOk;
+  ota["lastBytes"] = otaStats.lastBytes;
+  ota["lastImageBytes"] = otaStats.lastImageBytes;
+  ota["lastMs"] = otaStats.lastMs;
+  ota["deltaFallbacks"] = otaStats.deltaFallbacks;
+  JsonObject ap = doc["appointmentStore"].to<JsonObject>();
+  ap["count"] = apptStore.count;
+  ap["capacity"] = MAX_STORED_APPOINTMENTS;
+  ap["writes"] = apptStore.writes;
+  ap["pruned"] = apptStore.pruned;
+  ap["rejected"] = apptStore.rejected;
+  ap["lastCommitUs"] = (uint32_t)apptStore.lastCommitUs;
+  JsonObject mq = doc["mqtt"].to<JsonObject>();
+  mq["enabled"] = configState.mqttEnabled;
+  mq["connected"] = (bool)mqttStats.connected;
+  mq["connects"] = (uint32_t)mqttStats.connects;
+  mq["failures"] = (uint32_t)mqttStats.failures;
+  mq["published"] = (uint32_t)mqttStats.published;
+  mq["dropped"] = mqttStats.dropped;
+  mq["commands"] = mqttStats.commands;
+  mq["backoffMs"] = (uint32_t)mqttStats.backoffMs;
   doc["version"] = FW_VERSION;
   String out;
   serializeJson(doc, out);
   return out;
 }
 
-bool applyConfigJson(const String &body, String &errOut) {
-  DynamicJsonDocument doc(2048);
-  DeserializationError err = deserializeJson(doc, body);
-  if (err) {
-    errOut = "JSON parse error";
+// Assigns and records the area if the value actually differs.
+template <typename T, typename V>
+void setConfigValue(T &field, const V &value, ConfigArea area, uint32_t &changed) {
+  if (field == value) return;
+  field = value;
+  changed |= CFG_CHANGED(area);
+}
+
+bool sameScene(const SceneRule &a, const SceneRule &b) {
+  return a.name == b.name && a.days == b.days && a.startSec == b.startSec && a.endSec == b.endSec && a.sets == b.sets &&
+         a.mode == b.mode && a.brightness == b.brightness && a.effect == b.effect;
+}
+
+// True if the string value, when present, fits a snapshot field of `size` bytes.
+bool fitsField(JsonVariantConst v, size_t size) {
+  const char *s = v;
+  return !s || strlen(s) < size;
+}
+
+// Applies a config document. A full document (POST) resets the optional
+// fields it omits, as it always has; a patch (PATCH, MQTT) only touches the
+// fields present. `changed` gets the CFG_CHANGED() bits of the areas whose
+// values differ afterwards, so saveConfig() can skip the write and leave
+// unrelated derived state alone.
+bool applyConfigDoc(JsonVariantConst doc, bool patch, uint32_t &changed, String &errOut) {
+  changed = 0;
+  if (!doc.is<JsonObjectConst>()) {
+    errOut = "JSON object expected";
+    return false;
+  }
+  // Reject values the binary snapshot cannot hold instead of truncating them.
+  const char *tzIn = doc["tz"];
+  const char *icalUrlIn = doc["icalUrl"];
+  if (tzIn && strlen(tzIn) >= CFG_TZ_LEN) {
+    errOut = "tz too long";
+    return false;
+  }
+  bool urlTooLong = icalUrlIn && strlen(icalUrlIn) >= CFG_URL_LEN;
+  for (JsonVariantConst v : doc["icals"].as<JsonArrayConst>()) {
+    const char *url = v["url"];
+    if (url && strlen(url) >= CFG_URL_LEN) urlTooLong = true;
+  }
+  if (urlTooLong) {
+    errOut = "iCal URL too long";
+    return false;
+  }
+  const char *mqttHostIn = doc["mqttHost"];
+  const char *mqttUserIn = doc["mqttUser"];
+  const char *mqttPasswordIn = doc["mqttPassword"];
+  const char *mqttTopicIn = doc["mqttTopic"];
+  if ((mqttHostIn && strlen(mqttHostIn) >= CFG_HOST_LEN) || (mqttUserIn && strlen(mqttUserIn) >= CFG_NAME_LEN * 2) ||
+      (mqttPasswordIn && strlen(mqttPasswordIn) >= CFG_SECRET_LEN) || (mqttTopicIn && strlen(mqttTopicIn) >= CFG_TOPIC_LEN)) {
+    errOut = "MQTT setting too long";
+    return false;
+  }
+  bool colorsFit = fitsField(doc["icalColor"], CFG_COLOR_LEN) && fitsField(doc["openColor"], CFG_COLOR_LEN) &&
+                   fitsField(doc["closedColor"], CFG_COLOR_LEN) && fitsField(doc["clockColor"], CFG_COLOR_LEN) &&
+                   fitsField(doc["effectColor"], CFG_COLOR_LEN);
+  bool timesFit = fitsField(doc["appointmentTime"], CFG_DATETIME_LEN);
+  for (JsonVariantConst v : doc["icals"].as<JsonArrayConst>()) colorsFit &= fitsField(v["color"], CFG_COLOR_LEN);
+  for (JsonVariantConst v : doc["appointments"].as<JsonArrayConst>()) {
+    colorsFit &= fitsField(v["color"], CFG_COLOR_LEN);
+    timesFit &= fitsField(v["time"], CFG_DATETIME_LEN);
+  }
+  for (JsonVariantConst v : doc["hours"].as<JsonArrayConst>()) {
+    timesFit &= fitsField(v["start"], CFG_HM_LEN) && fitsField(v["end"], CFG_HM_LEN);
+  }
+  if (!colorsFit) {
+    errOut = "color too long";
+    return false;
+  }
+  if (!timesFit) {
+    errOut = "time too long";
     return false;
   }
+  if (!fitsField(doc["mode"], CFG_NAME_LEN) || !fitsField(doc["clockStyle"], CFG_NAME_LEN) || !fitsField(doc["effect"], CFG_NAME_LEN)) {
+    errOut = "mode, clockStyle or effect too long";
+    return false;
+  }
+  const char *syncModeIn = doc["syncMode"];
+  if (syncModeIn && syncModeFromName(syncModeIn) < 0) {
+    errOut = "syncMode must be off, leader or follower";
+    return false;
+  }
+  // Scenes are parsed up front so an invalid rule leaves the config untouched.
+  static SceneRule scenesIn[MAX_SCENES];
+  int sceneCountIn = -1;
+  JsonArrayConst scenesJson = doc["scenes"].as<JsonArrayConst>();
+  if (!scenesJson.isNull()) {
+    if (scenesJson.size() > MAX_SCENES) {
+      errOut = "too many scenes";
+      return false;
+    }
+    sceneCountIn = 0;
+    for (JsonVariantConst v : scenesJson) {
+      if (!parseSceneJson(v, scenesIn[sceneCountIn], errOut)) return false;
+      sceneCountIn++;
+    }
+  }
+
   if (doc["brightness"].is<int>()) {
-    configState.brightness = doc["brightness"].as<int>();
+    setConfigValue(configState.brightness, (uint8_t)constrain(doc["brightness"].as<int>(), 0, 255), CFG_AREA_GENERAL, changed);
   }
-  if (const char *v = doc["mode"]) configState.mode = v;
-  if (const char *v = doc["tz"]) configState.tz = v;
-  if (const char *v = doc["icalUrl"]) configState.icalUrl = v; else configState.icalUrl = "";
-  if (const char *v = doc["icalColor"]) configState.icalColor = v; else configState.icalColor = DEFAULT_APPOINT_COLOR;
-  configState.enableAppointments = doc["enableAppointments"].is<bool>() ? doc["enableAppointments"].as<bool>() : true;
-  configState.enableOpenHours = doc["enableOpenHours"].is<bool>() ? doc["enableOpenHours"].as<bool>() : true;
-  if (const char *v = doc["appointmentTime"]) configState.appointmentTime = v;
-  if (doc["notifyMinutesBefore"].is<int>()) configState.notifyMinutesBefore = doc["notifyMinutesBefore"].as<int>();
-  if (const char *v = doc["openColor"]) configState.openColor = v;
-  if (const char *v = doc["closedColor"]) configState.closedColor = v;
-  if (const char *v = doc["clockColor"]) configState.clockColor = v;
-  if (const char *v = doc["effect"]) configState.effect = v;
-  if (const char *v = doc["effectColor"]) configState.effectColor = v;
-  if (doc["effectSpeed"].is<int>()) configState.effectSpeed = constrain(doc["effectSpeed"].as<int>(), 1, 20);
-
-  JsonArray appts = doc["appointments"].as<JsonArray>();
+  if (const char *v = doc["mode"]) setConfigValue(configState.mode, v, CFG_AREA_GENERAL, changed);
+  if (const char *v = doc["tz"]) setConfigValue(configState.tz, v, CFG_AREA_TZ, changed);
+  if (const char *v = doc["icalUrl"]) setConfigValue(configState.icalUrl, v, CFG_AREA_ICAL, changed);
+  else if (!patch) setConfigValue(configState.icalUrl, "", CFG_AREA_ICAL, changed);
+  if (const char *v = doc["icalColor"]) setConfigValue(configState.icalColor, v, CFG_AREA_ICAL, changed);
+  else if (!patch) setConfigValue(configState.icalColor, DEFAULT_APPOINT_COLOR, CFG_AREA_ICAL, changed);
+  if (doc["enableAppointments"].is<bool>() || !patch) {
+    setConfigValue(configState.enableAppointments, doc["enableAppointments"] | true, CFG_AREA_GENERAL, changed);
+  }
+  if (doc["enableOpenHours"].is<bool>() || !patch) {
+    setConfigValue(configState.enableOpenHours, doc["enableOpenHours"] | true, CFG_AREA_GENERAL, changed);
+  }
+  if (const char *v = doc["appointmentTime"]) setConfigValue(configState.appointmentTime, v, CFG_AREA_APPOINTMENTS, changed);
+  if (doc["notifyMinutesBefore"].is<int>()) {
+    setConfigValue(configState.notifyMinutesBefore, doc["notifyMinutesBefore"].as<uint16_t>(), CFG_AREA_GENERAL, changed);
+  }
+  if (const char *v = doc["openColor"]) setConfigValue(configState.openColor, v, CFG_AREA_GENERAL, changed);
+  if (const char *v = doc["closedColor"]) setConfigValue(configState.closedColor, v, CFG_AREA_GENERAL, changed);
+  if (const char *v = doc["clockColor"]) setConfigValue(configState.clockColor, v, CFG_AREA_GENERAL, changed);
+  if (const char *v = doc["clockStyle"]) setConfigValue(configState.clockStyle, v, CFG_AREA_GENERAL, changed);
+  if (const char *v = doc["effect"]) setConfigValue(configState.effect, v, CFG_AREA_GENERAL, changed);
+  if (const char *v = doc["effectColor"]) setConfigValue(configState.effectColor, v, CFG_AREA_GENERAL, changed);
+  if (doc["effectSpeed"].is<int>()) {
+    setConfigValue(configState.effectSpeed, (uint8_t)constrain(doc["effectSpeed"].as<int>(), 1, 20), CFG_AREA_GENERAL, changed);
+  }
+  if (doc["powerBudgetMa"].is<int>()) {
+    setConfigValue(configState.powerBudgetMa, (uint16_t)constrain(doc["powerBudgetMa"].as<int>(), 0, 60000), CFG_AREA_GENERAL, changed);
+  }
+  if (doc["transitionMs"].is<int>()) {
+    setConfigValue(configState.transitionMs, (uint16_t)constrain(doc["transitionMs"].as<int>(), 0, 5000), CFG_AREA_GENERAL, changed);
+  }
+  if (doc["realtimeEnabled"].is<bool>()) {
+    setConfigValue(configState.realtimeEnabled, doc["realtimeEnabled"].as<bool>(), CFG_AREA_REALTIME, changed);
+  }
+  if (doc["realtimeUniverse"].is<int>()) {
+    setConfigValue(configState.realtimeUniverse, (uint16_t)constrain(doc["realtimeUniverse"].as<int>(), 1, 63999), CFG_AREA_REALTIME, changed);
+  }
+  if (doc["realtimeTimeoutMs"].is<int>()) {
+    // Read on every pass, the sockets do not need reopening.
+    setConfigValue(configState.realtimeTimeoutMs, (uint16_t)constrain(doc["realtimeTimeoutMs"].as<int>(), 500, 60000), CFG_AREA_GENERAL, changed);
+  }
+  if (syncModeIn) setConfigValue(configState.syncMode, syncModeIn, CFG_AREA_SYNC, changed);
+  if (doc["syncGroup"].is<int>()) {
+    setConfigValue(configState.syncGroup, (uint8_t)constrain(doc["syncGroup"].as<int>(), 1, 255), CFG_AREA_SYNC, changed);
+  }
+  if (doc["mqttEnabled"].is<bool>()) setConfigValue(configState.mqttEnabled, doc["mqttEnabled"].as<bool>(), CFG_AREA_MQTT, changed);
+  if (const char *v = doc["mqttHost"]) setConfigValue(configState.mqttHost, v, CFG_AREA_MQTT, changed);
+  if (doc["mqttPort"].is<int>()) {
+    setConfigValue(configState.mqttPort, (uint16_t)constrain(doc["mqttPort"].as<int>(), 1, 65535), CFG_AREA_MQTT, changed);
+  }
+  if (const char *v = doc["mqttUser"]) setConfigValue(configState.mqttUser, v, CFG_AREA_MQTT, changed);
+  if (const char *v = doc["mqttPassword"]) setConfigValue(configState.mqttPassword, v, CFG_AREA_MQTT, changed); // absent = keep
+  if (const char *v = doc["mqttTopic"]) {
+    if (strlen(v) > 0) setConfigValue(configState.mqttTopic, v, CFG_AREA_MQTT, changed);
+  }
+
+  if (sceneCountIn >= 0) {
+    bool same = sceneCountIn == configState.sceneCount;
+    for (int i = 0; same && i < sceneCountIn; ++i) same = sameScene(scenesIn[i], configState.scenes[i]);
+    if (!same) {
+      for (int i = 0; i < sceneCountIn; ++i) configState.scenes[i] = scenesIn[i];
+      configState.sceneCount = sceneCountIn;
+      changed |= CFG_CHANGED(CFG_AREA_SCENES);
+    }
+  }
+
+  JsonArrayConst appts = doc["appointments"].as<JsonArrayConst>();
   if (!appts.isNull()) {
-    configState.appointmentCount = 0;
-    for (JsonVariant v : appts) {
-      if (configState.appointmentCount >= MAX_APPOINTMENTS) break;
+    uint8_t count = 0;
+    for (JsonVariantConst v : appts) {
+      if (count >= MAX_APPOINTMENTS) break;
       const char *t = v["time"].as<const char *>();
       const char *c = v["color"].as<const char *>();
       if (t) {
-        configState.appointments[configState.appointmentCount].time = t;
-        configState.appointments[configState.appointmentCount].color = c ? c : DEFAULT_APPOINT_COLOR;
-        configState.appointmentCount++;
+        setConfigValue(configState.appointments[count].time, t, CFG_AREA_APPOINTMENTS, changed);
+        setConfigValue(configState.appointments[count].color, c ? c : DEFAULT_APPOINT_COLOR, CFG_AREA_APPOINTMENTS, changed);
+        count++;
       }
     }
+    setConfigValue(configState.appointmentCount, count, CFG_AREA_APPOINTMENTS, changed);
   }
 
-  JsonArray hours = doc["hours"].as<JsonArray>();
+  JsonArrayConst hours = doc["hours"].as<JsonArrayConst>();
   for (int i = 0; i < 7 && i < hours.size(); ++i) {
-    if (const char *s = hours[i]["start"]) configState.hours[i].start = s;
-    if (const char *e = hours[i]["end"]) configState.hours[i].end = e;
+    if (const char *s = hours[i]["start"]) setConfigValue(configState.hours[i].start, s, CFG_AREA_GENERAL, changed);
+    if (const char *e = hours[i]["end"]) setConfigValue(configState.hours[i].end, e, CFG_AREA_GENERAL, changed);
   }
 
-  // iCal list
-  configState.icalCount = 0;
-  JsonArray icalsApply = doc["icals"].as<JsonArray>();
-  if (!icalsApply.isNull()) {
-    for (JsonVariant v : icalsApply) {
-      if (configState.icalCount >= MAX_ICALS) break;
-      const char *url = v["url"].as<const char *>();
-      const char *color = v["color"].as<const char *>();
-      if (url && strlen(url) > 0) {
-        configState.icals[configState.icalCount].url = url;
-        configState.icals[configState.icalCount].color = color ? color : configState.icalColor;
-        configState.icalCount++;
-      }
+  // iCal list: a full document always carries it (missing = none), a patch only when edited.
+  IcalSource icals[MAX_ICALS];
+  uint8_t icalCount = 0;
+  JsonArrayConst icalsApply = doc["icals"].as<JsonArrayConst>();
+  if (patch && icalsApply.isNull()) {
+    for (; icalCount < configState.icalCount; ++icalCount) icals[icalCount] = configState.icals[icalCount];
+  }
+  for (JsonVariantConst v : icalsApply) {
+    if (icalCount >= MAX_ICALS) break;
+    const char *url = v["url"].as<const char *>();
+    const char *color = v["color"].as<const char *>();
+    if (url && strlen(url) > 0) {
+      icals[icalCount].url = url;
+      icals[icalCount].color = color ? color : configState.icalColor;
+      icalCount++;
     }
   }
-  if (configState.icalCount == 0 && configState.icalUrl.length() > 0) {
-    configState.icals[0].url = configState.icalUrl;
-    configState.icals[0].color = configState.icalColor;
-    configState.icalCount = 1;
+  if (icalCount == 0 && configState.icalUrl.length() > 0) {
+    icals[0].url = configState.icalUrl;
+    icals[0].color = configState.icalColor;
+    icalCount = 1;
   }
-
-  for (int i = 0; i < MAX_ICALS; ++i) nextIcalTimes[i] = 0;
-  lastIcalFetch = 0;
-
+  for (int i = 0; i < icalCount; ++i) {
+    setConfigValue(configState.icals[i].url, icals[i].url, CFG_AREA_ICAL, changed);
+    setConfigValue(configState.icals[i].color, icals[i].color, CFG_AREA_ICAL, changed);
+  }
+  setConfigValue(configState.icalCount, icalCount, CFG_AREA_ICAL, changed);
   return true;
 }
 
-// --------- OTA update from URL ---------
-bool performUpdate(const String &url, bool isFs = false) {
-  HTTPClient http;
-  http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
-  Serial.printf("[OTA] Starte %s-Update: %s\n", isFs ? "FS" : "FW", url.c_str());
-  http.setTimeout(20000); // 20s socket timeout to survive slow links
-  http.begin(url);
-  int httpCode = http.GET();
-  if (httpCode != HTTP_CODE_OK) {
-    Serial.printf("Update HTTP error: %d\n", httpCode);
-    http.end();
+bool applyConfigJson(const String &body, bool patch, uint32_t &changed, String &errOut) {
+  DynamicJsonDocument doc(2048);
+  DeserializationError err = deserializeJson(doc, body);
+  if (err) {
+    errOut = "JSON parse error";
     return false;
   }
+  return applyConfigDoc(doc, patch, changed, errOut);
+}
 
-  int len = http.getSize();
-  Serial.printf("[OTA] HTTP OK, size=%d Bytes (kann -1 sein)\n", len);
-  WiFiClient *stream = http.getStreamPtr();
-  if (!Update.begin(len, isFs ? U_SPIFFS : U_FLASH)) {
-    Serial.println("Not enough space for update");
-    http.end();
-    return false;
+// --------- Request bodies ---------
+// Endpoints that take a body are registered with onBody() instead of on().
+// Their handler asks WebServer for the raw body, which then arrives in
+// HTTP_RAW_BUFLEN chunks instead of being collected into arg("plain"). The
+// chunks are appended to one static arena; a Content-Length over
+// BODY_MAX_BYTES gets its 413 before the first byte is read. Documents parsed
+// from the body allocate from the rest of the same arena (it is an
+// ArduinoJson allocator). Nothing in it is freed piecemeal: the arena is
+// reset when a request starts and after its handler ran, so API traffic of
+// any size or shape leaves the heap where it was.
+#define BODY_ARENA_BYTES (24 * 1024)
+#define BODY_MAX_BYTES (16 * 1024) // the remaining 8 KB are for the parsed document
+#define BODY_ALIGN 8
+
+struct BodyArena : ArduinoJson::Allocator {
+  size_t bodyLen = 0;
+  size_t top = 0;          // end of the last allocation
+  size_t last = SIZE_MAX;  // header offset of the last allocation, if it may still grow or be freed
+  bool answered = false;   // response already sent while the body came in (413)
+  size_t highWater = 0;
+  uint32_t requests = 0;
+  uint32_t tooLarge = 0;
+  uint32_t noMemory = 0;
+  alignas(BODY_ALIGN) uint8_t buf[BODY_ARENA_BYTES];
+
+  static size_t alignUp(size_t n) { return (n + BODY_ALIGN - 1) & ~(size_t)(BODY_ALIGN - 1); }
+
+  void reset() {
+    bodyLen = top = 0;
+    last = SIZE_MAX;
+    answered = false;
   }
 
-  const size_t bufSize = 1024;
-  uint8_t buf[bufSize];
-  size_t written = 0;
-  unsigned long lastProgress = millis();
-  const unsigned long timeoutMs = 60000; // 60s ohne Fortschritt => Abbruch
+  // Drops every document allocation but keeps the body.
+  void resetPool() {
+    top = alignUp(bodyLen);
+    last = SIZE_MAX;
+  }
 
-  while (stream->connected() && (len < 0 || written < (size_t)len)) {
-    size_t avail = stream->available();
-    if (avail) {
-      size_t toRead = avail > bufSize ? bufSize : avail;
-      int r = stream->readBytes(buf, toRead);
-      if (r > 0) {
-        if (Update.write(buf, r) != r) {
-          Serial.println("[OTA] Write error");
-          http.end();
-          return false;
-        }
-        written += r;
-        lastProgress = millis();
-        showOtaProgress(written, len, isFs);
-        if (written % 262144 < (size_t)r) { // alle ~256KB
-          Serial.printf("[OTA] Fortschritt: %u Bytes\n", (unsigned)written);
-        }
-      }
-    } else {
-      delay(25);
+  // Only valid before the first allocation of the request.
+  bool append(const uint8_t *data, size_t len) {
+    if (bodyLen + len > BODY_MAX_BYTES) return false;
+    memcpy(buf + bodyLen, data, len);
+    bodyLen += len;
+    resetPool();
+    return true;
+  }
+
+  // Blocks carry their size in an aligned header so reallocate() can copy.
+  void *allocate(size_t size) override {
+    size_t end = top + BODY_ALIGN + alignUp(size);
+    if (end > BODY_ARENA_BYTES) {
+      noMemory++;
+      return nullptr;
     }
-    if (millis() - lastProgress > timeoutMs) {
-      Serial.println("[OTA] Timeout ohne Fortschritt");
+    *(size_t *)(buf + top) = size;
+    last = top;
+    top = end;
+    highWater = max(highWater, top);
+    return buf + last + BODY_ALIGN;
+  }
+
+  // Only the newest block is given back; anything else waits for the reset.
+  void deallocate(void *p) override {
+    if (p && (uint8_t *)p - BODY_ALIGN == buf + last) {
+      top = last;
+      last = SIZE_MAX;
+    }
+  }
+
+  void *reallocate(void *p, size_t size) override {
+    if (!p) return allocate(size);
+    size_t at = (uint8_t *)p - BODY_ALIGN - buf;
+    size_t old = *(size_t *)(buf + at);
+    if (at == last) { // newest block grows or shrinks in place
+      size_t end = at + BODY_ALIGN + alignUp(size);
+      if (end > BODY_ARENA_BYTES) {
+        noMemory++;
+        return nullptr;
+      }
+      *(size_t *)(buf + at) = size;
+      top = end;
+      highWater = max(highWater, top);
+      return p;
+    }
+    if (size <= old) return p;
+    void *q = allocate(size);
+    if (q) memcpy(q, p, old);
+    return q;
+  }
+};
+
+static BodyArena bodyArena;
+
+// Reads the body as a stream, so arrays can be parsed one element at a time.
+struct BodyReader {
+  size_t pos = 0;
+
+  int read() { return pos < bodyArena.bodyLen ? bodyArena.buf[pos++] : -1; }
+
+  size_t readBytes(char *out, size_t n) {
+    n = min(n, bodyArena.bodyLen - pos);
+    memcpy(out, bodyArena.buf + pos, n);
+    pos += n;
+    return n;
+  }
+
+  // Next character after whitespace, without consuming it; -1 at the end.
+  int peekToken() {
+    while (pos < bodyArena.bodyLen && isspace(bodyArena.buf[pos])) pos++;
+    return pos < bodyArena.bodyLen ? bodyArena.buf[pos] : -1;
+  }
+};
+
+void sendBodyTooLarge(WebServer &srv) {
+  bodyArena.tooLarge++;
+  sendJsonErrorTo(srv, "body too large (max " + String(BODY_MAX_BYTES) + " bytes)", 413);
+}
+
+// Parses the whole body into doc, which must use bodyArena as allocator.
+// Sends the error response and returns false on failure.
+bool parseRequestBody(WebServer &srv, JsonDocument &doc) {
+  DeserializationError err = deserializeJson(doc, (const char *)bodyArena.buf, bodyArena.bodyLen);
+  if (err == DeserializationError::NoMemory) {
+    sendBodyTooLarge(srv);
+    return false;
+  }
+  if (err) {
+    sendJsonErrorTo(srv, "JSON parse error");
+    return false;
+  }
+  return true;
+}
+
+// Body is a JSON array: fn gets each element from its own document, whose
+// memory is dropped before the next one is parsed. The pool only ever holds
+// one element, however long the array is.
+template <typename Fn>
+bool forEachBodyElement(WebServer &srv, Fn fn) {
+  BodyReader in;
+  if (in.peekToken() != '[') {
+    sendJsonErrorTo(srv, "JSON array expected");
+    return false;
+  }
+  in.pos++;
+  if (in.peekToken() == ']') return true;
+  for (;;) {
+    {
+      JsonDocument doc(&bodyArena);
+      DeserializationError err = deserializeJson(doc, in);
+      if (err == DeserializationError::NoMemory) {
+        sendBodyTooLarge(srv);
+        return false;
+      }
+      if (err) {
+        sendJsonErrorTo(srv, "JSON parse error");
+        return false;
+      }
+      fn(doc.as<JsonVariantConst>());
+    }
+    bodyArena.resetPool();
+    int c = in.peekToken();
+    in.pos++;
+    if (c == ']') return true;
+    if (c != ',') {
+      sendJsonErrorTo(srv, "JSON parse error");
+      return false;
+    }
+  }
+}
+
+bool bodyIsArray() {
+  BodyReader in;
+  return in.peekToken() == '[';
+}
+
+// Receives chunks of a body that is not kept in the arena (appointment import).
+typedef void (*BodyChunkFn)(WebServer &srv, HTTPRawStatus status, const uint8_t *data, size_t len);
+
+class BodyHandler : public RequestHandler {
+ public:
+  BodyHandler(const char *uri, HTTPMethod method, WebServer::THandlerFunction fn, BodyChunkFn chunks)
+      : _uri(uri), _method(method), _fn(fn), _chunks(chunks) {}
+
+  bool canHandle(HTTPMethod method, String uri) override { return method == _method && uri == _uri; }
+  bool canRaw(String uri) override { return uri == _uri; }
+  bool canUpload(String uri) override { return _chunks && uri == _uri; }
+
+  void raw(WebServer &srv, String uri, HTTPRaw &raw) override {
+    if (raw.status == RAW_START) {
+      bodyArena.reset();
+      bodyArena.requests++;
+      // Answer now; the rest of the body is still read (into WebServer's
+      // chunk buffer, not the heap) so the client gets the 413, not a reset.
+      if (!_chunks && srv.clientContentLength() > BODY_MAX_BYTES) {
+        sendBodyTooLarge(srv);
+        bodyArena.answered = true;
+      }
+    }
+    if (_chunks) return _chunks(srv, raw.status, raw.buf, raw.status == RAW_WRITE ? raw.currentSize : 0);
+    if (raw.status == RAW_WRITE && !bodyArena.answered && !bodyArena.append(raw.buf, raw.currentSize)) {
+      sendBodyTooLarge(srv);
+      bodyArena.answered = true;
+    }
+    if (raw.status == RAW_ABORTED) bodyArena.reset();
+  }
+
+  void upload(WebServer &srv, String uri, HTTPUpload &up) override {
+    static const HTTPRawStatus STATUS[] = {RAW_START, RAW_WRITE, RAW_END, RAW_ABORTED};
+    if (up.status == UPLOAD_FILE_START) {
+      bodyArena.reset();
+      bodyArena.requests++;
+    }
+    _chunks(srv, STATUS[up.status], up.buf, up.status == UPLOAD_FILE_WRITE ? up.currentSize : 0);
+  }
+
+  bool handle(WebServer &srv, HTTPMethod method, String uri) override {
+    if (!canHandle(method, uri)) return false;
+    if (!bodyArena.answered) _fn();
+    bodyArena.reset();
+    return true;
+  }
+
+ private:
+  String _uri;
+  HTTPMethod _method;
+  WebServer::THandlerFunction _fn;
+  BodyChunkFn _chunks;
+};
+
+void onBody(WebServer &srv, const char *uri, HTTPMethod method, WebServer::THandlerFunction fn, BodyChunkFn chunks = nullptr) {
+  srv.addHandler(new BodyHandler(uri, method, fn, chunks));
+}
+
+// Requests with a body that no onBody() route claimed: without a raw handler
+// WebServer would read them into a heap buffer of Content-Length bytes. This
+// one takes them through the arena as well (413 over BODY_MAX_BYTES) and then
+// runs fn. Registered after the onBody() routes, before any on() route that
+// accepts these methods. Multipart forms do not use the raw path; their file
+// parts are streamed and dropped by WebServer, only text fields are kept.
+class UnclaimedBodyHandler : public BodyHandler {
+ public:
+  explicit UnclaimedBodyHandler(WebServer::THandlerFunction fn) : BodyHandler("", HTTP_ANY, fn, nullptr) {}
+
+  bool canHandle(HTTPMethod method, String uri) override {
+    return method == HTTP_POST || method == HTTP_PUT || method == HTTP_PATCH || method == HTTP_DELETE;
+  }
+  bool canRaw(String uri) override { return true; }
+};
+
+bool applyConfigBody(WebServer &srv, bool patch, uint32_t &changed) {
+  JsonDocument doc(&bodyArena);
+  if (!parseRequestBody(srv, doc)) return false;
+  String err;
+  if (!applyConfigDoc(doc, patch, changed, err)) {
+    sendJsonErrorTo(srv, err);
+    return false;
+  }
+  return true;
+}
+
+// --------- OTA update from URL ---------
+void recordOtaResult(const char *kind, bool ok, size_t downloaded, size_t imageBytes, unsigned long startMs) {
+  otaStats.lastKind = kind;
+  otaStats.lastOk = ok;
+  otaStats.lastBytes = downloaded;
+  otaStats.lastImageBytes = imageBytes;
+  otaStats.lastMs = millis() - startMs;
+  Serial.printf("[OTA] %s: %s, %u Bytes geladen, %u ms\n", kind, ok ? "ok" : "fehlgeschlagen", (unsigned)downloaded,
+                (unsigned)otaStats.lastMs);
+}
+
+bool streamFullImage(const String &url, bool isFs, size_t &written) {
+  HTTPClient http;
+  http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+  Serial.printf("[OTA] Starte %s-Update: %s\n", isFs ? "FS" : "FW", url.c_str());
+  http.setTimeout(20000); // 20s socket timeout to survive slow links
+  http.begin(url);
+  int httpCode = http.GET();
+  if (httpCode != HTTP_CODE_OK) {
+    Serial.printf("Update HTTP error: %d\n", httpCode);
+    http.end();
+    return false;
+  }
+
+  int len = http.getSize();
+  Serial.printf("[OTA] HTTP OK, size=%d Bytes (kann -1 sein)\n", len);
+  WiFiClient *stream = http.getStreamPtr();
+  if (!Update.begin(len, isFs ? U_SPIFFS : U_FLASH)) {
+    Serial.println("Not enough space for update");
+    http.end();
+    return false;
+  }
+
+  const size_t bufSize = 1024;
+  uint8_t buf[bufSize];
+  unsigned long lastProgress = millis();
+  const unsigned long timeoutMs = 60000; // 60s ohne Fortschritt => Abbruch
+
+  while (stream->connected() && (len < 0 || written < (size_t)len)) {
+    size_t avail = stream->available();
+    if (avail) {
+      size_t toRead = avail > bufSize ? bufSize : avail;
+      int r = stream->readBytes(buf, toRead);
+      if (r > 0) {
+        if (Update.write(buf, r) != r) {
+          Serial.println("[OTA] Write error");
+          http.end();
+          return false;
+        }
+        written += r;
+        lastProgress = millis();
+        showOtaProgress(written, len, isFs);
+        if (written % 262144 < (size_t)r) { // alle ~256KB
+          Serial.printf("[OTA] Fortschritt: %u Bytes\n", (unsigned)written);
+        }
+      }
+    } else {
+      delay(25);
+    }
+    if (millis() - lastProgress > timeoutMs) {
+      Serial.println("[OTA] Timeout ohne Fortschritt");
       http.end();
       return false;
     }
   }
 
-  Serial.printf("[OTA] Geschrieben: %u Bytes\n", (unsigned)written);
-  if (len >= 0 && written != (size_t)len) {
-    Serial.println("Update incomplete");
-    http.end();
-    return false;
+  Serial.printf("[OTA] Geschrieben: %u Bytes\n", (unsigned)written);
+  if (len >= 0 && written != (size_t)len) {
+    Serial.println("Update incomplete");
+    http.end();
+    return false;
+  }
+
+  if (!Update.end()) {
+    Serial.printf("Update failed: %s\n", Update.errorString());
+    http.end();
+    return false;
+  }
+
+  http.end();
+  Serial.printf("[OTA] %s-Update erfolgreich, reboot folgt.\n", isFs ? "FS" : "FW");
+  return Update.isFinished();
+}
+
+bool performUpdate(const String &url, bool isFs = false) {
+  unsigned long startMs = millis();
+  size_t written = 0;
+  bool ok = streamFullImage(url, isFs, written);
+  recordOtaResult(isFs ? "fs" : "full", ok, written, written, startMs);
+  return ok;
+}
+
+// Perform FS update but restore config afterwards so user settings survive.
+bool updateFsPreserveConfig(const String &url) {
+  if (!performUpdate(url, true)) return false;
+
+  LittleFS.end();
+  if (!LittleFS.begin()) {
+    Serial.println("LittleFS remount failed after update");
+    return false;
+  }
+
+  // The new image wiped the snapshot and the appointment store; rewrite both
+  // from the copies in RAM.
+  if (!writeConfigSnapshot()) {
+    Serial.println("Failed to restore config after FS update");
+    return false;
+  }
+  if (!writeAppointmentStore()) {
+    Serial.println("Failed to restore appointments after FS update");
+    return false;
+  }
+  return true;
+}
+
+// --------- Delta OTA ---------
+// LSD1 patches (tools/make_delta.py, published by the release workflow as
+// firmware.delta) rebuild the new image from the running one: COPY records add
+// a diff to bytes of the running partition, INSERT records carry new bytes.
+// The record stream is zlib-compressed and inflated with the ROM inflater
+// into a 32 KB window; old bytes are read in small chunks, the result goes
+// straight to Update. Peak RAM is ~45 KB, allocated only during the update.
+// Both ends are SHA-256 checked: a patch built against another image is
+// rejected after its 76-byte header, a wrong result is never activated.
+#define DELTA_MAGIC "LSD1"
+#define DELTA_OP_END 0
+#define DELTA_OP_COPY 1
+#define DELTA_OP_INSERT 2
+#define DELTA_OLD_CHUNK 256
+
+struct DeltaHeader {
+  char magic[4];
+  uint32_t oldSize;
+  uint8_t oldSha[32];
+  uint32_t newSize;
+  uint8_t newSha[32];
+} __attribute__((packed));
+
+enum DeltaState : uint8_t { DELTA_OP, DELTA_LEN, DELTA_OFFSET, DELTA_COPY, DELTA_INSERT, DELTA_END, DELTA_ERROR };
+
+struct DeltaApplier {
+  const esp_partition_t *source = nullptr;
+  uint32_t oldSize = 0;
+  uint32_t newSize = 0;
+  DeltaState state = DELTA_OP;
+  uint8_t op = 0;
+  uint32_t varint = 0;
+  uint8_t varShift = 0;
+  uint32_t remaining = 0;
+  uint32_t oldCursor = 0;
+  uint32_t written = 0;
+  const char *error = nullptr;
+  uint8_t out[1024];
+  size_t outLen = 0;
+  uint8_t oldBuf[DELTA_OLD_CHUNK];
+  uint32_t oldBufStart = 0;
+  uint32_t oldBufLen = 0;
+  mbedtls_sha256_context sha;
+
+  void begin(const esp_partition_t *part, uint32_t oldBytes, uint32_t newBytes) {
+    source = part;
+    oldSize = oldBytes;
+    newSize = newBytes;
+    state = DELTA_OP;
+    oldCursor = 0;
+    written = 0;
+    outLen = 0;
+    oldBufLen = 0;
+    error = nullptr;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+  }
+
+  void fail(const char *why) {
+    if (state != DELTA_ERROR) error = why;
+    state = DELTA_ERROR;
+  }
+
+  // Accumulates a LEB128 varint; true once the last byte arrived.
+  bool readVarint(uint8_t b) {
+    if (varShift > 28) {
+      fail("varint too long");
+      return false;
+    }
+    varint |= (uint32_t)(b & 0x7f) << varShift;
+    varShift += 7;
+    return !(b & 0x80);
+  }
+
+  uint8_t oldByte(uint32_t pos) {
+    if (pos < oldBufStart || pos >= oldBufStart + oldBufLen) {
+      oldBufStart = pos;
+      oldBufLen = min((uint32_t)DELTA_OLD_CHUNK, oldSize - pos);
+      if (esp_partition_read(source, pos, oldBuf, oldBufLen) != ESP_OK) {
+        fail("flash read");
+        oldBufLen = 0;
+        return 0;
+      }
+    }
+    return oldBuf[pos - oldBufStart];
+  }
+
+  void flushOut() {
+    if (outLen == 0) return;
+    mbedtls_sha256_update(&sha, out, outLen);
+    if (Update.write(out, outLen) != outLen) fail("flash write");
+    outLen = 0;
+  }
+
+  void emit(uint8_t b) {
+    out[outLen++] = b;
+    written++;
+    if (outLen == sizeof(out)) flushOut();
+  }
+
+  // Feeds inflated record bytes; chunk boundaries may fall anywhere.
+  void consume(const uint8_t *data, size_t len) {
+    size_t i = 0;
+    while (i < len && state < DELTA_END) {
+      uint8_t b = data[i];
+      switch (state) {
+        case DELTA_OP:
+          i++;
+          op = b;
+          varint = 0;
+          varShift = 0;
+          if (op == DELTA_OP_END) state = DELTA_END;
+          else if (op == DELTA_OP_COPY || op == DELTA_OP_INSERT) state = DELTA_LEN;
+          else fail("bad record");
+          break;
+        case DELTA_LEN:
+          i++;
+          if (!readVarint(b) || state == DELTA_ERROR) break;
+          remaining = varint;
+          varint = 0;
+          varShift = 0;
+          if (remaining > newSize - written) fail("output too long");
+          else state = op == DELTA_OP_COPY ? DELTA_OFFSET : (remaining ? DELTA_INSERT : DELTA_OP);
+          break;
+        case DELTA_OFFSET: {
+          i++;
+          if (!readVarint(b) || state == DELTA_ERROR) break;
+          int64_t pos = (int64_t)oldCursor + ((int32_t)(varint >> 1) ^ -(int32_t)(varint & 1));
+          if (pos < 0 || pos + remaining > oldSize) {
+            fail("copy outside old image");
+            break;
+          }
+          oldCursor = (uint32_t)pos;
+          state = remaining ? DELTA_COPY : DELTA_OP;
+          break;
+        }
+        case DELTA_COPY:
+        case DELTA_INSERT: {
+          size_t n = min((size_t)remaining, len - i);
+          if (state == DELTA_COPY) {
+            for (size_t k = 0; k < n; ++k) emit(oldByte(oldCursor++) + data[i + k]);
+          } else {
+            for (size_t k = 0; k < n; ++k) emit(data[i + k]);
+          }
+          i += n;
+          remaining -= n;
+          if (remaining == 0 && state != DELTA_ERROR) state = DELTA_OP;
+          break;
+        }
+        default:
+          break;
+      }
+    }
+  }
+
+  // True if the records ended cleanly and the result has the expected hash.
+  bool finish(const uint8_t expectedSha[32]) {
+    flushOut();
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    if (state == DELTA_ERROR) return false;
+    if (state != DELTA_END || written != newSize) {
+      fail("truncated patch");
+      return false;
+    }
+    if (memcmp(digest, expectedSha, 32) != 0) {
+      fail("hash mismatch");
+      return false;
+    }
+    return true;
+  }
+};
+
+bool hashRunningImage(const esp_partition_t *part, uint32_t size, uint8_t digest[32]) {
+  if (!part || size > part->size) return false;
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+  uint8_t buf[256];
+  bool ok = true;
+  for (uint32_t pos = 0; pos < size && ok; pos += sizeof(buf)) {
+    uint32_t n = min((uint32_t)sizeof(buf), size - pos);
+    ok = esp_partition_read(part, pos, buf, n) == ESP_OK;
+    if (ok) mbedtls_sha256_update(&ctx, buf, n);
+  }
+  mbedtls_sha256_finish(&ctx, digest);
+  mbedtls_sha256_free(&ctx);
+  return ok;
+}
+
+bool streamDeltaImage(const String &url, size_t &downloaded, size_t &imageBytes) {
+  HTTPClient http;
+  http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+  Serial.printf("[OTA] Starte Delta-Update: %s\n", url.c_str());
+  http.setTimeout(20000);
+  http.begin(url);
+  int httpCode = http.GET();
+  if (httpCode != HTTP_CODE_OK) {
+    Serial.printf("Delta HTTP error: %d\n", httpCode);
+    http.end();
+    return false;
+  }
+  int len = http.getSize();
+  WiFiClient *stream = http.getStreamPtr();
+
+  DeltaHeader h;
+  if (stream->readBytes((uint8_t *)&h, sizeof(h)) != sizeof(h) || memcmp(h.magic, DELTA_MAGIC, 4) != 0) {
+    Serial.println("[OTA] Kein gültiger Delta-Header");
+    http.end();
+    return false;
+  }
+  downloaded = sizeof(h);
+  imageBytes = h.newSize;
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  uint8_t digest[32];
+  if (!hashRunningImage(running, h.oldSize, digest) || memcmp(digest, h.oldSha, 32) != 0) {
+    Serial.println("[OTA] Delta passt nicht zum laufenden Image");
+    http.end();
+    return false;
+  }
+  if (!Update.begin(h.newSize, U_FLASH)) {
+    Serial.println("Not enough space for update");
+    http.end();
+    return false;
+  }
+
+  tinfl_decompressor *inflator = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+  uint8_t *dict = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE);
+  DeltaApplier *applier = new (std::nothrow) DeltaApplier();
+  if (!inflator || !dict || !applier) {
+    Serial.println("[OTA] Zu wenig RAM für Delta-Update");
+    free(inflator);
+    free(dict);
+    delete applier;
+    Update.abort();
+    http.end();
+    return false;
+  }
+  tinfl_init(inflator);
+  DeltaApplier &apply = *applier;
+  apply.begin(running, h.oldSize, h.newSize);
+
+  uint8_t in[512];
+  size_t dictOfs = 0;
+  tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+  unsigned long lastProgress = millis();
+  const unsigned long timeoutMs = 60000;
+  while (status > TINFL_STATUS_DONE && apply.state < DELTA_END) {
+    size_t avail = stream->available();
+    if (!avail) {
+      if (!stream->connected() || millis() - lastProgress > timeoutMs) break;
+      delay(25);
+      continue;
+    }
+    size_t inLen = stream->readBytes(in, min(avail, sizeof(in)));
+    downloaded += inLen;
+    lastProgress = millis();
+    bool more = len < 0 || downloaded < (size_t)len;
+    const uint8_t *next = in;
+    do {
+      size_t inBytes = inLen;
+      size_t outBytes = TINFL_LZ_DICT_SIZE - dictOfs;
+      status = tinfl_decompress(inflator, next, &inBytes, dict, dict + dictOfs, &outBytes,
+                                TINFL_FLAG_PARSE_ZLIB_HEADER | (more ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+      next += inBytes;
+      inLen -= inBytes;
+      apply.consume(dict + dictOfs, outBytes);
+      dictOfs = (dictOfs + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    } while ((inLen > 0 || status == TINFL_STATUS_HAS_MORE_OUTPUT) && status > TINFL_STATUS_DONE &&
+             apply.state < DELTA_END);
+    showOtaProgress(apply.written, h.newSize, false);
+  }
+  http.end();
+  free(inflator);
+  free(dict);
+
+  if (status < TINFL_STATUS_DONE) apply.fail("inflate");
+  bool ok = apply.finish(h.newSha);
+  if (!ok) Serial.printf("[OTA] Delta fehlgeschlagen: %s (%u/%u Bytes)\n", apply.error, (unsigned)apply.written, (unsigned)h.newSize);
+  delete applier;
+  if (!ok) {
+    Update.abort();
+    return false;
+  }
+  if (!Update.end()) {
+    Serial.printf("Update failed: %s\n", Update.errorString());
+    return false;
+  }
+  Serial.printf("[OTA] Delta-Update erfolgreich (%u Bytes für %u Bytes Image), reboot folgt.\n", (unsigned)downloaded,
+                (unsigned)h.newSize);
+  return Update.isFinished();
+}
+
+bool performDeltaUpdate(const String &url) {
+  unsigned long startMs = millis();
+  size_t downloaded = 0, imageBytes = 0;
+  bool ok = streamDeltaImage(url, downloaded, imageBytes);
+  recordOtaResult("delta", ok, downloaded, imageBytes, startMs);
+  return ok;
+}
+
+// Delta first if offered; the full image if the delta does not apply.
+bool performFirmwareUpdate(const String &fwUrl, const String &deltaUrl) {
+  if (deltaUrl.length() > 0) {
+    if (performDeltaUpdate(deltaUrl)) return true;
+    otaStats.deltaFallbacks++;
+    if (fwUrl.length() == 0) return false;
+    Serial.println("[OTA] Fallback auf volles Image");
+  }
+  return performUpdate(fwUrl, false);
+}
+
+// --------- ICAL fetch ---------
+void fetchIcalIfNeeded() {
+  if (configState.icalCount == 0) return;
+  if (millis() - lastIcalFetch < 30UL * 60UL * 1000UL) return; // every 30 min
+  lastIcalFetch = millis();
+  MetricScope scope(M_ICAL_FETCH);
+
+  static IcsImport reader; // String buffers reused between feeds
+  for (int idx = 0; idx < configState.icalCount; ++idx) {
+    const String &url = configState.icals[idx].url;
+    if (url.length() == 0) {
+      nextIcalTimes[idx] = 0;
+      continue;
+    }
+
+    HTTPClient http;
+    http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+    http.useHTTP10(true); // no chunked encoding, the stream is the feed itself
+    http.setTimeout(20000);
+    http.begin(url);
+    int code = http.GET();
+    if (code != HTTP_CODE_OK) {
+      Serial.printf("iCal fetch failed (%d) for %s\n", code, url.c_str());
+      http.end();
+      nextIcalTimes[idx] = 0;
+      continue;
+    }
+
+    // Fed in small chunks as it arrives; a feed of a few hundred KB never
+    // sits in the heap as a whole.
+    int len = http.getSize();
+    WiFiClient *stream = http.getStreamPtr();
+    reader.reset(0, false, time(nullptr));
+    uint8_t in[512];
+    size_t received = 0;
+    unsigned long lastProgress = millis();
+    const unsigned long timeoutMs = 20000;
+    while (len < 0 || received < (size_t)len) {
+      size_t avail = stream->available();
+      if (!avail) {
+        if (!stream->connected() || millis() - lastProgress > timeoutMs) break;
+        delay(10);
+        continue;
+      }
+      size_t n = stream->readBytes(in, min(avail, sizeof(in)));
+      reader.feed(in, n);
+      received += n;
+      lastProgress = millis();
+    }
+    http.end();
+    if (len >= 0 && received < (size_t)len) {
+      Serial.printf("iCal feed cut off after %u of %d bytes for %s\n", (unsigned)received, len, url.c_str());
+    }
+    reader.finish();
+    nextIcalTimes[idx] = reader.nextAfter > 0 ? reader.nextAfter : reader.earliest;
+  }
+}
+
+// --------- Physical layout ---------
+// The strip runs around the "A" of the logo, spiralling inwards. Each LED gets
+// quantized 2D coordinates plus polar coordinates around the layout center, so
+// spatial effects are table lookups with 8-bit math like the linear ones.
+// Angle 0 points up and grows clockwise (0..255 = full turn).
+struct LedLayout {
+  uint8_t x[DEFAULT_LED_COUNT];      // 0..255 across the larger extent
+  uint8_t y[DEFAULT_LED_COUNT];      // 0..255, grows downwards
+  uint8_t angle[DEFAULT_LED_COUNT];  // around the center
+  uint8_t radius[DEFAULT_LED_COUNT]; // 0 = center, 255 = outermost LED
+  bool fromFile = false;
+};
+
+LedLayout ledLayout;
+
+// Positions of the 12-LED prototype, same as the web preview (pixels, y down).
+static const int16_t DEFAULT_LAYOUT_XY[DEFAULT_LED_COUNT][2] = {
+  {0, 120}, {15, 95}, {30, 70}, {45, 45}, {60, 20}, {75, 0},
+  {90, 20}, {105, 45}, {120, 70}, {135, 95}, {110, 95}, {85, 95}
+};
+
+// Quantize raw coordinates (any unit) into the lookup tables. Runs once at boot,
+// so floats are fine here.
+void buildLayout(const float *xs, const float *ys, int count, bool hasCenter, float cx, float cy) {
+  float minX = xs[0], maxX = xs[0], minY = ys[0], maxY = ys[0];
+  for (int i = 1; i < count; ++i) {
+    minX = min(minX, xs[i]); maxX = max(maxX, xs[i]);
+    minY = min(minY, ys[i]); maxY = max(maxY, ys[i]);
+  }
+  float span = max(maxX - minX, maxY - minY);
+  if (span <= 0) span = 1;
+  if (!hasCenter) {
+    cx = 0; cy = 0;
+    for (int i = 0; i < count; ++i) { cx += xs[i]; cy += ys[i]; }
+    cx /= count; cy /= count;
+  }
+  float maxR = 0;
+  for (int i = 0; i < count; ++i) maxR = max(maxR, hypotf(xs[i] - cx, ys[i] - cy));
+  if (maxR <= 0) maxR = 1;
+
+  for (int i = 0; i < configState.ledCount; ++i) {
+    if (i >= count) { // more LEDs than layout entries: park them in the center
+      ledLayout.x[i] = ledLayout.y[i] = 128;
+      ledLayout.angle[i] = ledLayout.radius[i] = 0;
+      continue;
+    }
+    float dx = xs[i] - cx, dy = ys[i] - cy;
+    ledLayout.x[i] = (uint8_t)lroundf((xs[i] - minX) * 255.0f / span);
+    ledLayout.y[i] = (uint8_t)lroundf((ys[i] - minY) * 255.0f / span);
+    float turn = atan2f(dx, -dy) / (2.0f * (float)M_PI); // -0.5..0.5, clockwise from up
+    ledLayout.angle[i] = (uint8_t)((int)lroundf(turn * 256.0f) & 0xFF);
+    ledLayout.radius[i] = (uint8_t)lroundf(hypotf(dx, dy) * 255.0f / maxR);
+  }
+}
+
+void loadLayout() {
+  float xs[DEFAULT_LED_COUNT], ys[DEFAULT_LED_COUNT];
+  for (int i = 0; i < DEFAULT_LED_COUNT; ++i) {
+    xs[i] = DEFAULT_LAYOUT_XY[i][0];
+    ys[i] = DEFAULT_LAYOUT_XY[i][1];
+  }
+  ledLayout.fromFile = false;
+
+  // Format: {"leds":[[x,y],...], "center":[x,y]} (center optional, default centroid)
+  File f = LittleFS.open(FILE_LAYOUT, "r");
+  if (!f) {
+    buildLayout(xs, ys, DEFAULT_LED_COUNT, false, 0, 0);
+    return;
+  }
+  DynamicJsonDocument doc(2048);
+  DeserializationError err = deserializeJson(doc, f);
+  f.close();
+  JsonArray pts = doc["leds"].as<JsonArray>();
+  if (err || pts.isNull() || pts.size() == 0) {
+    Serial.println("Failed to parse layout, using built-in layout");
+    buildLayout(xs, ys, DEFAULT_LED_COUNT, false, 0, 0);
+    return;
+  }
+  int count = 0;
+  for (JsonVariant p : pts) {
+    if (count >= DEFAULT_LED_COUNT) break;
+    xs[count] = p[0] | 0.0f;
+    ys[count] = p[1] | 0.0f;
+    count++;
+  }
+  JsonArray center = doc["center"].as<JsonArray>();
+  bool hasCenter = !center.isNull() && center.size() == 2;
+  buildLayout(xs, ys, count, hasCenter, hasCenter ? center[0].as<float>() : 0, hasCenter ? center[1].as<float>() : 0);
+  ledLayout.fromFile = true;
+}
+
+// Shortest distance between two 8-bit angles (0..128).
+uint8_t angleDistance(uint8_t a, uint8_t b) {
+  uint8_t d = a - b;
+  return d > 128 ? 256 - d : d;
+}
+
+String buildLayoutJson() {
+  DynamicJsonDocument doc(2048);
+  doc["source"] = ledLayout.fromFile ? "file" : "builtin";
+  JsonArray arr = doc["leds"].to<JsonArray>();
+  for (int i = 0; i < configState.ledCount; ++i) {
+    JsonObject o = arr.add<JsonObject>();
+    o["x"] = ledLayout.x[i];
+    o["y"] = ledLayout.y[i];
+    o["angle"] = ledLayout.angle[i];
+    o["radius"] = ledLayout.radius[i];
+  }
+  String out;
+  serializeJson(doc, out);
+  return out;
+}
+
+// --------- LED rendering ---------
+// Rendering is split into ordered layers. Each layer owns a pixel buffer and a
+// per-LED coverage mask and is composited bottom to top with its blend mode.
+// A layer is only re-rendered when the fingerprint of its inputs changed (or
+// it animates), and the composite is only rebuilt when a layer changed.
+enum LayerId : uint8_t { LAYER_EFFECT, LAYER_CLOCK, LAYER_HOURS, LAYER_APPOINTMENT, LAYER_COUNT };
+enum BlendMode : uint8_t { BLEND_NORMAL, BLEND_LIGHTEN };
+
+struct RenderLayer {
+  CRGB pixels[DEFAULT_LED_COUNT];
+  uint8_t mask[DEFAULT_LED_COUNT]; // coverage per LED, 0 = transparent
+  BlendMode blendMode = BLEND_NORMAL;
+  bool enabled = false;
+  bool dirty = true;      // pixels changed since the last composite
+  bool rendered = false;  // pixels hold a valid render for inputKey
+  uint32_t inputKey = 0;  // fingerprint of the inputs of the last render
+};
+
+RenderLayer layers[LAYER_COUNT];
+uint8_t composedLayerMask = 0; // enabled layers at the last composite
+
+uint32_t mixKey(uint32_t h, uint32_t v) {
+  h ^= v + 0x9e3779b9UL + (h << 6) + (h >> 2);
+  return h;
+}
+
+uint32_t hashString(const String &s) {
+  uint32_t h = 2166136261UL; // FNV-1a
+  for (unsigned i = 0; i < s.length(); ++i) {
+    h ^= (uint8_t)s.charAt(i);
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+// Enable/disable a layer and decide whether it has to be rendered this frame.
+bool layerNeedsRender(LayerId id, bool enabled, uint32_t inputKey, bool animated) {
+  RenderLayer &layer = layers[id];
+  layer.enabled = enabled;
+  if (!enabled) return false;
+  if (animated || !layer.rendered || inputKey != layer.inputKey) {
+    layer.inputKey = inputKey;
+    layer.rendered = true;
+    layer.dirty = true;
+  }
+  return layer.dirty;
+}
+
+// Same pseudo-random value for (step, led) on every sign.
+uint32_t effectNoise(uint32_t step, uint32_t led) {
+  uint32_t x = step * 0x9e3779b1UL ^ led * 0x85ebca6bUL;
+  x ^= x >> 16;
+  x *= 0x7feb352dUL;
+  x ^= x >> 15;
+  x *= 0x846ca68bUL;
+  x ^= x >> 16;
+  return x;
+}
+
+// Every effect is a function of effectMillis() only, with no state carried
+// between frames, so signs that share the effect clock show the same frame
+// whenever they render. Decaying effects look back over the last steps for
+// the most recent hit instead of fading a buffer.
+#define TWINKLE_LOOKBACK 48 // frames until a twinkle has faded below 2%
+#define XMAS_LOOKBACK 24    // steps until a light has faded below 2%
+
+void renderEffect(CRGB *out) {
+  const uint32_t t = effectMillis();
+  const String &effect = activeEffect();
+  if (effect == "solid") {
+    CRGB c;
+    colorToCrgb(parseHexColor(configState.effectColor), c);
+    fill_solid(out, configState.ledCount, c);
+  } else if (effect == "breathe") {
+    CRGB c;
+    colorToCrgb(parseHexColor(configState.effectColor), c);
+    uint8_t bpm = map(constrain(configState.effectSpeed, 1, 20), 1, 20, 6, 30);
+    uint8_t beat = (uint8_t)(((uint64_t)t * bpm * 280) >> 16); // beat8() on the effect clock
+    uint8_t val = 10 + scale8(sin8(beat), 245);
+    c.nscale8_video(val);
+    fill_solid(out, configState.ledCount, c);
+  } else if (effect == "theater") {
+    CRGB c;
+    colorToCrgb(parseHexColor(configState.effectColor), c);
+    fill_solid(out, configState.ledCount, CRGB::Black);
+    uint8_t speed = constrain(configState.effectSpeed, 1, 20);
+    uint16_t stepMs = map(speed, 1, 20, 250, 40);
+    for (int i = (t / stepMs) % 3; i < configState.ledCount; i += 3) {
+      out[i] = c;
+    }
+  } else if (effect == "twinkle") {
+    // Per frame each LED lights up with probability speed/256 and fades by 20.
+    CRGB c;
+    colorToCrgb(parseHexColor(configState.effectColor), c);
+    uint8_t chance = constrain(configState.effectSpeed, 1, 20);
+    uint32_t frame = t / LOOP_FRAME_MS;
+    for (int i = 0; i < configState.ledCount; ++i) {
+      out[i] = CRGB::Black;
+      uint8_t level = 255;
+      for (uint8_t age = 0; age < TWINKLE_LOOKBACK; ++age, level = scale8(level, 235)) {
+        if ((effectNoise(frame - age, i) & 0xff) < chance) {
+          out[i] = c;
+          out[i].nscale8(level);
+          break;
+        }
+      }
+    }
+  } else if (effect == "xmas") {
+    // Colorful blinking string: red, green, gold, blue with gentle decay
+    static const CRGB palette[] = {CRGB::Red, CRGB::Green, CRGB(255,215,0), CRGB::Blue};
+    uint8_t speed = constrain(configState.effectSpeed, 1, 20);
+    uint16_t stepMs = map(speed, 1, 20, 320, 80);
+    uint8_t chance = map(speed, 1, 20, 20, 120); // more hits when faster
+    uint32_t step = t / stepMs;
+    for (int i = 0; i < configState.ledCount; ++i) {
+      out[i] = CRGB::Black;
+      uint8_t level = 255;
+      for (uint8_t age = 0; age < XMAS_LOOKBACK; ++age, level = scale8(level, 215)) {
+        uint32_t n = effectNoise(step - age, i);
+        if ((n & 0xff) < chance) {
+          out[i] = palette[(n >> 8) & 3];
+          out[i].nscale8(level);
+          break;
+        }
+      }
+    }
+  } else if (effect == "radar") {
+    // Sweep around the layout center with a fading trail behind the beam
+    CRGB c;
+    colorToCrgb(parseHexColor(configState.effectColor), c);
+    uint8_t speed = constrain(configState.effectSpeed, 1, 20);
+    uint8_t sweep = (uint8_t)(((uint64_t)t * speed) >> 6); // 64 bit: t * speed overflows 32 bits after ~2.5 days
+    for (int i = 0; i < configState.ledCount; ++i) {
+      uint8_t behind = sweep - ledLayout.angle[i];
+      out[i] = c;
+      out[i].nscale8_video(behind < 96 ? 255 - behind * 8 / 3 : 0);
+    }
+  } else if (effect == "ripple") {
+    // Rings travelling outwards from the layout center
+    CRGB c;
+    colorToCrgb(parseHexColor(configState.effectColor), c);
+    uint8_t speed = constrain(configState.effectSpeed, 1, 20);
+    uint8_t phase = (uint8_t)(((uint64_t)t * speed) >> 4);
+    for (int i = 0; i < configState.ledCount; ++i) {
+      out[i] = c;
+      out[i].nscale8_video(sin8(ledLayout.radius[i] * 2 - phase));
+    }
+  } else {
+    // Rainbow: the hue moves by effectSpeed per nominal frame.
+    uint8_t step = constrain(configState.effectSpeed, 1, 20);
+    uint8_t hue = (uint8_t)(t / LOOP_FRAME_MS * step);
+    for (int i = 0; i < configState.ledCount; ++i) {
+      out[i] = CHSV(hue + i * 3, 255, 255);
+    }
+  }
+}
+
+void renderEffectLayer() {
+  RenderLayer &layer = layers[LAYER_EFFECT];
+  renderEffect(layer.pixels);
+  memset(layer.mask, 255, configState.ledCount);
+}
+
+// Map local 12h range onto strip as a progressive fill (e.g., 20:30 -> 8 full, 9th half),
+// or with clockStyle "hand" light the LEDs around the physical hour-hand angle.
+// The coverage goes into the mask so tint layers can reuse it.
+void renderClockLayer(int minutes12, uint32_t colorHex) {
+  RenderLayer &layer = layers[LAYER_CLOCK];
+  CRGB base;
+  colorToCrgb(colorHex, base);
+  if (configState.clockStyle == "hand") {
+    uint8_t hand = (uint8_t)((uint32_t)minutes12 * 256 / 720);
+    for (int i = 0; i < configState.ledCount; ++i) {
+      uint8_t d = angleDistance(ledLayout.angle[i], hand);
+      layer.pixels[i] = base;
+      layer.mask[i] = d < 32 ? 255 - d * 8 : 0; // ~45 degree wide hand
+    }
+    return;
+  }
+  uint32_t pos = (uint32_t)minutes12 * configState.ledCount * 255 / 720; // fill level in 1/255 LED
+  int full = pos / 255;
+  uint8_t frac = pos % 255;
+  for (int i = 0; i < configState.ledCount; ++i) {
+    layer.pixels[i] = base;
+    layer.mask[i] = i < full ? 255 : (i == full ? frac : 0);
+  }
+}
+
+// Opening-hours tint: recolors the clock fill with the open/closed color.
+void renderHoursLayer(uint32_t colorHex) {
+  RenderLayer &layer = layers[LAYER_HOURS];
+  CRGB c;
+  colorToCrgb(colorHex, c);
+  fill_solid(layer.pixels, configState.ledCount, c);
+  memcpy(layer.mask, layers[LAYER_CLOCK].mask, configState.ledCount);
+}
+
+// Appointment overlay: the clock fill pulses towards white (800 ms period) and
+// a dim countdown bar at the end of the strip shrinks towards the appointment.
+void renderAppointmentLayer(uint32_t colorHex, int barLeds) {
+  RenderLayer &layer = layers[LAYER_APPOINTMENT];
+  uint8_t phase = (uint8_t)((effectMillis() % 800) * 256 / 800);
+  uint8_t pulse = triwave8(phase);
+  CRGB bar;
+  colorToCrgb(colorHex, bar);
+  bar.nscale8_video(64);
+  const uint8_t *fill = layers[LAYER_CLOCK].mask;
+  for (int i = 0; i < configState.ledCount; ++i) {
+    if (fill[i] > 0) {
+      layer.pixels[i] = CRGB(pulse, pulse, pulse);
+      layer.mask[i] = fill[i];
+    } else if (i >= configState.ledCount - barLeds) {
+      layer.pixels[i] = bar;
+      layer.mask[i] = 255;
+    } else {
+      layer.mask[i] = 0;
+    }
+  }
+}
+
+void setupLayers() {
+  layers[LAYER_APPOINTMENT].blendMode = BLEND_LIGHTEN;
+}
+
+// Rebuild out from the enabled layers; returns false when nothing changed.
+bool compositeLayers(CRGB *out) {
+  const int count = configState.ledCount;
+  uint8_t enabledMask = 0;
+  bool changed = false;
+  for (int l = 0; l < LAYER_COUNT; ++l) {
+    if (!layers[l].enabled) continue;
+    enabledMask |= 1 << l;
+    changed |= layers[l].dirty;
+  }
+  changed |= enabledMask != composedLayerMask;
+  if (!changed) return false;
+
+  fill_solid(out, count, CRGB::Black);
+  for (int l = 0; l < LAYER_COUNT; ++l) {
+    RenderLayer &layer = layers[l];
+    if (!layer.enabled) continue;
+    for (int i = 0; i < count; ++i) {
+      uint8_t a = layer.mask[i];
+      if (a == 0) continue;
+      CRGB src = layer.pixels[i];
+      if (layer.blendMode == BLEND_LIGHTEN) {
+        src = CRGB(max(out[i].r, src.r), max(out[i].g, src.g), max(out[i].b, src.b));
+      }
+      out[i] = a == 255 ? src : blend(out[i], src, a);
+    }
+    layer.dirty = false;
+  }
+  composedLayerMask = enabledMask;
+  return true;
+}
+
+// --------- Scene transitions ---------
+// The composited layers form the scene. When the scene (or its color/effect)
+// changes, the last output is frozen into fadeFromLayer and both are blended
+// with an 8-bit lerp until transitionMs has elapsed. Buffers are static, so a
+// transition costs one blend per LED and no allocation.
+enum SceneKind : uint8_t { SCENE_NONE, SCENE_CLOCK, SCENE_EFFECT, SCENE_ALERT, SCENE_REALTIME };
+
+struct TransitionState {
+  SceneKind scene = SCENE_NONE;
+  uint32_t key = 0;           // identity of what the scene shows (color, effect)
+  unsigned long startMs = 0;
+  bool active = false;
+};
+
+CRGB sceneLayer[DEFAULT_LED_COUNT];
+CRGB fadeFromLayer[DEFAULT_LED_COUNT];
+TransitionState transition;
+
+void presentScene(SceneKind scene, uint32_t key) {
+  const int count = configState.ledCount;
+  const unsigned long nowMs = millis();
+  bool sceneChanged = compositeLayers(sceneLayer);
+  if (scene != transition.scene || key != transition.key) {
+    // Start from what is currently on the strip, so an interrupted fade continues smoothly.
+    if (transition.scene != SCENE_NONE && configState.transitionMs > 0) {
+      memcpy(fadeFromLayer, leds, sizeof(CRGB) * count);
+      transition.startMs = nowMs;
+      transition.active = true;
+    } else {
+      sceneChanged = true; // hard cut: leds may hold something the layers never saw
+    }
+    transition.scene = scene;
+    transition.key = key;
+  }
+
+  if (transition.active) {
+    unsigned long elapsed = nowMs - transition.startMs;
+    if (elapsed >= configState.transitionMs) {
+      transition.active = false;
+      sceneChanged = true; // land exactly on the scene
+    } else {
+      fract8 amount = (fract8)(elapsed * 255UL / configState.transitionMs);
+      for (int i = 0; i < count; ++i) {
+        leds[i] = blend(fadeFromLayer[i], sceneLayer[i], amount);
+      }
+      showFrame(true);
+      return;
+    }
+  }
+  if (sceneChanged) memcpy(leds, sceneLayer, sizeof(CRGB) * count);
+  showFrame(sceneChanged);
+}
+
+uint32_t effectInputKey() {
+  return mixKey(mixKey(hashString(activeEffect()), parseHexColor(configState.effectColor)), configState.effectSpeed);
+}
+
+// Effect only, used while the Wi-Fi portal is up and time is unknown.
+void showEffect() {
+  bool animated = activeEffect() != "solid";
+  if (layerNeedsRender(LAYER_EFFECT, true, effectInputKey(), animated)) renderEffectLayer();
+  layers[LAYER_CLOCK].enabled = false;
+  layers[LAYER_HOURS].enabled = false;
+  layers[LAYER_APPOINTMENT].enabled = false;
+  presentScene(SCENE_EFFECT, effectInputKey());
+}
+
+void handleLeds(time_t nowLocal) {
+  AppointmentHit next = nextAnyAppointment(nowLocal);
+  double diff = next.when > 0 ? difftime(next.when, nowLocal) : 1e9;
+  uint32_t windowSec = (uint32_t)configState.notifyMinutesBefore * 60;
+  bool appointmentActive = configState.enableAppointments && next.when > 0 && diff >= 0 && diff <= windowSec;
+  bool effectMode = activeMode() == "effect";
+
+  // Opening state only changes with the minute or with a config edit.
+  static time_t openMinute = -1;
+  static uint32_t openGeneration = 0;
+  static bool open = false;
+  time_t minuteStamp = nowLocal / 60;
+  if (minuteStamp != openMinute || openGeneration != configGeneration) {
+    open = isOpenNow(nowLocal);
+    openMinute = minuteStamp;
+    openGeneration = configGeneration;
+  }
+
+  struct tm *tmNow = localtime(&nowLocal);
+  int minutes12 = (tmNow->tm_hour % 12) * 60 + tmNow->tm_min;
+
+  uint32_t appointmentColor = parseHexColor(next.color.length() == 6 ? next.color : DEFAULT_APPOINT_COLOR);
+  uint32_t clockColor = appointmentActive ? appointmentColor : parseHexColor(configState.clockColor);
+  uint32_t hoursColor = parseHexColor(open ? configState.openColor : configState.closedColor);
+  bool showHours = !appointmentActive && !effectMode && configState.enableOpenHours;
+
+  bool animatedEffect = activeEffect() != "solid";
+  if (layerNeedsRender(LAYER_EFFECT, effectMode && !appointmentActive, effectInputKey(), animatedEffect)) {
+    renderEffectLayer();
+  }
+  bool clockEnabled = appointmentActive || !effectMode;
+  uint32_t clockKey = mixKey(mixKey(minutes12, clockColor), hashString(configState.clockStyle));
+  if (layerNeedsRender(LAYER_CLOCK, clockEnabled, clockKey, false)) {
+    renderClockLayer(minutes12, clockColor);
+  }
+  if (layerNeedsRender(LAYER_HOURS, showHours, mixKey(clockKey, hoursColor), false)) {
+    renderHoursLayer(hoursColor);
+  }
+  int barLeds = 0;
+  if (appointmentActive && windowSec > 0) {
+    barLeds = (int)((diff * configState.ledCount + windowSec - 1) / windowSec);
+  }
+  if (layerNeedsRender(LAYER_APPOINTMENT, appointmentActive, mixKey(clockKey, barLeds), true)) {
+    renderAppointmentLayer(appointmentColor, barLeds);
   }
 
-  if (!Update.end()) {
-    Serial.printf("Update failed: %s\n", Update.errorString());
-    http.end();
-    return false;
+  if (appointmentActive) {
+    presentScene(SCENE_ALERT, appointmentColor);
+  } else if (effectMode) {
+    presentScene(SCENE_EFFECT, effectInputKey());
+  } else {
+    presentScene(SCENE_CLOCK, showHours ? hoursColor : clockColor);
   }
+}
 
-  http.end();
-  Serial.printf("[OTA] %s-Update erfolgreich, reboot folgt.\n", isFs ? "FS" : "FW");
-  return Update.isFinished();
+// --------- Realtime input (E1.31 / DDP) ---------
+// Pixel data from a lighting controller over UDP: E1.31 (sACN) on 5568,
+// unicast or the universe's multicast group, and DDP on 4048. The header of
+// each datagram is peeked first; once it passes the checks, recvmsg()
+// scatters the payload straight into leds[], so pixels are copied once, from
+// the lwIP buffer into the frame buffer. All pending datagrams are drained per
+// pass and only the newest state is shown: bursts faster than the strip can
+// refresh are dropped, never queued. loop() waits in select() on these
+// sockets, so frames go out when they arrive instead of on the 30 ms tick.
+#define E131_PORT 5568
+#define DDP_PORT 4048
+#define E131_HEADER_LEN 126
+#define E131_OPT_PREVIEW 0x80
+#define E131_OPT_TERMINATED 0x40
+#define DDP_HEADER_LEN 10
+#define DDP_TIMECODE_LEN 4
+#define DDP_FLAG_PUSH 0x01
+#define DDP_FLAG_QUERY 0x02
+#define DDP_FLAG_REPLY 0x04
+#define DDP_FLAG_STORAGE 0x08
+#define DDP_FLAG_TIMECODE 0x10
+#define DDP_VERSION_MASK 0xc0
+#define DDP_VERSION_1 0x40
+#define DDP_TYPE_UNDEFINED 0x00 // older senders leave the data type empty
+#define DDP_TYPE_RGB8 0x0b
+#define DDP_ID_LEGACY 0         // reserved, but sent by some older senders
+#define DDP_ID_DISPLAY 1        // default output device
+
+int openUdpSocket(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return -1;
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
 }
 
-// Perform FS update but restore config afterwards so user settings survive.
-bool updateFsPreserveConfig(const String &url) {
-  String backup;
-  if (LittleFS.exists(FILE_CONFIG)) {
-    File f = LittleFS.open(FILE_CONFIG, "r");
-    if (f) {
-      backup = f.readString();
-      f.close();
-    }
+void closeRealtimeSockets() {
+  if (realtime.e131Fd >= 0) close(realtime.e131Fd);
+  if (realtime.ddpFd >= 0) close(realtime.ddpFd);
+  realtime.e131Fd = realtime.ddpFd = -1;
+  realtime.generation = UINT32_MAX;
+}
+
+void openRealtimeSockets() {
+  closeRealtimeSockets();
+  realtime.e131Fd = openUdpSocket(E131_PORT);
+  realtime.ddpFd = openUdpSocket(DDP_PORT);
+  if (realtime.e131Fd >= 0) {
+    // 239.255.<universe hi>.<universe lo>
+    struct ip_mreq mreq = {};
+    uint16_t u = configState.realtimeUniverse;
+    mreq.imr_multiaddr.s_addr = htonl(0xefff0000UL | u);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    setsockopt(realtime.e131Fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
   }
+  realtime.generation = areaGeneration[CFG_AREA_REALTIME];
+  Serial.printf("[RT] listening: E1.31 universe %u %s, DDP %s\n", configState.realtimeUniverse,
+                realtime.e131Fd >= 0 ? "ok" : "failed", realtime.ddpFd >= 0 ? "ok" : "failed");
+}
 
-  if (!performUpdate(url, true)) return false;
+void discardDatagram(int fd) {
+  uint8_t b;
+  recv(fd, &b, 1, MSG_DONTWAIT); // UDP: the unread rest of the datagram is dropped
+}
 
-  LittleFS.end();
-  if (!LittleFS.begin()) {
-    Serial.println("LittleFS remount failed after update");
+void exitRealtime() {
+  if (realtime.source == RT_NONE) return;
+  Serial.printf("[RT] %s stopped\n", RT_SOURCE_NAMES[realtime.source]);
+  realtime.source = RT_NONE;
+  realtime.framePending = false;
+}
+
+// E1.31 rule: a sequence number up to 20 behind the last one is stale.
+bool acceptE131Sequence(uint8_t seq) {
+  if (realtime.source != RT_E131) {
+    realtime.e131Seq = seq;
+    return true;
+  }
+  int8_t diff = (int8_t)(seq - realtime.e131Seq);
+  if (diff <= 0 && diff > -20) {
+    realtime.outOfOrder++;
     return false;
   }
+  if (diff > 1) realtime.lost += diff - 1;
+  realtime.e131Seq = seq;
+  return true;
+}
 
-  if (backup.length() > 0) {
-    File f = LittleFS.open(FILE_CONFIG, "w");
-    if (!f) {
-      Serial.println("Failed to restore config after FS update");
-      return false;
-    }
-    f.print(backup);
-    f.close();
+// DDP numbers packets 1..15 (0 = not used); more than half a cycle behind is stale.
+bool acceptDdpSequence(uint8_t seq) {
+  if (seq == 0 || realtime.source != RT_DDP || realtime.ddpSeq == 0) {
+    realtime.ddpSeq = seq;
+    return true;
+  }
+  uint8_t diff = (seq + 15 - realtime.ddpSeq) % 15;
+  if (diff == 0 || diff > 7) {
+    realtime.outOfOrder++;
+    return false;
   }
+  if (diff > 1) realtime.lost += diff - 1;
+  realtime.ddpSeq = seq;
   return true;
 }
 
-// --------- ICAL fetch placeholder ---------
-void fetchIcalIfNeeded() {
-  if (configState.icalCount == 0) return;
-  if (millis() - lastIcalFetch < 30UL * 60UL * 1000UL) return; // every 30 min
-  lastIcalFetch = millis();
-
-  auto parseDtstart = [](String line) -> time_t {
-    int colon = line.indexOf(":");
-    if (colon < 0) return 0;
-    String ts = line.substring(colon + 1);
-    ts.trim();
-    ts.replace("Z", ""); // ignore UTC marker, treat as local for simplicity
-    ts.replace("T", "");
-    if (ts.length() < 8) return 0;
-    while (ts.length() < 14) ts += "0"; // pad missing hhmmss if only date present
+void noteRealtimeFrame(RealtimeSource src) {
+  if (realtime.framePending) realtime.dropped++;
+  realtime.framePending = true;
+  realtime.frames++;
+  realtime.lastFrameUs = micros();
+  realtime.lastPacketMs = millis();
+  if (realtime.source != src) {
+    Serial.printf("[RT] %s started\n", RT_SOURCE_NAMES[src]);
+    realtime.source = src;
+    transition.scene = SCENE_REALTIME; // the configured mode fades back in afterwards
+    transition.active = false;
+  }
+}
 
-    struct tm t = {};
-    t.tm_year = ts.substring(0, 4).toInt() - 1900;
-    t.tm_mon  = ts.substring(4, 6).toInt() - 1;
-    t.tm_mday = ts.substring(6, 8).toInt();
-    t.tm_hour = ts.substring(8, 10).toInt();
-    t.tm_min  = ts.substring(10, 12).toInt();
-    t.tm_sec  = ts.substring(12, 14).toInt();
-    time_t parsed = mktime(&t);
-    return parsed > 0 ? parsed : 0;
-  };
+size_t realtimeFrameBytes() {
+  return (size_t)configState.ledCount * sizeof(CRGB);
+}
 
-  for (int idx = 0; idx < configState.icalCount; ++idx) {
-    const String &url = configState.icals[idx].url;
-    if (url.length() == 0) {
-      nextIcalTimes[idx] = 0;
+void receiveE131() {
+  uint8_t hdr[E131_HEADER_LEN];
+  for (;;) {
+    ssize_t n = recv(realtime.e131Fd, hdr, sizeof(hdr), MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0) return;
+    realtime.packets++;
+    bool valid = n == E131_HEADER_LEN && memcmp(hdr + 4, "ASC-E1.17", 9) == 0 &&
+                 hdr[21] == 0x04 && hdr[43] == 0x02 && hdr[117] == 0x02 && hdr[125] == 0x00;
+    uint16_t universe = (hdr[113] << 8) | hdr[114];
+    if (!valid || universe != configState.realtimeUniverse || (hdr[112] & E131_OPT_PREVIEW)) {
+      if (!valid) realtime.invalid++;
+      discardDatagram(realtime.e131Fd);
+      continue;
+    }
+    if (hdr[112] & E131_OPT_TERMINATED) {
+      discardDatagram(realtime.e131Fd);
+      if (realtime.source == RT_E131) exitRealtime();
+      continue;
+    }
+    if (!acceptE131Sequence(hdr[111])) {
+      discardDatagram(realtime.e131Fd);
       continue;
     }
+    uint16_t channels = ((hdr[123] << 8) | hdr[124]) - 1; // property count includes the start code
+    struct iovec iov[2];
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = E131_HEADER_LEN;
+    iov[1].iov_base = (uint8_t *)leds;
+    iov[1].iov_len = min((size_t)channels, realtimeFrameBytes());
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (recvmsg(realtime.e131Fd, &msg, MSG_DONTWAIT) < 0) return;
+    noteRealtimeFrame(RT_E131);
+  }
+}
 
-    HTTPClient http;
-    http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
-    http.begin(url);
-    int code = http.GET();
-    if (code != HTTP_CODE_OK) {
-      Serial.printf("iCal fetch failed (%d) for %s\n", code, url.c_str());
-      http.end();
-      nextIcalTimes[idx] = 0;
+void receiveDdp() {
+  uint8_t hdr[DDP_HEADER_LEN + DDP_TIMECODE_LEN];
+  for (;;) {
+    ssize_t n = recv(realtime.ddpFd, hdr, sizeof(hdr), MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0) return;
+    realtime.packets++;
+    uint8_t flags = hdr[0];
+    size_t hdrLen = DDP_HEADER_LEN + ((flags & DDP_FLAG_TIMECODE) ? DDP_TIMECODE_LEN : 0);
+    if (n < (ssize_t)hdrLen || (flags & DDP_VERSION_MASK) != DDP_VERSION_1 ||
+        (flags & (DDP_FLAG_QUERY | DDP_FLAG_REPLY | DDP_FLAG_STORAGE)) ||
+        (hdr[2] != DDP_TYPE_UNDEFINED && hdr[2] != DDP_TYPE_RGB8) ||
+        (hdr[3] != DDP_ID_DISPLAY && hdr[3] != DDP_ID_LEGACY)) {
+      realtime.invalid++;
+      discardDatagram(realtime.ddpFd);
+      continue;
+    }
+    if (!acceptDdpSequence(hdr[1] & 0x0f)) {
+      discardDatagram(realtime.ddpFd);
       continue;
     }
+    uint32_t offset = ((uint32_t)hdr[4] << 24) | ((uint32_t)hdr[5] << 16) | ((uint32_t)hdr[6] << 8) | hdr[7];
+    uint16_t length = (hdr[8] << 8) | hdr[9];
+    size_t frameBytes = realtimeFrameBytes();
+    if (offset < frameBytes) {
+      struct iovec iov[2];
+      iov[0].iov_base = hdr;
+      iov[0].iov_len = hdrLen;
+      iov[1].iov_base = (uint8_t *)leds + offset;
+      iov[1].iov_len = min((size_t)length, frameBytes - offset);
+      struct msghdr msg = {};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = 2;
+      if (recvmsg(realtime.ddpFd, &msg, MSG_DONTWAIT) < 0) return;
+    } else {
+      discardDatagram(realtime.ddpFd); // beyond our strip, but may still carry the push
+    }
+    // A frame is complete on PUSH, or when a sender without PUSH reaches our last pixel.
+    if ((flags & DDP_FLAG_PUSH) || offset + length >= frameBytes) noteRealtimeFrame(RT_DDP);
+  }
+}
 
-    String payload = http.getString();
-    http.end();
-    time_t nowLocal = time(nullptr);
-    time_t bestFuture = 0;
-    time_t bestAny = 0;
-    int pos = 0;
-    while (true) {
-      pos = payload.indexOf("DTSTART", pos);
-      if (pos < 0) break;
-      int nl = payload.indexOf('\n', pos);
-      String line = payload.substring(pos, nl < 0 ? payload.length() : nl);
-      if (line.endsWith("\r")) line.remove(line.length() - 1);
-      // consume folded continuation lines starting with space/tab
-      int contPos = nl;
-      while (contPos > 0 && contPos < (int)payload.length()) {
-        int nextNl = payload.indexOf('\n', contPos + 1);
-        String cont = payload.substring(contPos + 1, nextNl < 0 ? payload.length() : nextNl);
-        if (!(cont.startsWith(" ") || cont.startsWith("\t"))) break;
-        cont.trim();
-        line += cont;
-        contPos = nextNl;
-        nl = nextNl;
-      }
+void showRealtimeFrame() {
+  unsigned long nowUs = micros();
+  if (realtime.shown > 0) {
+    float interval = (float)(nowUs - realtime.lastShowUs);
+    realtime.intervalUs = realtime.intervalUs == 0 ? interval : realtime.intervalUs + (interval - realtime.intervalUs) / 16;
+    realtime.jitterUs += (fabsf(interval - realtime.intervalUs) - realtime.jitterUs) / 16;
+  }
+  realtime.lastShowUs = nowUs;
+  recordLatency(M_REALTIME_LATENCY, nowUs - realtime.lastFrameUs);
+  realtime.framePending = false;
+  realtime.shown++;
+  showFrame(true);
+}
 
-      time_t cand = parseDtstart(line);
-      if (cand > 0 && difftime(cand, nowLocal) >= 0) {
-        if (bestFuture == 0 || cand < bestFuture) bestFuture = cand;
-      }
-      if (cand > 0) {
-        if (bestAny == 0 || cand < bestAny) bestAny = cand;
-      }
+// Returns true while realtime data owns the strip.
+bool serviceRealtime() {
+  bool wanted = configState.realtimeEnabled && WiFi.isConnected() && !portalActive;
+  if (!wanted) {
+    if (realtime.e131Fd >= 0 || realtime.ddpFd >= 0) closeRealtimeSockets();
+    exitRealtime();
+    return false;
+  }
+  if (realtime.generation != areaGeneration[CFG_AREA_REALTIME]) openRealtimeSockets();
+  if (realtime.e131Fd >= 0) receiveE131();
+  if (realtime.ddpFd >= 0) receiveDdp();
 
-      if (nl < 0) break;
-      pos = nl + 1;
-    }
-    nextIcalTimes[idx] = bestFuture > 0 ? bestFuture : bestAny;
+  if (realtime.source == RT_NONE) return false;
+  if (millis() - realtime.lastPacketMs > configState.realtimeTimeoutMs && !realtime.framePending) {
+    exitRealtime();
+    return false;
   }
+  // WS2812 take ~30 us per LED plus the latch; a faster frame would only stall show().
+  unsigned long refreshUs = (unsigned long)configState.ledCount * 30 + 300;
+  if (realtime.framePending && micros() - realtime.lastShowUs >= refreshUs) showRealtimeFrame();
+  return true;
 }
 
-// --------- LED rendering ---------
-void showClock(time_t nowLocal, uint32_t colorHex, bool alert = false) {
-  fill_solid(leds, configState.ledCount, CRGB::Black);
+// Loop pacing: sleep in select() on the realtime and sync sockets so a frame
+// is shown (or a beacon timestamped) as soon as it arrives; plain delay() when
+// neither is open.
+void waitForNextPass(unsigned long ms) {
+  int syncFd = effectSync.mode == SYNC_FOLLOWER ? effectSync.fd : -1;
+  int maxFd = max(max(realtime.e131Fd, realtime.ddpFd), syncFd);
+  if (maxFd < 0) {
+    delay(ms);
+    return;
+  }
+  if (realtime.framePending) ms = 1;
+  fd_set readable;
+  FD_ZERO(&readable);
+  if (realtime.e131Fd >= 0) FD_SET(realtime.e131Fd, &readable);
+  if (realtime.ddpFd >= 0) FD_SET(realtime.ddpFd, &readable);
+  if (syncFd >= 0) FD_SET(syncFd, &readable);
+  struct timeval tv;
+  tv.tv_sec = ms / 1000;
+  tv.tv_usec = (ms % 1000) * 1000;
+  if (select(maxFd + 1, &readable, nullptr, nullptr, &tv) > 0 && syncFd >= 0 && FD_ISSET(syncFd, &readable)) {
+    receiveSyncBeacons();
+  }
+}
 
-  // Map local 12h range onto strip as a progressive fill (e.g., 20:30 -> 8 full, 9th half)
-  struct tm *tmNow = localtime(&nowLocal);
-  double hours12 = (tmNow->tm_hour % 12) + (tmNow->tm_min / 60.0); // 0..12
-  double pos = (hours12 / 12.0) * configState.ledCount;   // 0..ledCount
-  int full = floor(pos);
-  double frac = pos - full; // 0..1
+// --------- Frame streaming & capture ---------
+// Remote preview of the real frame buffer. Clients subscribe via SSE
+// (GET /api/frames/stream?fps=N); the first event is a full keyframe, later
+// events only carry LEDs that changed. SSE is text, so pixels are hex encoded:
+//   event: key   data: RRGGBB RRGGBB ... (one per LED, no separators)
+//   event: delta data: IIIIRRGGBB ...    (4 hex digit LED index + color)
+// Each client has a fixed output buffer written with non-blocking sends. While
+// a slow client still drains its buffer, new frames are skipped for it (the
+// next delta is taken against what it last received), so it never blocks
+// rendering.
+#define MAX_STREAM_CLIENTS 2
+#define STREAM_OUT_BYTES (DEFAULT_LED_COUNT * 10 + 32)
+#define STREAM_PING_MS 15000UL
+#define FRAME_CAPTURE_BYTES 8192
 
-  CRGB base;
-  colorToCrgb(colorHex, base);
-  if (alert && ((millis() / 400) % 2 == 0)) {
-    base = CRGB::White; // blink for appointment alert
-  }
+struct FrameStreamClient {
+  WiFiClient client;
+  bool active = false;
+  bool needKeyframe = true;
+  uint16_t intervalMs = 100;
+  unsigned long lastSendMs = 0;
+  CRGB lastSent[DEFAULT_LED_COUNT];
+  char out[STREAM_OUT_BYTES];
+  uint16_t outLen = 0;
+  uint16_t outPos = 0;
+  uint32_t skipped = 0; // frames skipped because the client was still busy
+};
 
-  for (int i = 0; i < configState.ledCount; ++i) {
-    if (i < full) {
-      leds[i] = base;
-    } else if (i == full && frac > 0.0 && i < configState.ledCount) {
-      leds[i] = base;
-      leds[i].nscale8_video((uint8_t)round(frac * 255));
-    } else {
-      leds[i] = CRGB::Black;
+// Capture: frames land in a ring of fixed slots (timestamp + RGB per LED).
+// With a frame target the capture stops once that many frames were taken,
+// without one it keeps overwriting the oldest frames.
+struct FrameCapture {
+  bool running = false;
+  uint16_t target = 0;      // 0 = continuous
+  uint16_t slots = 0;       // capacity in frames for the current LED count
+  uint16_t head = 0;        // next slot to write
+  uint16_t stored = 0;      // valid frames in the ring
+  uint32_t taken = 0;       // frames taken since start
+  unsigned long startMs = 0;
+};
+
+FrameStreamClient streamClients[MAX_STREAM_CLIENTS];
+FrameCapture frameCapture;
+uint8_t captureRing[FRAME_CAPTURE_BYTES];
+
+size_t captureSlotBytes() {
+  return 4 + (size_t)configState.ledCount * 3;
+}
+
+void startFrameCapture(uint16_t frames) {
+  frameCapture.slots = FRAME_CAPTURE_BYTES / captureSlotBytes();
+  frameCapture.target = min<uint16_t>(frames, frameCapture.slots);
+  frameCapture.head = 0;
+  frameCapture.stored = 0;
+  frameCapture.taken = 0;
+  frameCapture.startMs = millis();
+  frameCapture.running = true;
+}
+
+// Called for every frame pushed to the strip; unchanged frames are not pushed,
+// so the capture holds change events with their timestamps.
+void onFrameShown() {
+  if (!frameCapture.running || frameCapture.slots == 0) return;
+  uint8_t *slot = captureRing + (size_t)frameCapture.head * captureSlotBytes();
+  uint32_t ts = millis() - frameCapture.startMs;
+  memcpy(slot, &ts, 4);
+  memcpy(slot + 4, leds, (size_t)configState.ledCount * 3);
+  frameCapture.head = (frameCapture.head + 1) % frameCapture.slots;
+  if (frameCapture.stored < frameCapture.slots) frameCapture.stored++;
+  frameCapture.taken++;
+  if (frameCapture.target > 0 && frameCapture.taken >= frameCapture.target) frameCapture.running = false;
+}
+
+void appendHexByte(char *dst, uint16_t &len, uint8_t v) {
+  static const char digits[] = "0123456789abcdef";
+  dst[len++] = digits[v >> 4];
+  dst[len++] = digits[v & 0x0f];
+}
+
+void appendText(char *dst, uint16_t &len, const char *text) {
+  size_t n = strlen(text);
+  memcpy(dst + len, text, n);
+  len += n;
+}
+
+// Encode the current frame for one client; returns false if nothing changed.
+bool encodeStreamFrame(FrameStreamClient &sc) {
+  const int count = configState.ledCount;
+  uint16_t len = 0;
+  if (sc.needKeyframe) {
+    appendText(sc.out, len, "event: key\ndata: ");
+    for (int i = 0; i < count; ++i) {
+      appendHexByte(sc.out, len, leds[i].r);
+      appendHexByte(sc.out, len, leds[i].g);
+      appendHexByte(sc.out, len, leds[i].b);
     }
+    sc.needKeyframe = false;
+  } else {
+    appendText(sc.out, len, "event: delta\ndata: ");
+    uint16_t header = len;
+    for (int i = 0; i < count; ++i) {
+      if (leds[i] == sc.lastSent[i]) continue;
+      appendHexByte(sc.out, len, i >> 8);
+      appendHexByte(sc.out, len, i & 0xff);
+      appendHexByte(sc.out, len, leds[i].r);
+      appendHexByte(sc.out, len, leds[i].g);
+      appendHexByte(sc.out, len, leds[i].b);
+    }
+    if (len == header) return false;
   }
+  appendText(sc.out, len, "\n\n");
+  memcpy(sc.lastSent, leds, sizeof(CRGB) * count);
+  sc.outLen = len;
+  sc.outPos = 0;
+  return true;
+}
 
-  FastLED.show();
+void closeStreamClient(FrameStreamClient &sc) {
+  sc.client.stop();
+  sc.client = WiFiClient();
+  sc.active = false;
 }
 
-void showStatus(time_t nowLocal) {
-  bool open = isOpenNow(nowLocal);
-  CRGB c;
-  colorToCrgb(parseHexColor(open ? configState.openColor : configState.closedColor), c);
-  fill_solid(leds, configState.ledCount, c);
-  FastLED.show();
+// Push pending bytes without blocking; false if the client went away.
+bool flushStreamClient(FrameStreamClient &sc) {
+  while (sc.outPos < sc.outLen) {
+    int sent = send(sc.client.fd(), sc.out + sc.outPos, sc.outLen - sc.outPos, MSG_DONTWAIT);
+    if (sent > 0) {
+      sc.outPos += sent;
+      continue;
+    }
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    return false;
+  }
+  sc.outLen = sc.outPos = 0;
+  return true;
 }
 
-void showEffect() {
-  static uint8_t hue = 0;
-  static uint16_t chase = 0;
-  static unsigned long lastTheaterStep = 0;
-  static unsigned long lastXmasStep = 0;
+void pumpFrameStreams() {
   const unsigned long nowMs = millis();
-  if (configState.effect == "solid") {
-    CRGB c;
-    colorToCrgb(parseHexColor(configState.effectColor), c);
-    fill_solid(leds, configState.ledCount, c);
-  } else if (configState.effect == "breathe") {
-    CRGB c;
-    colorToCrgb(parseHexColor(configState.effectColor), c);
-    uint8_t bpm = map(constrain(configState.effectSpeed, 1, 20), 1, 20, 6, 30);
-    uint8_t val = beatsin8(bpm, 10, 255);
-    c.nscale8_video(val);
-    fill_solid(leds, configState.ledCount, c);
-  } else if (configState.effect == "theater") {
-    CRGB c;
-    colorToCrgb(parseHexColor(configState.effectColor), c);
-    fill_solid(leds, configState.ledCount, CRGB::Black);
-    uint8_t speed = constrain(configState.effectSpeed, 1, 20);
-    uint16_t stepMs = map(speed, 1, 20, 250, 40);
-    if (nowMs - lastTheaterStep >= stepMs) {
-      lastTheaterStep = nowMs;
-      chase = (chase + 1) % 3;
-    }
-    for (int i = chase % 3; i < configState.ledCount; i += 3) {
-      leds[i] = c;
+  for (int c = 0; c < MAX_STREAM_CLIENTS; ++c) {
+    FrameStreamClient &sc = streamClients[c];
+    if (!sc.active) continue;
+    if (!sc.client.connected() || !flushStreamClient(sc)) {
+      closeStreamClient(sc);
+      continue;
     }
-  } else if (configState.effect == "twinkle") {
-    for (int i = 0; i < configState.ledCount; ++i) {
-      leds[i].fadeToBlackBy(20);
-      if (random8() < constrain(configState.effectSpeed, 1, 20)) {
-        CRGB c;
-        colorToCrgb(parseHexColor(configState.effectColor), c);
-        leds[i] = c;
-      }
+    if (nowMs - sc.lastSendMs < sc.intervalMs) continue;
+    if (sc.outLen > 0) { // still draining the previous frame
+      sc.skipped++;
+      continue;
     }
-  } else if (configState.effect == "xmas") {
-    // Colorful blinking string: red, green, gold, blue with gentle decay
-    static const CRGB palette[] = {CRGB::Red, CRGB::Green, CRGB(255,215,0), CRGB::Blue};
-    uint8_t speed = constrain(configState.effectSpeed, 1, 20);
-    uint16_t stepMs = map(speed, 1, 20, 320, 80);
-    uint8_t chance = map(speed, 1, 20, 20, 120); // more hits when faster
-    if (nowMs - lastXmasStep >= stepMs) {
-      lastXmasStep = nowMs;
-      for (int i = 0; i < configState.ledCount; ++i) {
-        leds[i].fadeToBlackBy(40);
-        if (random8() < chance) {
-          leds[i] = palette[random8(4)];
-        }
-      }
+    bool queued = encodeStreamFrame(sc);
+    if (!queued && nowMs - sc.lastSendMs >= STREAM_PING_MS) {
+      sc.outLen = 0;
+      appendText(sc.out, sc.outLen, ": ping\n\n");
+      sc.outPos = 0;
+      queued = true;
     }
-  } else {
-    uint8_t step = constrain(configState.effectSpeed, 1, 20);
-    for (int i = 0; i < configState.ledCount; ++i) {
-      leds[i] = CHSV(hue + i * 3, 255, 255);
+    if (queued) {
+      sc.lastSendMs = nowMs;
+      if (!flushStreamClient(sc)) closeStreamClient(sc);
     }
-    hue += step;
   }
-  FastLED.show();
 }
 
-void handleLeds(time_t nowLocal) {
-  FastLED.setBrightness(configState.brightness);
-  if (configState.mode == "effect") {
-    AppointmentHit next = nextAnyAppointment(nowLocal);
-    double diff = next.when > 0 ? difftime(next.when, nowLocal) : 1e9;
-    bool appointmentActive = configState.enableAppointments && next.when > 0 && diff >= 0 && diff <= (configState.notifyMinutesBefore * 60);
-    if (appointmentActive) {
-      uint32_t color = parseHexColor(next.color.length() == 6 ? next.color : DEFAULT_APPOINT_COLOR);
-      showClock(nowLocal, color, true);
-    } else {
-      showEffect();
-    }
+void handleFrameStream() {
+  int fps = server.hasArg("fps") ? server.arg("fps").toInt() : 10;
+  fps = constrain(fps, 1, 30);
+  for (int c = 0; c < MAX_STREAM_CLIENTS; ++c) {
+    FrameStreamClient &sc = streamClients[c];
+    if (sc.active) continue;
+    sc.client = server.client();
+    sc.client.setNoDelay(true);
+    sc.client.print("HTTP/1.1 200 OK\r\n"
+                    "Content-Type: text/event-stream\r\n"
+                    "Cache-Control: no-cache\r\n"
+                    "Connection: keep-alive\r\n\r\n");
+    sc.active = true;
+    sc.needKeyframe = true;
+    sc.intervalMs = 1000 / fps;
+    sc.lastSendMs = 0;
+    sc.outLen = sc.outPos = 0;
+    sc.skipped = 0;
     return;
   }
+  server.send(503, "application/json", "{\"error\":\"too many stream clients\"}");
+}
 
-  AppointmentHit next = nextAnyAppointment(nowLocal);
-  double diff = next.when > 0 ? difftime(next.when, nowLocal) : 1e9;
-  bool appointmentActive = configState.enableAppointments && next.when > 0 && diff >= 0 && diff <= (configState.notifyMinutesBefore * 60);
-
-  if (appointmentActive) {
-    uint32_t color = parseHexColor(next.color.length() == 6 ? next.color : DEFAULT_APPOINT_COLOR);
-    showClock(nowLocal, color, true);
-    return;
-  }
+void handleFrameCaptureStart() {
+  JsonDocument doc(&bodyArena);
+  if (!parseRequestBody(server, doc)) return;
+  int frames = doc["frames"] | 0;
+  if (frames < 0) return sendJsonError("frames must be >= 0");
+  startFrameCapture((uint16_t)min(frames, 65535));
+  DynamicJsonDocument res(128);
+  res["status"] = "capturing";
+  res["frames"] = frameCapture.target;
+  res["capacity"] = frameCapture.slots;
+  String out;
+  serializeJson(res, out);
+  server.send(200, "application/json", out);
+}
 
-  // Clock base with optional open/closed overlay
-  bool open = isOpenNow(nowLocal);
-  uint32_t baseColor = parseHexColor(configState.clockColor);
-  if (configState.enableOpenHours) {
-    baseColor = parseHexColor(open ? configState.openColor : configState.closedColor);
-  }
-  showClock(nowLocal, baseColor);
+// Binary download: "LSF1", uint16 ledCount, uint16 frameCount (little endian),
+// then per frame uint32 ms since capture start followed by RGB per LED.
+void handleFrameCaptureGet() {
+  const size_t slotBytes = captureSlotBytes();
+  const uint16_t stored = frameCapture.stored;
+  uint8_t header[8] = {'L', 'S', 'F', '1'};
+  header[4] = configState.ledCount & 0xff;
+  header[5] = configState.ledCount >> 8;
+  header[6] = stored & 0xff;
+  header[7] = stored >> 8;
+  server.sendHeader("Content-Disposition", "attachment; filename=\"frames.lsf\"");
+  server.setContentLength(sizeof(header) + (size_t)stored * slotBytes);
+  server.send(200, "application/octet-stream", "");
+  server.sendContent((const char *)header, sizeof(header));
+  // oldest frame first: with a full ring that is the slot at head
+  uint16_t first = stored < frameCapture.slots ? 0 : frameCapture.head;
+  uint16_t tail = min<uint16_t>(stored, frameCapture.slots - first);
+  server.sendContent((const char *)captureRing + (size_t)first * slotBytes, (size_t)tail * slotBytes);
+  if (stored > tail) server.sendContent((const char *)captureRing, (size_t)(stored - tail) * slotBytes);
 }
 
 // --------- Web API ---------
@@ -822,27 +4579,196 @@ void handleConfigGet() {
   server.send(200, "application/json", buildConfigJson());
 }
 
+// {"status":"ok","changed":[areas]} so clients can see what an edit touched.
+String configSavedJson(uint32_t changed) {
+  DynamicJsonDocument doc(256);
+  doc["status"] = "ok";
+  JsonArray areas = doc["changed"].to<JsonArray>();
+  for (int a = 0; a < CFG_AREA_COUNT; ++a) {
+    if (changed & CFG_CHANGED(a)) areas.add(CFG_AREA_NAMES[a]);
+  }
+  String out;
+  serializeJson(doc, out);
+  return out;
+}
+
 void handleConfigPost() {
   if (server.method() != HTTP_POST) return sendJsonError("POST required");
-  String err;
-  if (!applyConfigJson(server.arg("plain"), err)) return sendJsonError(err);
-  saveConfig();
-  server.send(200, "application/json", "{\"status\":\"ok\"}");
+  uint32_t changed = 0;
+  if (!applyConfigBody(server, false, changed)) return;
+  saveConfig(changed);
+  server.send(200, "application/json", configSavedJson(changed));
+}
+
+// Sparse update: only the fields in the body are applied.
+void handleConfigPatch() {
+  uint32_t changed = 0;
+  if (!applyConfigBody(server, true, changed)) return;
+  saveConfig(changed);
+  server.send(200, "application/json", configSavedJson(changed));
 }
 
 void handleStatus() {
   server.send(200, "application/json", buildStatusJson());
 }
 
+// Small buffered writer so the metrics page goes out in ~1 KB chunks instead
+// of being assembled in one large String.
+struct MetricsWriter {
+  char buf[1024];
+  size_t len = 0;
+  WebServer *out = &server;
+
+  void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char line[192];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (n <= 0) return;
+    n = min(n, (int)sizeof(line) - 1);
+    if (len + n > sizeof(buf)) flush();
+    memcpy(buf + len, line, n);
+    len += n;
+  }
+
+  void flush() {
+    if (len == 0) return;
+    out->sendContent(buf, len);
+    len = 0;
+  }
+};
+
+// Prometheus text exposition format (version 0.0.4).
+void handleMetrics() {
+  static MetricsWriter w; // 1 KB, keep it off the loop task stack
+  w.len = 0;
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; version=0.0.4", "");
+
+  w.printf("# HELP ledsign_latency_us Latency of instrumented code paths in microseconds.\n");
+  w.printf("# TYPE ledsign_latency_us summary\n");
+  for (int m = 0; m < METRIC_COUNT; ++m) {
+    const LatencyHistogram &h = latencyHist[m];
+    const char *op = METRIC_NAMES[m];
+    w.printf("ledsign_latency_us{op=\"%s\",quantile=\"0.5\"} %u\n", op, (unsigned)histPercentileUs(h, 50));
+    w.printf("ledsign_latency_us{op=\"%s\",quantile=\"0.95\"} %u\n", op, (unsigned)histPercentileUs(h, 95));
+    w.printf("ledsign_latency_us{op=\"%s\",quantile=\"0.99\"} %u\n", op, (unsigned)histPercentileUs(h, 99));
+    w.printf("ledsign_latency_us_sum{op=\"%s\"} %llu\n", op, (unsigned long long)h.sumUs);
+    w.printf("ledsign_latency_us_count{op=\"%s\"} %u\n", op, (unsigned)h.count);
+  }
+  w.printf("# HELP ledsign_latency_max_us Longest observed latency in microseconds.\n");
+  w.printf("# TYPE ledsign_latency_max_us gauge\n");
+  for (int m = 0; m < METRIC_COUNT; ++m) {
+    w.printf("ledsign_latency_max_us{op=\"%s\"} %u\n", METRIC_NAMES[m], (unsigned)latencyHist[m].maxUs);
+  }
+
+  w.printf("# TYPE ledsign_heap_free_bytes gauge\nledsign_heap_free_bytes %u\n", (unsigned)ESP.getFreeHeap());
+  w.printf("# TYPE ledsign_heap_min_free_bytes gauge\nledsign_heap_min_free_bytes %u\n", (unsigned)ESP.getMinFreeHeap());
+  w.printf("# TYPE ledsign_heap_largest_free_block_bytes gauge\nledsign_heap_largest_free_block_bytes %u\n", (unsigned)ESP.getMaxAllocHeap());
+  w.printf("# TYPE ledsign_heap_min_largest_free_block_bytes gauge\nledsign_heap_min_largest_free_block_bytes %u\n",
+           (unsigned)(runtimeStats.minLargestBlock == UINT32_MAX ? ESP.getMaxAllocHeap() : runtimeStats.minLargestBlock));
+  w.printf("# HELP ledsign_request_body_arena_high_water_bytes Most of the %u-byte body arena used by one request.\n", (unsigned)BODY_ARENA_BYTES);
+  w.printf("# TYPE ledsign_request_body_arena_high_water_bytes gauge\nledsign_request_body_arena_high_water_bytes %u\n", (unsigned)bodyArena.highWater);
+  w.printf("# TYPE ledsign_request_bodies_total counter\n");
+  w.printf("ledsign_request_bodies_total{result=\"received\"} %u\n", (unsigned)bodyArena.requests);
+  w.printf("ledsign_request_bodies_total{result=\"too_large\"} %u\n", (unsigned)bodyArena.tooLarge);
+  w.printf("# TYPE ledsign_request_body_alloc_failures_total counter\nledsign_request_body_alloc_failures_total %u\n", (unsigned)bodyArena.noMemory);
+  w.printf("# TYPE ledsign_loop_iterations_total counter\nledsign_loop_iterations_total %u\n", (unsigned)runtimeStats.loopIterations);
+  w.printf("# HELP ledsign_stalls_total Loop passes over %u ms and render scopes over %u ms since boot.\n",
+           (unsigned)STALL_LOOP_MS, (unsigned)STALL_RENDER_MS);
+  w.printf("# TYPE ledsign_stalls_total counter\n");
+  w.printf("ledsign_stalls_total{kind=\"loop\"} %u\n", (unsigned)stallWatch.count[STALL_LOOP]);
+  w.printf("ledsign_stalls_total{kind=\"render\"} %u\n", (unsigned)stallWatch.count[STALL_RENDER]);
+  w.printf("# TYPE ledsign_stall_max_ms gauge\nledsign_stall_max_ms %u\n", (unsigned)stallWatch.maxMs);
+  w.printf("# TYPE ledsign_uptime_seconds gauge\nledsign_uptime_seconds %lu\n", millis() / 1000UL);
+  w.printf("# TYPE ledsign_power_draw_milliamps gauge\nledsign_power_draw_milliamps %u\n", (unsigned)powerState.drawMa);
+  w.printf("# HELP ledsign_boot_ms Milliseconds from app start to each boot milestone.\n");
+  w.printf("# TYPE ledsign_boot_ms gauge\n");
+  w.printf("ledsign_boot_ms{stage=\"first_frame\"} %lu\n", bootTimings.firstFrameMs);
+  w.printf("ledsign_boot_ms{stage=\"config\"} %lu\n", bootTimings.configMs);
+  w.printf("ledsign_boot_ms{stage=\"wifi\"} %lu\n", bootTimings.wifiMs);
+  w.printf("ledsign_boot_ms{stage=\"http_ready\"} %lu\n", bootTimings.httpReadyMs);
+  w.printf("# TYPE ledsign_realtime_active gauge\nledsign_realtime_active{source=\"%s\"} %d\n",
+           RT_SOURCE_NAMES[realtime.source], realtime.source != RT_NONE ? 1 : 0);
+  w.printf("# TYPE ledsign_realtime_frames_total counter\n");
+  w.printf("ledsign_realtime_frames_total{result=\"shown\"} %u\n", (unsigned)realtime.shown);
+  w.printf("ledsign_realtime_frames_total{result=\"dropped\"} %u\n", (unsigned)realtime.dropped);
+  w.printf("# TYPE ledsign_realtime_packets_total counter\n");
+  w.printf("ledsign_realtime_packets_total{result=\"received\"} %u\n", (unsigned)realtime.packets);
+  w.printf("ledsign_realtime_packets_total{result=\"out_of_order\"} %u\n", (unsigned)realtime.outOfOrder);
+  w.printf("ledsign_realtime_packets_total{result=\"lost\"} %u\n", (unsigned)realtime.lost);
+  w.printf("ledsign_realtime_packets_total{result=\"invalid\"} %u\n", (unsigned)realtime.invalid);
+  w.printf("# TYPE ledsign_realtime_interval_us gauge\nledsign_realtime_interval_us %u\n", (unsigned)realtime.intervalUs);
+  w.printf("# TYPE ledsign_realtime_jitter_us gauge\nledsign_realtime_jitter_us %u\n", (unsigned)realtime.jitterUs);
+  w.printf("# TYPE ledsign_sync_beacons_total counter\n");
+  w.printf("ledsign_sync_beacons_total{result=\"sent\"} %u\n", (unsigned)effectSync.sent);
+  w.printf("ledsign_sync_beacons_total{result=\"received\"} %u\n", (unsigned)effectSync.received);
+  w.printf("ledsign_sync_beacons_total{result=\"ignored\"} %u\n", (unsigned)effectSync.ignored);
+  w.printf("# TYPE ledsign_sync_locked gauge\nledsign_sync_locked %d\n", effectSync.locked ? 1 : 0);
+  w.printf("# HELP ledsign_sync_error_us Leader minus follower effect clock, least delayed beacon of the last window.\n");
+  w.printf("# TYPE ledsign_sync_error_us gauge\nledsign_sync_error_us %lld\n", (long long)effectSync.lastErrUs);
+  w.printf("# TYPE ledsign_sync_freq_ppb gauge\nledsign_sync_freq_ppb %d\n", (int)effectSync.freqPpb);
+  w.printf("# TYPE ledsign_sync_steps_total counter\nledsign_sync_steps_total %u\n", (unsigned)effectSync.steps);
+  w.printf("# HELP ledsign_esp_current_avg_milliamps Estimated average module current since boot (LEDs excluded).\n");
+  w.printf("# TYPE ledsign_esp_current_avg_milliamps gauge\nledsign_esp_current_avg_milliamps %u\n", (unsigned)averageEspMa());
+  w.printf("# TYPE ledsign_cpu_mhz gauge\nledsign_cpu_mhz %u\n", (unsigned)getCpuFrequencyMhz());
+  w.printf("# TYPE ledsign_power_level_seconds_total counter\n");
+  w.printf("ledsign_power_level_seconds_total{level=\"active\"} %llu\n", (unsigned long long)(powerMgr.activeMs / 1000));
+  w.printf("ledsign_power_level_seconds_total{level=\"idle\"} %llu\n", (unsigned long long)(powerMgr.idleMs / 1000));
+  w.printf("# TYPE ledsign_power_wakeups_total counter\nledsign_power_wakeups_total %u\n", (unsigned)powerMgr.wakeups);
+  w.printf("# HELP ledsign_time_offset_us NTP minus local clock at the last accepted sync.\n");
+  w.printf("# TYPE ledsign_time_offset_us gauge\nledsign_time_offset_us %lld\n", (long long)timeStats.lastOffsetUs);
+  w.printf("# TYPE ledsign_time_drift_ppm gauge\nledsign_time_drift_ppm %.2f\n", timeStats.driftPpm);
+  w.printf("# TYPE ledsign_time_since_sync_seconds gauge\nledsign_time_since_sync_seconds %ld\n",
+           timeStats.syncs ? (long)((millis() - timeStats.lastSyncMs) / 1000UL) : -1L);
+  w.printf("# TYPE ledsign_time_syncs_total counter\n");
+  w.printf("ledsign_time_syncs_total{result=\"step\"} %u\n", (unsigned)timeStats.steps);
+  w.printf("ledsign_time_syncs_total{result=\"slew\"} %u\n", (unsigned)timeStats.slews);
+  w.printf("ledsign_time_syncs_total{result=\"rejected\"} %u\n", (unsigned)timeStats.rejected);
+  w.printf("# TYPE ledsign_time_source gauge\nledsign_time_source{source=\"%s\"} 1\n", TIME_SOURCE_NAMES[timeStats.source]);
+  w.printf("# TYPE ledsign_scene_transitions_total counter\nledsign_scene_transitions_total %u\n", (unsigned)sceneState.transitions);
+  w.printf("# HELP ledsign_scene_resolves_total Segment lookups (transitions, full hours, clock jumps); frames in between are a range check.\n");
+  w.printf("# TYPE ledsign_scene_resolves_total counter\nledsign_scene_resolves_total %u\n", (unsigned)sceneState.resolves);
+  w.printf("# TYPE ledsign_scene_segments gauge\nledsign_scene_segments %u\n", (unsigned)sceneState.count);
+  w.printf("# TYPE ledsign_ical_tz_zones gauge\nledsign_ical_tz_zones %u\n", (unsigned)tzCache.zoneCount);
+  w.printf("# HELP ledsign_ical_tz_unknown_total Event times with a TZID that is neither in the feed nor known; read in the device zone.\n");
+  w.printf("# TYPE ledsign_ical_tz_unknown_total counter\nledsign_ical_tz_unknown_total %u\n", (unsigned)tzCache.unknownTzids);
+  w.printf("# HELP ledsign_ota_delta_fallbacks_total Delta updates that did not apply and fell back to the full image.\n");
+  w.printf("# TYPE ledsign_ota_delta_fallbacks_total counter\nledsign_ota_delta_fallbacks_total %u\n", (unsigned)otaStats.deltaFallbacks);
+  w.printf("# TYPE ledsign_appointments_stored gauge\nledsign_appointments_stored %u\n", (unsigned)apptStore.count);
+  w.printf("# TYPE ledsign_appointments_store_writes_total counter\nledsign_appointments_store_writes_total %u\n", (unsigned)apptStore.writes);
+  w.printf("# TYPE ledsign_appointments_pruned_total counter\nledsign_appointments_pruned_total %u\n", (unsigned)apptStore.pruned);
+  w.printf("# HELP ledsign_appointments_rejected_total Entries not stored because the store was full or the time was invalid.\n");
+  w.printf("# TYPE ledsign_appointments_rejected_total counter\nledsign_appointments_rejected_total %u\n", (unsigned)apptStore.rejected);
+  w.printf("# TYPE ledsign_mqtt_connected gauge\nledsign_mqtt_connected %d\n", mqttStats.connected ? 1 : 0);
+  w.printf("# TYPE ledsign_mqtt_connects_total counter\n");
+  w.printf("ledsign_mqtt_connects_total{result=\"ok\"} %u\n", (unsigned)mqttStats.connects);
+  w.printf("ledsign_mqtt_connects_total{result=\"failed\"} %u\n", (unsigned)mqttStats.failures);
+  w.printf("# TYPE ledsign_mqtt_published_total counter\nledsign_mqtt_published_total %u\n", (unsigned)mqttStats.published);
+  w.printf("# HELP ledsign_mqtt_dropped_total Messages dropped because a queue to or from the MQTT task was full.\n");
+  w.printf("# TYPE ledsign_mqtt_dropped_total counter\n");
+  w.printf("ledsign_mqtt_dropped_total{dir=\"out\"} %u\n", (unsigned)mqttStats.dropped);
+  w.printf("ledsign_mqtt_dropped_total{dir=\"in\"} %u\n", (unsigned)mqttStats.commandsDropped);
+  w.printf("# TYPE ledsign_mqtt_commands_total counter\nledsign_mqtt_commands_total %u\n", (unsigned)mqttStats.commands);
+  w.printf("# TYPE ledsign_build_info gauge\nledsign_build_info{version=\"%s\"} 1\n", FW_VERSION);
+  w.flush();
+  server.sendContent("");
+}
+
+void handleLayoutGet() {
+  server.send(200, "application/json", buildLayoutJson());
+}
+
 void handleUpdate() {
   if (server.method() != HTTP_POST) return sendJsonError("POST required");
-  DynamicJsonDocument doc(256);
-  DeserializationError err = deserializeJson(doc, server.arg("plain"));
-  if (err) return sendJsonError("JSON parse error");
+  JsonDocument doc(&bodyArena);
+  if (!parseRequestBody(server, doc)) return;
   String url = doc["url"].as<String>();
-  if (url.length() == 0) return sendJsonError("url missing");
+  String deltaUrl = doc["deltaUrl"].as<String>();
+  if (url.length() == 0 && deltaUrl.length() == 0) return sendJsonError("url missing");
   Serial.printf("[OTA] API /update FW: %s\n", url.c_str());
-  bool ok = performUpdate(url, false);
+  bool ok = performFirmwareUpdate(url, deltaUrl);
   if (!ok) return sendJsonError("update failed");
   server.send(200, "application/json", "{\"status\":\"rebooting\"}");
   delay(500);
@@ -851,9 +4777,8 @@ void handleUpdate() {
 
 void handleUpdateFs() {
   if (server.method() != HTTP_POST) return sendJsonError("POST required");
-  DynamicJsonDocument doc(256);
-  DeserializationError err = deserializeJson(doc, server.arg("plain"));
-  if (err) return sendJsonError("JSON parse error");
+  JsonDocument doc(&bodyArena);
+  if (!parseRequestBody(server, doc)) return;
   String url = doc["url"].as<String>();
   if (url.length() == 0) return sendJsonError("url missing");
   Serial.printf("[OTA] API /updatefs FS: %s\n", url.c_str());
@@ -864,61 +4789,279 @@ void handleUpdateFs() {
   ESP.restart();
 }
 
-void handleUpdateBundle() {
-  if (server.method() != HTTP_POST) return sendJsonError("POST required");
-  DynamicJsonDocument doc(384);
-  DeserializationError err = deserializeJson(doc, server.arg("plain"));
-  if (err) return sendJsonError("JSON parse error");
-  String fwUrl = doc["fwUrl"].as<String>();
-  String fsUrl = doc["fsUrl"].as<String>();
-  if (fwUrl.length() == 0) return sendJsonError("fwUrl missing");
+void handleUpdateBundle() {
+  if (server.method() != HTTP_POST) return sendJsonError("POST required");
+  JsonDocument doc(&bodyArena);
+  if (!parseRequestBody(server, doc)) return;
+  String fwUrl = doc["fwUrl"].as<String>();
+  String fsUrl = doc["fsUrl"].as<String>();
+  String deltaUrl = doc["deltaUrl"].as<String>();
+  if (fwUrl.length() == 0) return sendJsonError("fwUrl missing");
+
+  Serial.printf("[OTA] API /update_bundle FW: %s\n", fwUrl.c_str());
+  if (fsUrl.length() > 0) {
+    Serial.printf("[OTA] API /update_bundle FS: %s\n", fsUrl.c_str());
+    if (!updateFsPreserveConfig(fsUrl)) return sendJsonError("fs update failed");
+  }
+
+  if (!performFirmwareUpdate(fwUrl, deltaUrl)) return sendJsonError("fw update failed");
+
+  server.send(200, "application/json", "{\"status\":\"rebooting\"}");
+  delay(500);
+  ESP.restart();
+}
+
+// Query bounds may be epoch seconds or "YYYY-MM-DD HH:MM" (local).
+time_t parseTimeArg(const String &val, time_t fallback) {
+  if (val.length() == 0) return fallback;
+  time_t t;
+  if (val.indexOf('-') > 0) return parseAppointmentTime(val, t) ? t : fallback;
+  return (time_t)strtoll(val.c_str(), nullptr, 10);
+}
+
+static MetricsWriter appointmentWriter; // appointment list/export and stalls, off the loop task stack
+
+// GET /api/appointments[?from=&to=&offset=&limit=]; streamed, so the full
+// store never has to fit in one JSON document. X-Total-Count is the number
+// of entries in the range before offset/limit.
+void sendAppointmentList(WebServer &srv) {
+  time_t from = parseTimeArg(srv.arg("from"), 0);
+  time_t to = parseTimeArg(srv.arg("to"), std::numeric_limits<time_t>::max());
+  int offset = max(0, (int)srv.arg("offset").toInt());
+  int limit = srv.hasArg("limit") ? max(0, (int)srv.arg("limit").toInt()) : MAX_STORED_APPOINTMENTS;
+  int first = lowerBoundAppointment(from);
+  int end = lowerBoundAppointment(to);
+  MetricsWriter &w = appointmentWriter;
+  w.len = 0;
+  w.out = &srv;
+  srv.sendHeader("X-Total-Count", String(end - first));
+  srv.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  srv.send(200, "application/json", "");
+  w.printf("[");
+  int stop = min(end, first + offset + limit);
+  for (int i = first + offset; i < stop; ++i) {
+    const StoredAppointment &a = apptStore.entries[i];
+    w.printf("%s{\"index\":%d,\"when\":%u,\"time\":\"%s\",\"color\":\"%02x%02x%02x\"}", i > first + offset ? "," : "", i,
+             (unsigned)a.when, formatLocalTime(a.when).c_str(), a.r, a.g, a.b);
+  }
+  w.printf("]");
+  w.flush();
+  srv.sendContent("");
+}
+
+// POST body: one {"time","color"} object or an array of them; one flash write.
+// Arrays are parsed element by element.
+void addAppointmentsJson(WebServer &srv) {
+  int invalid = 0, added = 0;
+  if (bodyIsArray()) {
+    uint32_t color = parseHexColor(DEFAULT_APPOINT_COLOR);
+    beginAppointmentBatch(false);
+    bool ok = forEachBodyElement(srv, [&](JsonVariantConst v) {
+      if (stageAppointmentJson(v, color)) added++;
+      else invalid++;
+    });
+    if (!ok) return discardAppointmentBatch();
+  } else {
+    JsonDocument doc(&bodyArena);
+    if (!parseRequestBody(srv, doc)) return;
+    beginAppointmentBatch(false);
+    String t = doc["time"].as<String>();
+    String c = doc["color"].as<String>();
+    if (t.length() == 0) return sendJsonErrorTo(srv, "time missing");
+    time_t when;
+    if (!parseAppointmentTime(t, when) || !stageAppointment(when, parseHexColor(c.length() == 6 ? c : DEFAULT_APPOINT_COLOR))) {
+      return sendJsonErrorTo(srv, "invalid time or full");
+    }
+    added = 1;
+  }
+  if (added == 0) {
+    discardAppointmentBatch();
+    return sendJsonErrorTo(srv, "invalid time or full");
+  }
+  commitAppointments(time(nullptr));
+  srv.send(200, "application/json",
+           "{\"status\":\"ok\",\"added\":" + String(added) + ",\"skipped\":" + String(invalid) +
+           ",\"total\":" + String(apptStore.count) + "}");
+}
+
+// DELETE body: {"index":n} or {"from":..,"to":..} (same formats as the query).
+void deleteAppointmentsJson(WebServer &srv) {
+  JsonDocument doc(&bodyArena);
+  if (!parseRequestBody(srv, doc)) return;
+  if (doc["from"].isNull() && doc["to"].isNull()) {
+    int idx = doc["index"] | -1;
+    if (!deleteAppointment(idx)) return sendJsonErrorTo(srv, "invalid index");
+    return srv.send(200, "application/json", "{\"status\":\"ok\",\"removed\":1}");
+  }
+  time_t from = parseTimeArg(doc["from"].as<String>(), 0);
+  time_t to = parseTimeArg(doc["to"].as<String>(), std::numeric_limits<time_t>::max());
+  int first = lowerBoundAppointment(from);
+  int end = lowerBoundAppointment(to);
+  removeAppointments(first, end, end > first);
+  srv.send(200, "application/json", "{\"status\":\"ok\",\"removed\":" + String(max(0, end - first)) + "}");
+}
+
+void handleAppointmentsGet() {
+  sendAppointmentList(server);
+}
+
+void handleAppointmentsPost() {
+  if (server.method() != HTTP_POST) return sendJsonError("POST required");
+  addAppointmentsJson(server);
+}
+
+void handleAppointmentsDelete() {
+  if (server.method() != HTTP_DELETE) return sendJsonError("DELETE required");
+  deleteAppointmentsJson(server);
+}
+
+// Import: multipart upload (field name does not matter) or a raw body.
+// ICS is parsed while it streams in; JSON is collected in the body arena (up
+// to BODY_MAX_BYTES) and parsed there, array elements one at a time. Nothing
+// is written unless the whole import parsed.
+enum ImportFormat : uint8_t { IMPORT_UNKNOWN, IMPORT_ICS, IMPORT_JSON };
 
-  Serial.printf("[OTA] API /update_bundle FW: %s\n", fwUrl.c_str());
-  if (fsUrl.length() > 0) {
-    Serial.printf("[OTA] API /update_bundle FS: %s\n", fsUrl.c_str());
-    if (!updateFsPreserveConfig(fsUrl)) return sendJsonError("fs update failed");
+struct AppointmentImport {
+  ImportFormat format = IMPORT_UNKNOWN;
+  IcsImport ics;
+  bool started = false;
+  bool tooLarge = false;
+  size_t bytes = 0;
+};
+
+static AppointmentImport apptImport;
+
+void beginAppointmentImport(WebServer &srv) {
+  apptImport.format = IMPORT_UNKNOWN;
+  apptImport.tooLarge = false;
+  apptImport.bytes = 0;
+  apptImport.started = true;
+  String c = srv.arg("color");
+  apptImport.ics.reset(parseHexColor(c.length() == 6 ? c : configState.icalColor));
+  beginAppointmentBatch(srv.arg("replace") == "1");
+}
+
+void feedAppointmentImport(const uint8_t *data, size_t len) {
+  apptImport.bytes += len;
+  size_t i = 0;
+  while (apptImport.format == IMPORT_UNKNOWN && i < len) {
+    char ch = (char)data[i];
+    if (ch == '[' || ch == '{') apptImport.format = IMPORT_JSON;
+    else if (!isspace((unsigned char)ch) && (uint8_t)ch != 0xef && (uint8_t)ch != 0xbb && (uint8_t)ch != 0xbf) apptImport.format = IMPORT_ICS;
+    else i++; // whitespace or UTF-8 BOM
   }
+  if (apptImport.format == IMPORT_ICS) {
+    apptImport.ics.feed(data + i, len - i);
+  } else if (apptImport.format == IMPORT_JSON && !apptImport.tooLarge) {
+    apptImport.tooLarge = !bodyArena.append(data + i, len - i);
+  }
+}
 
-  if (!performUpdate(fwUrl, false)) return sendJsonError("fw update failed");
+void appointmentImportChunk(WebServer &srv, HTTPRawStatus status, const uint8_t *data, size_t len) {
+  if (status == RAW_START) beginAppointmentImport(srv);
+  else if (status == RAW_WRITE) feedAppointmentImport(data, len);
+  else if (status == RAW_ABORTED) {
+    apptImport.started = false;
+    discardAppointmentBatch();
+  }
+}
 
-  server.send(200, "application/json", "{\"status\":\"rebooting\"}");
-  delay(500);
-  ESP.restart();
+void handleAppointmentsImport() {
+  bool started = apptImport.started;
+  apptImport.started = false;
+  int imported = 0, skipped = 0;
+  if (!started || apptImport.format == IMPORT_UNKNOWN) {
+    if (started) discardAppointmentBatch();
+    return sendJsonError("no data");
+  }
+  if (apptImport.tooLarge) {
+    discardAppointmentBatch();
+    return sendBodyTooLarge(server);
+  }
+  if (apptImport.format == IMPORT_ICS) {
+    apptImport.ics.finish();
+    imported = apptImport.ics.staged;
+    skipped = apptImport.ics.events - apptImport.ics.staged;
+  } else if (bodyIsArray()) {
+    uint32_t color = apptImport.ics.color;
+    bool ok = forEachBodyElement(server, [&](JsonVariantConst v) {
+      if (stageAppointmentJson(v, color)) imported++;
+      else skipped++;
+    });
+    if (!ok) return discardAppointmentBatch();
+  } else {
+    // {"appointments":[...]} is parsed as a whole.
+    JsonDocument doc(&bodyArena);
+    if (!parseRequestBody(server, doc)) return discardAppointmentBatch();
+    imported = stageAppointmentsJson(doc["appointments"].as<JsonArrayConst>(), apptImport.ics.color, skipped);
+  }
+  commitAppointments(time(nullptr));
+  server.send(200, "application/json",
+              "{\"status\":\"ok\",\"imported\":" + String(imported) + ",\"skipped\":" + String(skipped) +
+              ",\"total\":" + String(apptStore.count) + "}");
 }
 
-void handleAppointmentsGet() {
-  DynamicJsonDocument doc(1024);
-  JsonArray arr = doc.to<JsonArray>();
-  for (int i = 0; i < configState.appointmentCount; ++i) {
-    JsonObject o = arr.add<JsonObject>();
-    o["time"] = configState.appointments[i].time;
-    o["color"] = configState.appointments[i].color;
+// Stall samples from the RTC ring, newest first. Samples with a lower boot
+// than the current one were taken before a soft reset.
+void handleStallsGet() {
+  MetricsWriter &w = appointmentWriter;
+  w.len = 0;
+  w.out = &server;
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  w.printf("{\"boot\":%u,\"resetReason\":\"%s\",\"loopMs\":%u,\"renderMs\":%u,\"total\":%u,\"samples\":[",
+           (unsigned)stallRing.boot, resetReasonName(stallWatch.resetReason), (unsigned)STALL_LOOP_MS,
+           (unsigned)STALL_RENDER_MS, (unsigned)stallRing.seq);
+  int n = min<uint32_t>(stallRing.seq, STALL_RING);
+  for (int i = 0; i < n; ++i) {
+    const StallSample &s = stallRing.samples[(stallRing.head + STALL_RING - 1 - i) % STALL_RING];
+    w.printf("%s{\"seq\":%u,\"boot\":%u,\"time\":%u,\"uptimeMs\":%u,\"kind\":\"%s\",\"phase\":\"%s\",\"stalledMs\":%u,\"backtrace\":\"",
+             i ? "," : "", (unsigned)s.seq, (unsigned)s.boot, (unsigned)s.unixTime, (unsigned)s.uptimeMs,
+             STALL_KIND_NAMES[s.kind & 1], s.phase < METRIC_COUNT ? METRIC_NAMES[s.phase] : "unknown", (unsigned)s.stalledMs);
+    for (int d = 0; d < STALL_DEPTH && s.pc[d]; ++d) w.printf("%s0x%08x", d ? " " : "", (unsigned)s.pc[d]);
+    w.printf("\"}");
   }
-  String out;
-  serializeJson(doc, out);
-  server.send(200, "application/json", out);
+  w.printf("]}");
+  w.flush();
+  server.sendContent("");
 }
 
-void handleAppointmentsPost() {
-  if (server.method() != HTTP_POST) return sendJsonError("POST required");
-  DynamicJsonDocument doc(384);
-  DeserializationError err = deserializeJson(doc, server.arg("plain"));
-  if (err) return sendJsonError("JSON parse error");
-  String t = doc["time"].as<String>();
-  String c = doc["color"].as<String>();
-  if (t.length() == 0) return sendJsonError("time missing");
-  if (!addAppointment(t, c)) return sendJsonError("invalid time or full");
+void handleStallsDelete() {
+  stallRing.head = 0;
+  stallRing.seq = 0;
   server.send(200, "application/json", "{\"status\":\"ok\"}");
 }
 
-void handleAppointmentsDelete() {
-  if (server.method() != HTTP_DELETE) return sendJsonError("DELETE required");
-  DynamicJsonDocument doc(128);
-  DeserializationError err = deserializeJson(doc, server.arg("plain"));
-  if (err) return sendJsonError("JSON parse error");
-  int idx = doc["index"] | -1;
-  if (!deleteAppointment(idx)) return sendJsonError("invalid index");
-  server.send(200, "application/json", "{\"status\":\"ok\"}");
+// GET /api/appointments/export[?format=json]; ICS by default.
+void handleAppointmentsExport() {
+  bool json = server.arg("format") == "json";
+  MetricsWriter &w = appointmentWriter;
+  w.len = 0;
+  w.out = &server;
+  server.sendHeader("Content-Disposition", json ? "attachment; filename=appointments.json" : "attachment; filename=appointments.ics");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, json ? "application/json" : "text/calendar", "");
+  if (!json) w.printf("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//ledsign//appointments//DE\r\n");
+  else w.printf("[");
+  for (int i = 0; i < apptStore.count; ++i) {
+    const StoredAppointment &a = apptStore.entries[i];
+    if (json) {
+      w.printf("%s{\"when\":%u,\"time\":\"%s\",\"color\":\"%02x%02x%02x\"}", i ? "," : "", (unsigned)a.when,
+               formatLocalTime(a.when).c_str(), a.r, a.g, a.b);
+      continue;
+    }
+    time_t when = a.when;
+    struct tm t;
+    gmtime_r(&when, &t);
+    char stamp[17];
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &t);
+    w.printf("BEGIN:VEVENT\r\nUID:%u-%02x%02x%02x@ledsign\r\nDTSTAMP:%s\r\nDTSTART:%s\r\nSUMMARY:Termin\r\n"
+             "X-LEDSIGN-COLOR:%02x%02x%02x\r\nEND:VEVENT\r\n",
+             (unsigned)a.when, a.r, a.g, a.b, stamp, stamp, a.r, a.g, a.b);
+  }
+  w.printf(json ? "]" : "END:VCALENDAR\r\n");
+  w.flush();
+  server.sendContent("");
 }
 
 void handleWifiReset() {
@@ -941,17 +5084,52 @@ String contentTypeForPath(const String &path) {
   return "application/octet-stream";
 }
 
+// Files from LittleFS; unknown paths get index.html.
+void handleStaticFile() {
+  powerWake();
+  String path = server.uri();
+  if (path == "/") path = "/index.html";
+  File f;
+  if (LittleFS.exists(path)) {
+    f = LittleFS.open(path, "r");
+    if (f) {
+      server.streamFile(f, contentTypeForPath(path));
+      f.close();
+      return;
+    }
+  }
+  f = LittleFS.open("/index.html", "r");
+  if (f) {
+    server.streamFile(f, "text/html");
+    f.close();
+  } else {
+    server.send(404, "text/plain", "Not Found");
+  }
+}
+
 void setupServer() {
-  server.on("/api/config", HTTP_GET, handleConfigGet);
-  server.on("/api/config", HTTP_POST, handleConfigPost);
-  server.on("/api/status", HTTP_GET, handleStatus);
-  server.on("/api/update", HTTP_POST, handleUpdate);
-  server.on("/api/updatefs", HTTP_POST, handleUpdateFs);
-  server.on("/api/update_bundle", HTTP_POST, handleUpdateBundle);
-  server.on("/api/appointments", HTTP_GET, handleAppointmentsGet);
-  server.on("/api/appointments", HTTP_POST, handleAppointmentsPost);
-  server.on("/api/appointments", HTTP_DELETE, handleAppointmentsDelete);
-  server.on("/api/wifi/reset", HTTP_POST, handleWifiReset);
+  server.on("/api/config", HTTP_GET, timedHandler(M_API_CONFIG_GET, handleConfigGet));
+  onBody(server, "/api/config", HTTP_POST, timedHandler(M_API_CONFIG_POST, handleConfigPost));
+  onBody(server, "/api/config", HTTP_PATCH, timedHandler(M_API_CONFIG_PATCH, handleConfigPatch));
+  server.on("/api/status", HTTP_GET, timedHandler(M_API_STATUS, handleStatus));
+  server.on("/api/layout", HTTP_GET, timedHandler(M_API_LAYOUT, handleLayoutGet));
+  server.on("/api/frames/stream", HTTP_GET, timedHandler(M_API_FRAMES_STREAM, handleFrameStream));
+  onBody(server, "/api/frames/capture", HTTP_POST, timedHandler(M_API_CAPTURE_START, handleFrameCaptureStart));
+  server.on("/api/frames/capture", HTTP_GET, timedHandler(M_API_CAPTURE_GET, handleFrameCaptureGet));
+  onBody(server, "/api/update", HTTP_POST, timedHandler(M_API_UPDATE, handleUpdate));
+  onBody(server, "/api/updatefs", HTTP_POST, timedHandler(M_API_UPDATE_FS, handleUpdateFs));
+  onBody(server, "/api/update_bundle", HTTP_POST, timedHandler(M_API_UPDATE_BUNDLE, handleUpdateBundle));
+  server.on("/api/appointments", HTTP_GET, timedHandler(M_API_APPOINTMENTS_GET, handleAppointmentsGet));
+  onBody(server, "/api/appointments", HTTP_POST, timedHandler(M_API_APPOINTMENTS_POST, handleAppointmentsPost));
+  onBody(server, "/api/appointments", HTTP_DELETE, timedHandler(M_API_APPOINTMENTS_DELETE, handleAppointmentsDelete));
+  onBody(server, "/api/appointments/import", HTTP_POST, timedHandler(M_API_APPOINTMENTS_IMPORT, handleAppointmentsImport),
+         appointmentImportChunk);
+  server.on("/api/appointments/export", HTTP_GET, timedHandler(M_API_APPOINTMENTS_EXPORT, handleAppointmentsExport));
+  onBody(server, "/api/wifi/reset", HTTP_POST, timedHandler(M_API_WIFI_RESET, handleWifiReset));
+  server.on("/api/metrics", HTTP_GET, timedHandler(M_API_METRICS, handleMetrics));
+  server.on("/api/stalls", HTTP_GET, timedHandler(M_API_STALLS, handleStallsGet));
+  onBody(server, "/api/stalls", HTTP_DELETE, timedHandler(M_API_STALLS, handleStallsDelete));
+  server.addHandler(new UnclaimedBodyHandler(handleStaticFile));
 
   server.on("/app", [](){
     File f = LittleFS.open("/index.html", "r");
@@ -973,30 +5151,13 @@ void setupServer() {
     f.close();
   });
 
-  server.onNotFound([](){
-    String path = server.uri();
-    if (path == "/") path = "/index.html";
-    File f;
-    if (LittleFS.exists(path)) {
-      f = LittleFS.open(path, "r");
-      if (f) {
-        server.streamFile(f, contentTypeForPath(path));
-        f.close();
-        return;
-      }
-    }
-    f = LittleFS.open("/index.html", "r");
-    if (f) {
-      server.streamFile(f, "text/html");
-      f.close();
-    } else {
-      server.send(404, "text/plain", "Not Found");
-    }
-  });
+  server.onNotFound(handleStaticFile);
 
   server.begin();
 }
 
+void startConfigPortal();
+
 void setupWifiAndTime() {
   WiFi.mode(WIFI_STA);
   static WiFiManager wm;
@@ -1027,115 +5188,942 @@ void setupWifiAndTime() {
       wm.server->send(200, "application/json", buildConfigJson());
     });
 
-    wm.server->on("/api/config", HTTP_POST, [&wm]() {
-      String err;
-      if (!applyConfigJson(wm.server->arg("plain"), err)) return sendJsonErrorTo(*wm.server, err);
-      saveConfig();
-      wm.server->send(200, "application/json", "{\"status\":\"ok\"}");
+    onBody(*wm.server, "/api/config", HTTP_POST, [&wm]() {
+      uint32_t changed = 0;
+      if (!applyConfigBody(*wm.server, false, changed)) return;
+      saveConfig(changed);
+      wm.server->send(200, "application/json", configSavedJson(changed));
+    });
+
+    onBody(*wm.server, "/api/config", HTTP_PATCH, [&wm]() {
+      uint32_t changed = 0;
+      if (!applyConfigBody(*wm.server, true, changed)) return;
+      saveConfig(changed);
+      wm.server->send(200, "application/json", configSavedJson(changed));
     });
 
     wm.server->on("/api/status", HTTP_GET, [&wm]() {
       wm.server->send(200, "application/json", buildStatusJson());
     });
 
-    wm.server->on("/api/appointments", HTTP_GET, [&wm]() {
-      DynamicJsonDocument doc(1024);
-      JsonArray arr = doc.to<JsonArray>();
-      for (int i = 0; i < configState.appointmentCount; ++i) {
-        JsonObject o = arr.add<JsonObject>();
-        o["time"] = configState.appointments[i].time;
-        o["color"] = configState.appointments[i].color;
-      }
-      String out;
-      serializeJson(doc, out);
-      wm.server->send(200, "application/json", out);
-    });
+    wm.server->on("/api/appointments", HTTP_GET, [&wm]() { sendAppointmentList(*wm.server); });
+    onBody(*wm.server, "/api/appointments", HTTP_POST, [&wm]() { addAppointmentsJson(*wm.server); });
+    onBody(*wm.server, "/api/appointments", HTTP_DELETE, [&wm]() { deleteAppointmentsJson(*wm.server); });
+  });
+  wm.setConfigPortalTimeout(0); // no auto-timeout; stay in portal until connected
+  if (wm.getWiFiIsSaved()) {
+    WiFi.begin(); // stored credentials; completion is picked up in serviceNetwork()
+    wifiConnecting = true;
+    wifiConnectStartMs = millis();
+    Serial.println("Connecting with stored WLAN credentials");
+  } else {
+    startConfigPortal();
+  }
+}
 
-    wm.server->on("/api/appointments", HTTP_POST, [&wm]() {
-      DynamicJsonDocument doc(384);
-      DeserializationError err = deserializeJson(doc, wm.server->arg("plain"));
-      if (err) return sendJsonErrorTo(*wm.server, "JSON parse error");
-      String t = doc["time"].as<String>();
-      String c = doc["color"].as<String>();
-      if (t.length() == 0) return sendJsonErrorTo(*wm.server, "time missing");
-      if (!addAppointment(t, c)) return sendJsonErrorTo(*wm.server, "invalid time or full");
-      wm.server->send(200, "application/json", "{\"status\":\"ok\"}");
-    });
+void startConfigPortal() {
+  wmPortal->startConfigPortal("Agentur-für-Felix");
+  portalActive = true;
+  Serial.println("Config portal active, non-blocking mode");
+}
 
-    wm.server->on("/api/appointments", HTTP_DELETE, [&wm]() {
-      DynamicJsonDocument doc(128);
-      DeserializationError err = deserializeJson(doc, wm.server->arg("plain"));
-      if (err) return sendJsonErrorTo(*wm.server, "JSON parse error");
-      int idx = doc["index"] | -1;
-      if (!deleteAppointment(idx)) return sendJsonErrorTo(*wm.server, "invalid index");
-      wm.server->send(200, "application/json", "{\"status\":\"ok\"}");
-    });
+void onWifiConnected() {
+  Serial.print("Connected: ");
+  Serial.println(WiFi.localIP());
+  if (bootTimings.wifiMs == 0) bootTimings.wifiMs = millis();
+  configTzTime(configState.tz.c_str(), "pool.ntp.org");
+  lastNtpSync = millis();
+  tzInitialized = true;
+  if (!serverStarted) {
+    setupServer();
+    serverStarted = true;
+    bootTimings.httpReadyMs = millis();
+    Serial.printf("[BOOT] first frame %lu ms%s, config %lu ms, WLAN %lu ms, HTTP ready %lu ms\n",
+                  bootTimings.firstFrameMs, bootTimings.cachedFrame ? " (cached)" : "",
+                  bootTimings.configMs, bootTimings.wifiMs, bootTimings.httpReadyMs);
+  }
+}
+
+// Drives the WLAN start without blocking the render loop: stored credentials
+// first, the setup portal if they are missing or do not connect in time.
+void serviceNetwork() {
+  if (wifiConnecting) {
+    if (WiFi.isConnected()) {
+      wifiConnecting = false;
+      onWifiConnected();
+    } else if (millis() - wifiConnectStartMs > WIFI_CONNECT_TIMEOUT_MS) {
+      wifiConnecting = false;
+      Serial.println("WLAN connect timed out");
+      startConfigPortal();
+    }
+  }
+  if (wmPortal && portalActive) {
+    wmPortal->process();
+    if (WiFi.isConnected()) {
+      wmPortal->stopConfigPortal();
+      wmPortal->setEnableConfigPortal(false);
+      WiFi.softAPdisconnect(true);
+      WiFi.mode(WIFI_STA);
+      portalActive = false;
+      onWifiConnected();
+    }
+  }
+}
+
+// --------- MQTT ---------
+// The broker connection lives in its own task, so DNS, TCP connect and the
+// CONNACK wait never stall rendering. The loop and the task only talk through
+// two bounded queues: state/metrics go out (oldest message dropped when
+// full), commands come in and are applied on the loop task through the same
+// paths as the HTTP API. Topics below <mqttTopic>:
+//   status/open, status/mode, status/next_appointment, status/notify,
+//   status/version, status/metrics (JSON)          retained
+//   availability                                   retained, LWT "offline"
+//   cmd/mode, cmd/brightness, cmd/effect, cmd/config (JSON),
+//   cmd/appointment/add ({"time","color"} or a time), cmd/appointment/remove (index)
+//   result                                         {"cmd","ok","error"}
+#define MQTT_OUT_QUEUE 8
+#define MQTT_IN_QUEUE 4
+#define MQTT_BACKOFF_MIN_MS 1000UL
+#define MQTT_BACKOFF_MAX_MS 60000UL
+#define MQTT_METRICS_INTERVAL_MS 60000UL
+#define MQTT_STATE_CHECK_MS 1000UL
+#define MQTT_SUBTOPIC_LEN 32
+#define MQTT_PAYLOAD_LEN 320
+
+struct MqttMessage {
+  char topic[MQTT_SUBTOPIC_LEN]; // below the base topic
+  char payload[MQTT_PAYLOAD_LEN];
+  bool retained;
+};
+
+// Copy of the broker settings for the task; written by the loop under mqttMux.
+struct MqttSettings {
+  bool enabled = false;
+  char host[CFG_HOST_LEN] = "";
+  uint16_t port = 1883;
+  char user[CFG_NAME_LEN * 2] = "";
+  char password[CFG_SECRET_LEN] = "";
+  char topic[CFG_TOPIC_LEN] = "";
+  uint32_t version = 0;
+};
+
+
+static QueueHandle_t mqttOutQueue = nullptr;
+static QueueHandle_t mqttInQueue = nullptr;
+static portMUX_TYPE mqttMux = portMUX_INITIALIZER_UNLOCKED;
+static MqttSettings mqttShared;
+uint32_t mqttGeneration = UINT32_MAX;
+
+// Loop side: never blocks. A full queue loses its oldest message.
+void mqttEnqueue(const char *topic, const char *payload, bool retained) {
+  if (!mqttOutQueue || !configState.mqttEnabled) return;
+  MqttMessage msg;
+  strlcpy(msg.topic, topic, sizeof(msg.topic));
+  strlcpy(msg.payload, payload, sizeof(msg.payload));
+  msg.retained = retained;
+  if (xQueueSend(mqttOutQueue, &msg, 0) != pdTRUE) {
+    MqttMessage oldest;
+    xQueueReceive(mqttOutQueue, &oldest, 0);
+    mqttStats.dropped++;
+    xQueueSend(mqttOutQueue, &msg, 0);
+  }
+}
+
+void mqttTask(void *) {
+  static WiFiClient net;
+  static PubSubClient mqtt(net);
+  static MqttSettings settings; // task-local copy, PubSubClient keeps pointers into it
+  static MqttMessage msg;
+  char fullTopic[CFG_TOPIC_LEN + MQTT_SUBTOPIC_LEN + 1];
+  char clientId[24];
+  snprintf(clientId, sizeof(clientId), "agentur-led-%06llx", (unsigned long long)((ESP.getEfuseMac() >> 24) & 0xffffff));
+  unsigned long nextAttemptMs = 0;
+  uint32_t backoffMs = MQTT_BACKOFF_MIN_MS;
+
+  mqtt.setBufferSize(CFG_TOPIC_LEN + MQTT_SUBTOPIC_LEN + MQTT_PAYLOAD_LEN + 16);
+  mqtt.setKeepAlive(30);
+  mqtt.setSocketTimeout(5);
+  mqtt.setCallback([](char *topic, uint8_t *payload, unsigned int length) {
+    // Only <base>/cmd/... is subscribed; hand "cmd/..." over to the loop.
+    size_t baseLen = strlen(settings.topic);
+    MqttMessage in;
+    strlcpy(in.topic, topic + min(strlen(topic), baseLen + 1), sizeof(in.topic));
+    size_t n = min((size_t)length, sizeof(in.payload) - 1);
+    memcpy(in.payload, payload, n);
+    in.payload[n] = '\0';
+    in.retained = false;
+    if (xQueueSend(mqttInQueue, &in, 0) != pdTRUE) mqttStats.commandsDropped++;
   });
-  wm.setConfigPortalTimeout(0); // no auto-timeout; stay in portal until connected
-  bool connected = wm.autoConnect("Agentur-für-Felix");
-  if (!connected) {
-    portalActive = true;
-    Serial.println("Config portal active, non-blocking mode");
+
+  for (;;) {
+    if (settings.version != mqttShared.version) {
+      taskENTER_CRITICAL(&mqttMux);
+      settings = mqttShared;
+      taskEXIT_CRITICAL(&mqttMux);
+      if (mqtt.connected()) mqtt.disconnect();
+      mqttStats.connected = false;
+      nextAttemptMs = 0;
+      backoffMs = MQTT_BACKOFF_MIN_MS;
+    }
+    if (!settings.enabled || settings.host[0] == '\0' || !WiFi.isConnected()) {
+      if (mqtt.connected()) mqtt.disconnect();
+      mqttStats.connected = false;
+      vTaskDelay(pdMS_TO_TICKS(500));
+      continue;
+    }
+
+    if (!mqtt.connected()) {
+      mqttStats.connected = false;
+      if ((long)(millis() - nextAttemptMs) < 0) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+        continue;
+      }
+      mqtt.setServer(settings.host, settings.port);
+      snprintf(fullTopic, sizeof(fullTopic), "%s/availability", settings.topic);
+      bool ok = mqtt.connect(clientId, settings.user[0] ? settings.user : nullptr,
+                             settings.password[0] ? settings.password : nullptr, fullTopic, 1, true, "offline");
+      if (!ok) {
+        mqttStats.failures++;
+        // Exponential backoff with +-25% jitter so a fleet does not reconnect in lockstep.
+        uint32_t jitter = esp_random() % (backoffMs / 2 + 1);
+        mqttStats.backoffMs = backoffMs - backoffMs / 4 + jitter;
+        nextAttemptMs = millis() + mqttStats.backoffMs;
+        backoffMs = min(backoffMs * 2, (uint32_t)MQTT_BACKOFF_MAX_MS);
+        Serial.printf("[MQTT] connect to %s:%u failed (%d), retry in %u ms\n", settings.host, settings.port,
+                      mqtt.state(), (unsigned)mqttStats.backoffMs);
+        continue;
+      }
+      backoffMs = MQTT_BACKOFF_MIN_MS;
+      mqttStats.backoffMs = 0;
+      mqttStats.connects++;
+      mqtt.publish(fullTopic, "online", true);
+      snprintf(fullTopic, sizeof(fullTopic), "%s/cmd/#", settings.topic);
+      mqtt.subscribe(fullTopic);
+      mqttStats.connected = true;
+      mqttStats.needFullPublish = true;
+      Serial.printf("[MQTT] connected to %s:%u as %s\n", settings.host, settings.port, clientId);
+    }
+
+    mqtt.loop();
+    while (xQueueReceive(mqttOutQueue, &msg, 0) == pdTRUE) {
+      snprintf(fullTopic, sizeof(fullTopic), "%s/%s", settings.topic, msg.topic);
+      if (mqtt.publish(fullTopic, msg.payload, msg.retained)) mqttStats.published++;
+    }
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+}
+
+void beginMqtt() {
+  mqttOutQueue = xQueueCreate(MQTT_OUT_QUEUE, sizeof(MqttMessage));
+  mqttInQueue = xQueueCreate(MQTT_IN_QUEUE, sizeof(MqttMessage));
+  // Core 0, next to the network stack; the Arduino loop runs on core 1.
+  xTaskCreatePinnedToCore(mqttTask, "mqtt", 6144, nullptr, 1, nullptr, 0);
+}
+
+// Same path as PATCH /api/config.
+bool applyConfigPatch(JsonVariantConst patch, String &errOut) {
+  uint32_t changed = 0;
+  if (!applyConfigDoc(patch, true, changed, errOut)) return false;
+  saveConfig(changed);
+  return true;
+}
+
+void publishMqttResult(const char *cmd, bool ok, const String &err) {
+  char payload[MQTT_PAYLOAD_LEN];
+  snprintf(payload, sizeof(payload), "{\"cmd\":\"%s\",\"ok\":%s,\"error\":\"%s\"}", cmd, ok ? "true" : "false", err.c_str());
+  mqttEnqueue("result", payload, false);
+}
+
+void applyMqttCommand(const MqttMessage &in) {
+  mqttStats.commands++;
+  powerWake();
+  String err;
+  bool ok = false;
+  const char *cmd = in.topic;
+  if (strncmp(cmd, "cmd/", 4) != 0) return;
+  cmd += 4;
+
+  DynamicJsonDocument patch(512);
+  if (strcmp(cmd, "mode") == 0 || strcmp(cmd, "effect") == 0) {
+    patch[cmd] = in.payload;
+    ok = applyConfigPatch(patch, err);
+  } else if (strcmp(cmd, "brightness") == 0) {
+    patch["brightness"] = constrain(atoi(in.payload), 0, 255);
+    ok = applyConfigPatch(patch, err);
+  } else if (strcmp(cmd, "config") == 0) {
+    if (deserializeJson(patch, in.payload) || !patch.is<JsonObject>()) err = "JSON parse error";
+    else ok = applyConfigPatch(patch, err);
+  } else if (strcmp(cmd, "appointment/add") == 0) {
+    String time = in.payload;
+    String color;
+    if (!deserializeJson(patch, in.payload) && patch.is<JsonObject>()) {
+      time = patch["time"] | "";
+      color = patch["color"] | "";
+    }
+    ok = addAppointment(time, color);
+    if (!ok) err = "invalid time or full";
+  } else if (strcmp(cmd, "appointment/remove") == 0) {
+    ok = deleteAppointment(atoi(in.payload));
+    if (!ok) err = "invalid index";
   } else {
-    portalActive = false;
-    Serial.print("Connected: ");
-    Serial.println(WiFi.localIP());
-    configTzTime(configState.tz.c_str(), "pool.ntp.org");
-    lastNtpSync = millis();
-    tzInitialized = true;
+    err = "unknown command";
   }
+  publishMqttResult(cmd, ok, err);
 }
 
+void publishMqttMetrics() {
+  char payload[MQTT_PAYLOAD_LEN];
+  snprintf(payload, sizeof(payload),
+           "{\"uptimeS\":%lu,\"heapFree\":%u,\"heapMin\":%u,\"loopP99Us\":%u,\"showP99Us\":%u,"
+           "\"powerMa\":%u,\"espAvgMa\":%u,\"timeSource\":\"%s\",\"driftPpm\":%.1f,\"realtime\":%s}",
+           millis() / 1000UL, (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMinFreeHeap(),
+           (unsigned)histPercentileUs(latencyHist[M_LOOP], 99), (unsigned)histPercentileUs(latencyHist[M_LED_SHOW], 99),
+           (unsigned)powerState.drawMa, (unsigned)averageEspMa(), TIME_SOURCE_NAMES[timeStats.source],
+           timeStats.driftPpm, realtime.source != RT_NONE ? "true" : "false");
+  mqttEnqueue("status/metrics", payload, true);
+}
+
+// Publishes retained state when it changes (or everything after a reconnect).
+void publishMqttState(bool force) {
+  static int lastOpen = -1;
+  static int lastNotify = -1;
+  static time_t lastNext = -1;
+  static String lastMode;
+  char buf[24];
+  time_t nowLocal = time(nullptr);
+  AppointmentHit next = nextAnyAppointment(nowLocal);
+  int open = isOpenNow(nowLocal) ? 1 : 0;
+  int notify = (next.when > 0) && (difftime(next.when, nowLocal) <= configState.notifyMinutesBefore * 60) ? 1 : 0;
+  String mode = realtime.source != RT_NONE ? String("realtime") : activeMode();
+
+  if (force || open != lastOpen) mqttEnqueue("status/open", open ? "1" : "0", true);
+  if (force || notify != lastNotify) mqttEnqueue("status/notify", notify ? "1" : "0", true);
+  if (force || next.when != lastNext) {
+    snprintf(buf, sizeof(buf), "%ld", (long)next.when);
+    mqttEnqueue("status/next_appointment", buf, true);
+  }
+  if (force || mode != lastMode) mqttEnqueue("status/mode", mode.c_str(), true);
+  if (force) {
+    mqttEnqueue("status/version", FW_VERSION, true);
+    publishMqttMetrics();
+  }
+  lastOpen = open;
+  lastNotify = notify;
+  lastNext = next.when;
+  lastMode = mode;
+}
+
+void serviceMqtt() {
+  if (!mqttOutQueue) return;
+  if (mqttGeneration != areaGeneration[CFG_AREA_MQTT]) {
+    taskENTER_CRITICAL(&mqttMux);
+    mqttShared.enabled = configState.mqttEnabled;
+    strlcpy(mqttShared.host, configState.mqttHost.c_str(), sizeof(mqttShared.host));
+    mqttShared.port = configState.mqttPort;
+    strlcpy(mqttShared.user, configState.mqttUser.c_str(), sizeof(mqttShared.user));
+    strlcpy(mqttShared.password, configState.mqttPassword.c_str(), sizeof(mqttShared.password));
+    strlcpy(mqttShared.topic, configState.mqttTopic.c_str(), sizeof(mqttShared.topic));
+    mqttShared.version++;
+    taskEXIT_CRITICAL(&mqttMux);
+    mqttGeneration = areaGeneration[CFG_AREA_MQTT];
+  }
+
+  MqttMessage in;
+  while (xQueueReceive(mqttInQueue, &in, 0) == pdTRUE) applyMqttCommand(in);
+
+  if (!mqttStats.connected) return;
+  static unsigned long lastCheckMs = 0;
+  static unsigned long lastMetricsMs = 0;
+  unsigned long nowMs = millis();
+  bool full = mqttStats.needFullPublish;
+  if (full) {
+    mqttStats.needFullPublish = false;
+    lastMetricsMs = nowMs;
+  }
+  if (full || nowMs - lastCheckMs >= MQTT_STATE_CHECK_MS) {
+    lastCheckMs = nowMs;
+    publishMqttState(full);
+  }
+  if (nowMs - lastMetricsMs >= MQTT_METRICS_INTERVAL_MS) {
+    lastMetricsMs = nowMs;
+    publishMqttMetrics();
+  }
+}
+
+// --------- Benchmarks (env esp32-wroom32-bench) ---------
+#ifdef LEDSIGN_BENCH
+#define BENCH_LED_COUNT 1000
+#define BENCH_ROUNDS 200
+
+// Benches that load or apply configs work on configState; they keep a copy
+// here and put it back afterwards. Nothing is saved.
+static DeviceConfig benchConfigBackup;
+
+void benchPowerEstimator() {
+  static CRGB frame[BENCH_LED_COUNT];
+  for (int i = 0; i < BENCH_LED_COUNT; ++i) frame[i] = CHSV(i * 3, 255, 255);
+  uint32_t sink = 0;
+  unsigned long startUs = micros();
+  for (int r = 0; r < BENCH_ROUNDS; ++r) {
+    sink += estimateMilliamps(sumFrameChannels(frame, BENCH_LED_COUNT), BENCH_LED_COUNT, configState.brightness);
+  }
+  unsigned long elapsed = micros() - startUs;
+  Serial.printf("[BENCH] power estimate %d LEDs: %.2f us/frame (%u mA)\n",
+                BENCH_LED_COUNT, (float)elapsed / BENCH_ROUNDS, (unsigned)(sink / BENCH_ROUNDS));
+}
+
+void benchCrossfade() {
+  static CRGB from[BENCH_LED_COUNT];
+  static CRGB to[BENCH_LED_COUNT];
+  static CRGB out[BENCH_LED_COUNT];
+  for (int i = 0; i < BENCH_LED_COUNT; ++i) {
+    from[i] = CHSV(i, 255, 255);
+    to[i] = CHSV(128 + i, 200, 180);
+  }
+  unsigned long startUs = micros();
+  for (int r = 0; r < BENCH_ROUNDS; ++r) {
+    fract8 amount = (fract8)r;
+    for (int i = 0; i < BENCH_LED_COUNT; ++i) out[i] = blend(from[i], to[i], amount);
+  }
+  unsigned long elapsed = micros() - startUs;
+  Serial.printf("[BENCH] crossfade %d LEDs: %.2f us/frame (%u)\n",
+                BENCH_LED_COUNT, (float)elapsed / BENCH_ROUNDS, (unsigned)out[BENCH_LED_COUNT - 1].r);
+}
+
+// Config persistence, JSON vs. binary snapshot, on the real LittleFS. The
+// snapshot written is the live config, restored before the JSON loads can
+// leave their mark on it.
+void benchConfigPersistence() {
+  const int rounds = 20; // flash writes are slow, keep boot time reasonable
+  benchConfigBackup = configState;
+  unsigned long startUs = micros();
+  size_t jsonBytes = 0;
+  for (int r = 0; r < rounds; ++r) {
+    String json = buildConfigJson();
+    File f = LittleFS.open("/bench.json", "w");
+    if (!f) break;
+    jsonBytes = f.print(json);
+    f.close();
+  }
+  unsigned long jsonSaveUs = micros() - startUs;
+  startUs = micros();
+  for (int r = 0; r < rounds; ++r) loadConfigJson("/bench.json");
+  unsigned long jsonLoadUs = micros() - startUs;
+  LittleFS.remove("/bench.json");
+  configState = benchConfigBackup;
+
+  startUs = micros();
+  for (int r = 0; r < rounds; ++r) writeConfigSnapshot();
+  unsigned long binSaveUs = micros() - startUs;
+  startUs = micros();
+  for (int r = 0; r < rounds; ++r) readConfigSnapshot();
+  unsigned long binLoadUs = micros() - startUs;
+  configState = benchConfigBackup;
+
+  Serial.printf("[BENCH] config JSON   %u B: save %.0f us, load %.0f us\n",
+                (unsigned)jsonBytes, (float)jsonSaveUs / rounds, (float)jsonLoadUs / rounds);
+  Serial.printf("[BENCH] config binary %u B: save %.0f us, load %.0f us\n",
+                (unsigned)sizeof(ConfigSnapshotFile), (float)binSaveUs / rounds, (float)binLoadUs / rounds);
+}
+
+// Power manager over a simulated day in clock mode: a frame change every
+// minute plus its crossfade, a status request every 1-10 minutes. Runs the
+// real decision and loop-period functions on a virtual clock; the level
+// switch is measured on the device, radio wake-up uses the beacon model.
+void benchPowerScheduler() {
+  applyPowerLevel(POWER_IDLE);
+  applyPowerLevel(POWER_ACTIVE);
+  uint32_t switchMs = (powerMgr.lastSwitchUs + 999) / 1000;
+
+  static uint16_t latencyHist[1024]; // 1 ms buckets
+  memset(latencyHist, 0, sizeof(latencyHist));
+  uint32_t seed = 12345;
+  auto rnd = [&seed]() {
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+  };
+  const unsigned long dayMs = 24UL * 3600UL * 1000UL;
+  unsigned long t = 0, lastFrame = 0, lastActivity = 0;
+  unsigned long issuedAt = 60000, arrivesAt = ULONG_MAX;
+  PowerLevel level = POWER_ACTIVE;
+  uint64_t chargeMaMs = 0, idleMs = 0;
+  uint32_t requests = 0;
+  while (t < dayMs) {
+    if (t % 60000UL < configState.transitionMs + LOOP_FRAME_MS) lastFrame = t;
+    if (arrivesAt == ULONG_MAX && t >= issuedAt) {
+      // The AP buffers the request until the station's next wake-up.
+      uint32_t radioMs = level == POWER_ACTIVE ? WIFI_WAKE_ACTIVE_MS : WIFI_WAKE_IDLE_MS;
+      arrivesAt = issuedAt + rnd() % (radioMs + 1);
+    }
+    if (t >= arrivesAt) {
+      uint32_t latencyMs = (t - issuedAt) + (level == POWER_IDLE ? switchMs : 0);
+      latencyHist[min(latencyMs, (uint32_t)1023)]++;
+      requests++;
+      lastActivity = t;
+      issuedAt = t + 60000UL + rnd() % 540000UL;
+      arrivesAt = ULONG_MAX;
+    }
+    level = powerTargetLevel(t, lastFrame, lastActivity, false);
+    unsigned long dt = powerLoopDelayMs(level, t % 60000UL);
+    chargeMaMs += (uint64_t)powerLevelMa(level) * dt;
+    if (level == POWER_IDLE) idleMs += dt;
+    t += dt;
+  }
+
+  auto percentile = [&](uint32_t pct) {
+    uint32_t target = (requests * pct + 99) / 100, seen = 0;
+    for (int i = 0; i < 1024; ++i) {
+      seen += latencyHist[i];
+      if (seen >= target) return i;
+    }
+    return 1023;
+  };
+  Serial.printf("[BENCH] power sim 24h clock: avg %.1f mA (always active %d mA), idle %.0f%%\n",
+                (double)chargeMaMs / dayMs, ESP_MA_ACTIVE, 100.0 * idleMs / dayMs);
+  Serial.printf("[BENCH] power sim wake-to-response: p50 %d ms, p99 %d ms (%u requests, level switch %u us)\n",
+                percentile(50), percentile(99), (unsigned)requests, (unsigned)powerMgr.lastSwitchUs);
+}
+
+// Realtime ingest over lwIP loopback: E1.31 frames sent to ourselves, then
+// drained and shown by the normal path. Measures receive + show per frame.
+void benchRealtimeIngest() {
+  openRealtimeSockets();
+  int tx = socket(AF_INET, SOCK_DGRAM, 0);
+  if (tx < 0 || realtime.e131Fd < 0) {
+    Serial.println("[BENCH] realtime: no sockets");
+    if (tx >= 0) close(tx);
+    closeRealtimeSockets();
+    return;
+  }
+  struct sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(E131_PORT);
+  to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  static uint8_t pkt[E131_HEADER_LEN + DEFAULT_LED_COUNT * 3];
+  const uint16_t slots = DEFAULT_LED_COUNT * 3;
+  memset(pkt, 0, sizeof(pkt));
+  memcpy(pkt + 4, "ASC-E1.17", 9);
+  pkt[21] = 0x04;
+  pkt[43] = 0x02;
+  pkt[113] = configState.realtimeUniverse >> 8;
+  pkt[114] = configState.realtimeUniverse & 0xff;
+  pkt[117] = 0x02;
+  pkt[123] = (slots + 1) >> 8;
+  pkt[124] = (slots + 1) & 0xff;
+
+  const int rounds = 500;
+  unsigned long busyUs = 0;
+  for (int r = 0; r < rounds; ++r) {
+    pkt[111] = (uint8_t)r;
+    for (int i = 0; i < slots; ++i) pkt[E131_HEADER_LEN + i] = (uint8_t)(r + i);
+    sendto(tx, pkt, sizeof(pkt), 0, (struct sockaddr *)&to, sizeof(to));
+    waitForNextPass(5);
+    realtime.lastShowUs -= 100000; // no refresh pacing in the bench
+    unsigned long startUs = micros();
+    receiveE131();
+    if (realtime.framePending) showRealtimeFrame();
+    busyUs += micros() - startUs;
+  }
+  Serial.printf("[BENCH] realtime E1.31 loopback: %.1f us/frame receive+show, %u/%d shown, %u out of order\n",
+                (float)busyUs / rounds, (unsigned)realtime.shown, rounds, (unsigned)realtime.outOfOrder);
+  close(tx);
+  closeRealtimeSockets();
+  exitRealtime();
+  realtime = RealtimeState();
+}
+
+// Config edits: full POST document vs. a one-field PATCH, parse + apply only.
+// The write a changed field costs is the binary save in benchConfigPersistence.
+void benchConfigPatch() {
+  const int rounds = 50;
+  benchConfigBackup = configState;
+  String full = buildConfigJson();
+  String err;
+  uint32_t changed = 0;
+  uint32_t fullChanged = 0;
+  unsigned long startUs = micros();
+  for (int r = 0; r < rounds; ++r) {
+    applyConfigJson(full, false, changed, err);
+    fullChanged |= changed;
+  }
+  unsigned long fullUs = micros() - startUs;
+
+  uint8_t brightness = configState.brightness;
+  String patches[2] = {String("{\"brightness\":") + (brightness ^ 1) + "}", String("{\"brightness\":") + brightness + "}"};
+  startUs = micros();
+  for (int r = 0; r < rounds; ++r) applyConfigJson(patches[r & 1], true, changed, err);
+  unsigned long patchUs = micros() - startUs;
+  configState = benchConfigBackup;
+
+  Serial.printf("[BENCH] config apply: full POST %u B %.0f us (changed 0x%02x), PATCH 1 field %.0f us\n",
+                (unsigned)full.length(), (float)fullUs / rounds, (unsigned)fullChanged, (float)patchUs / rounds);
+}
+
+// Request bodies: a full config POST through the old arg("plain") path (heap
+// String plus heap document) and through the arena, then a 200-entry
+// appointment array parsed element by element. The heap numbers should not
+// move on the arena path. The applied config is put back afterwards.
+void benchFillBody(const String &body) {
+  bodyArena.reset();
+  for (size_t at = 0; at < body.length(); at += HTTP_RAW_BUFLEN) {
+    bodyArena.append((const uint8_t *)body.c_str() + at, min((size_t)HTTP_RAW_BUFLEN, body.length() - at));
+  }
+}
+
+void benchRequestBodies() {
+  const int rounds = 200;
+  benchConfigBackup = configState;
+  String full = buildConfigJson();
+  String err;
+  uint32_t changed = 0;
+  uint32_t freeBefore = ESP.getFreeHeap(), blockBefore = ESP.getMaxAllocHeap();
+  unsigned long startUs = micros();
+  for (int r = 0; r < rounds; ++r) {
+    String body = full; // what arg("plain") hands out
+    applyConfigJson(body, false, changed, err);
+  }
+  unsigned long heapUs = micros() - startUs;
+  uint32_t freeHeapPath = ESP.getFreeHeap(), blockHeapPath = ESP.getMaxAllocHeap();
+
+  bodyArena.highWater = 0;
+  startUs = micros();
+  for (int r = 0; r < rounds; ++r) {
+    benchFillBody(full);
+    applyConfigBody(server, false, changed);
+  }
+  unsigned long arenaUs = micros() - startUs;
+  uint32_t freeArenaPath = ESP.getFreeHeap(), blockArenaPath = ESP.getMaxAllocHeap();
+  size_t configHighWater = bodyArena.highWater;
+  configState = benchConfigBackup;
+
+  String list = "[";
+  for (int i = 0; i < 200; ++i) {
+    list += i ? ",{\"when\":" : "{\"when\":";
+    list += String(1767225600UL + i * 3600UL) + ",\"color\":\"ff8800\"}";
+  }
+  list += "]";
+  benchFillBody(list);
+  bodyArena.highWater = 0;
+  int staged = 0;
+  beginAppointmentBatch(false);
+  startUs = micros();
+  forEachBodyElement(server, [&](JsonVariantConst v) { staged += stageAppointmentJson(v, 0xffffff); });
+  unsigned long listUs = micros() - startUs;
+  discardAppointmentBatch();
+  bodyArena.reset();
+
+  Serial.printf("[BENCH] body config %u B: heap path %.0f us (free %d B, largest block %d B), arena %.0f us (free %d B, largest block %d B, arena %u B)\n",
+                (unsigned)full.length(), (float)heapUs / rounds, (int)(freeHeapPath - freeBefore), (int)(blockHeapPath - blockBefore),
+                (float)arenaUs / rounds, (int)(freeArenaPath - freeHeapPath), (int)(blockArenaPath - blockHeapPath), (unsigned)configHighWater);
+  Serial.printf("[BENCH] body array %u B, %d entries staged in %lu us, arena %u B\n", (unsigned)list.length(), staged, listUs,
+                (unsigned)bodyArena.highWater);
+}
+
+// Scene scheduler: compile time for a full rule set, cost of the per-frame
+// check, and a week swept second by second against a direct evaluation of the
+// rules (windows by day and length, open-ended scenes by their latest start).
+void benchSceneScheduler() {
+  static SceneRule savedScenes[MAX_SCENES];
+  uint8_t savedCount = configState.sceneCount;
+  for (int i = 0; i < MAX_SCENES; ++i) savedScenes[i] = configState.scenes[i];
+
+  const char *rules[MAX_SCENES] = {
+      "{\"name\":\"Nacht\",\"start\":\"22:00\",\"end\":\"06:00\",\"mode\":\"clock\",\"brightness\":10}",
+      "{\"name\":\"Freitag\",\"days\":[5],\"start\":\"16:00\",\"effect\":\"xmas\"}",
+      "{\"name\":\"Montag\",\"days\":[1],\"start\":\"07:30\",\"mode\":\"status\"}",
+      "{\"name\":\"Mittag\",\"days\":[1,2,3,4,5],\"start\":\"12:00\",\"end\":\"12:45\",\"brightness\":200}",
+      "{\"name\":\"Sekunde\",\"days\":[3],\"start\":\"09:15:30\",\"end\":\"09:15:45\",\"effect\":\"radar\"}",
+      "{\"name\":\"WE\",\"days\":[0,6],\"start\":\"10:00\",\"end\":\"18:00\",\"effect\":\"rainbow\",\"mode\":\"effect\"}",
+      "{\"name\":\"Abend\",\"days\":[0,1,2,3,4,5,6],\"start\":\"19:00\",\"end\":\"23:00\",\"brightness\":40}",
+      "{\"name\":\"Sa\",\"days\":[6],\"start\":\"08:00\",\"mode\":\"clock\"}",
+  };
+  String err;
+  configState.sceneCount = 0;
+  for (int i = 0; i < MAX_SCENES; ++i) {
+    DynamicJsonDocument doc(256);
+    deserializeJson(doc, rules[i]);
+    if (parseSceneJson(doc, configState.scenes[i], err)) configState.sceneCount++;
+  }
+  compileScenes();
+  unsigned long compileUs = sceneState.compileUs;
+
+  // Reference: which rule supplies the given setting at second t of the week.
+  auto reference = [](uint32_t t, uint8_t bit) {
+    int winner = SCENE_RULE_NONE;
+    for (int r = 0; r < configState.sceneCount; ++r) {
+      const SceneRule &rule = configState.scenes[r];
+      if (!(rule.sets & bit)) continue;
+      bool active = false;
+      if (rule.endSec >= 0) {
+        uint32_t len = ((uint32_t)rule.endSec + SCENE_DAY_SEC - rule.startSec) % SCENE_DAY_SEC;
+        if (len == 0) len = SCENE_DAY_SEC;
+        for (int d = 0; d < 7 && !active; ++d) {
+          uint32_t start = d * SCENE_DAY_SEC + rule.startSec;
+          active = (rule.days & (1 << d)) && (t + SCENE_WEEK_SEC - start) % SCENE_WEEK_SEC < len;
+        }
+      } else {
+        // Most recent open-ended start at or before t (cyclic) must be this rule's.
+        uint32_t best = SCENE_WEEK_SEC;
+        int bestRule = -1;
+        for (int o = 0; o < configState.sceneCount; ++o) {
+          const SceneRule &other = configState.scenes[o];
+          if (other.endSec >= 0) continue;
+          for (int d = 0; d < 7; ++d) {
+            if (!(other.days & (1 << d))) continue;
+            uint32_t ago = (t + SCENE_WEEK_SEC - d * SCENE_DAY_SEC - other.startSec) % SCENE_WEEK_SEC;
+            if (ago < best || (ago == best && o > bestRule)) {
+              best = ago;
+              bestRule = o;
+            }
+          }
+        }
+        active = bestRule == r;
+      }
+      if (active) winner = r;
+    }
+    return winner;
+  };
+  uint32_t mismatches = 0;
+  for (uint32_t t = 0; t < SCENE_WEEK_SEC; ++t) {
+    const SceneSegment &seg = sceneState.segments[findSceneSegment(t)];
+    if (seg.mode != reference(t, SCENE_SET_MODE) || seg.brightness != reference(t, SCENE_SET_BRIGHTNESS) ||
+        seg.effect != reference(t, SCENE_SET_EFFECT)) {
+      mismatches++;
+    }
+  }
+
+  // One simulated day at 30 fps through the runtime path.
+  const time_t base = 1735689600; // 2025-01-01
+  sceneState.generation = areaGeneration[CFG_AREA_SCENES];
+  sceneState.current = -1;
+  sceneState.validUntil = 0;
+  uint32_t resolvesBefore = sceneState.resolves, transitionsBefore = sceneState.transitions;
+  const uint32_t frames = 86400UL * 30;
+  unsigned long startUs = micros();
+  for (uint32_t f = 0; f < frames; ++f) serviceScenes(base + f / 30);
+  unsigned long loopUs = micros() - startUs;
+
+  Serial.printf("[BENCH] scenes: %u rules -> %u segments, compile %lu us, week sweep %u mismatches\n",
+                (unsigned)configState.sceneCount, (unsigned)sceneState.count, compileUs, (unsigned)mismatches);
+  Serial.printf("[BENCH] scenes per frame: %.0f ns (%u frames, %u lookups, %u transitions in 24 h)\n",
+                loopUs * 1000.0 / frames, (unsigned)frames, (unsigned)(sceneState.resolves - resolvesBefore),
+                (unsigned)(sceneState.transitions - transitionsBefore));
+
+  configState.sceneCount = savedCount;
+  for (int i = 0; i < MAX_SCENES; ++i) configState.scenes[i] = savedScenes[i];
+  sceneState.generation = UINT32_MAX;
+  sceneState.current = -1;
+  sceneState.transitions = 0;
+  sceneState.resolves = 0;
+}
+
+// Appointment store: bulk commit (sort + one write) of 500 entries, the
+// per-frame next-appointment lookup, a ranged query and an ICS import. The
+// real store is restored afterwards.
+void benchAppointmentStore() {
+  StoredAppointment *saved = (StoredAppointment *)malloc(sizeof(apptStore.entries));
+  if (!saved) return;
+  memcpy(saved, apptStore.entries, sizeof(apptStore.entries));
+  uint16_t savedCount = apptStore.count;
+
+  const time_t base = 1735689600; // 2025-01-01
+  const int n = 500;
+  beginAppointmentBatch(true);
+  uint32_t seed = 12345;
+  for (int i = 0; i < n; ++i) {
+    seed = seed * 1103515245 + 12345;
+    stageAppointment(base + (seed >> 8) % (365L * 86400L), 0x00ffff);
+  }
+  unsigned long startUs = micros();
+  commitAppointments(base);
+  unsigned long commitUs = micros() - startUs;
+
+  const uint32_t frames = 86400UL * 30;
+  uint32_t hits = 0;
+  startUs = micros();
+  for (uint32_t f = 0; f < frames; ++f) {
+    if (nextManualAppointment(base + 86400L * 30 + f / 30).when) hits++;
+  }
+  unsigned long lookupUs = micros() - startUs;
+
+  startUs = micros();
+  int first = lowerBoundAppointment(base + 86400L * 100);
+  int end = lowerBoundAppointment(base + 86400L * 107);
+  unsigned long rangeUs = micros() - startUs;
+
+  String ics = "BEGIN:VCALENDAR\r\n";
+  for (int i = 0; i < 100; ++i) {
+    char ev[96];
+    snprintf(ev, sizeof(ev), "BEGIN:VEVENT\r\nDTSTART:202503%02dT%02d0000Z\r\nSUMMARY:x\r\nEND:VEVENT\r\n", 1 + i % 28, i % 24);
+    ics += ev;
+  }
+  ics += "END:VCALENDAR\r\n";
+  beginAppointmentBatch(true);
+  IcsImport imp;
+  imp.reset(0xff0000);
+  startUs = micros();
+  imp.feed((const uint8_t *)ics.c_str(), ics.length());
+  imp.finish();
+  unsigned long icsUs = micros() - startUs;
+  apptStore.staged = 0;
+
+  Serial.printf("[BENCH] appointments: commit %d entries %lu us (%u kept), next lookup %.0f ns/frame (%u hits)\n",
+                n, commitUs, (unsigned)apptStore.count, lookupUs * 1000.0 / frames, (unsigned)hits);
+  Serial.printf("[BENCH] appointments: 7-day range %d entries in %lu us, ICS %u B / %u events parsed in %lu us\n",
+                end - first, rangeUs, (unsigned)ics.length(), (unsigned)imp.staged, icsUs);
+
+  memcpy(apptStore.entries, saved, sizeof(apptStore.entries));
+  apptStore.count = savedCount;
+  apptStore.staged = 0;
+  apptStore.cursorTime = -1;
+  writeAppointmentStore();
+  free(saved);
+}
+
+// iCal time zones: event-time conversion through the transition tables
+// against the setenv/tzset/mktime round trip. Correctness is covered by the
+// host tests in test/test_tz.
+void benchIcalTimezones() {
+  const int rounds = 2000;
+  const char *const values[4] = {"20250301T100000", "20250715T083000", "20251026T023000", "20260105T180000"};
+  tzZoneFor("America/New_York");
+  unsigned long startUs = micros();
+  time_t sink = 0;
+  for (int r = 0; r < rounds; ++r) sink += icalDateTimeToEpoch(values[r & 3], "America/New_York");
+  unsigned long tableUs = micros() - startUs;
+
+  startUs = micros();
+  for (int r = 0; r < rounds; ++r) {
+    int y, mo, d, h, mi, sec;
+    sscanf(values[r & 3], "%4d%2d%2dT%2d%2d%2d", &y, &mo, &d, &h, &mi, &sec);
+    setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", 1);
+    tzset();
+    struct tm t = {};
+    t.tm_year = y - 1900;
+    t.tm_mon = mo - 1;
+    t.tm_mday = d;
+    t.tm_hour = h;
+    t.tm_min = mi;
+    t.tm_sec = sec;
+    t.tm_isdst = -1;
+    sink += mktime(&t);
+    setenv("TZ", configState.tz.c_str(), 1);
+    tzset();
+  }
+  unsigned long mktimeUs = micros() - startUs;
+
+  Serial.printf("[BENCH] ical tz: table %.2f us/event vs setenv+mktime %.2f us (%u transitions, sink %ld)\n",
+                (float)tableUs / rounds, (float)mktimeUs / rounds, (unsigned)tzZoneFor("America/New_York").count,
+                (long)(sink & 1));
+}
+
+void runBenchmarks() {
+  benchPowerEstimator();
+  benchCrossfade();
+  benchConfigPersistence();
+  benchConfigPatch();
+  benchRequestBodies();
+  benchPowerScheduler();
+  benchRealtimeIngest();
+  benchSceneScheduler();
+  benchAppointmentStore();
+  benchIcalTimezones();
+}
+#endif
+
 void setup() {
   Serial.begin(115200);
-  delay(200);
+
+  // Light the strip before anything slow happens.
+  FastLED.addLeds<NEOPIXEL, LED_PIN>(leds, DEFAULT_LED_COUNT);
+  bootHoldFrame = showCachedBootFrame();
+  beginStallWatch();
 
   if (!LittleFS.begin(true)) {
     Serial.println("LittleFS mount failed");
   }
 
   loadConfig();
+  loadAppointmentStore();
+  loadLayout();
+  bootTimings.configMs = millis();
+  beginTimekeeping();
+  beginPowerManager();
+  beginMqtt();
 
-  FastLED.addLeds<NEOPIXEL, LED_PIN>(leds, DEFAULT_LED_COUNT);
   FastLED.setBrightness(configState.brightness);
+  setupLayers();
+  if (!bootHoldFrame) handleLeds(time(nullptr));
+
+#ifdef LEDSIGN_BENCH
+  runBenchmarks();
+#endif
 
   setupWifiAndTime();
-  setupServer();
 }
 
-void loop() {
-  if (wmPortal && portalActive) {
-    wmPortal->process();
-    if (WiFi.isConnected()) {
-      wmPortal->stopConfigPortal();
-      wmPortal->setEnableConfigPortal(false);
-      WiFi.softAPdisconnect(true);
-      WiFi.mode(WIFI_STA);
-      portalActive = false;
-      Serial.print("Connected: ");
-      Serial.println(WiFi.localIP());
-      configTzTime(configState.tz.c_str(), "pool.ntp.org");
-      lastNtpSync = millis();
-      tzInitialized = true;
-    }
-  }
+// One pass of housekeeping and rendering; loop() adds the frame pacing.
+void loopWork() {
+  serviceNetwork();
+  serviceTimekeeping();
 
-  server.handleClient();
+  {
+    MetricScope scope(M_HANDLE_CLIENT);
+    server.handleClient();
+  }
 
   // In AP/portal mode default to the configured effect for a simple visual indicator
   if (portalActive) {
-    FastLED.setBrightness(configState.brightness);
     showEffect();
-    delay(30);
+    pumpFrameStreams();
     return;
   }
 
   time_t nowLocal = time(nullptr);
+  if (bootHoldFrame) {
+    // Keep the cached frame rather than drawing a 1970 clock.
+    bool canRender = activeMode() == "effect" || clockIsSet(nowLocal) || millis() > BOOT_HOLD_MAX_MS;
+    if (canRender) bootHoldFrame = false;
+  }
   if (tzInitialized && millis() - lastNtpSync > 6UL * 60UL * 60UL * 1000UL) {
     configTzTime(configState.tz.c_str(), "pool.ntp.org");
     lastNtpSync = millis();
   }
   fetchIcalIfNeeded();
-  handleLeds(nowLocal);
-  delay(30);
+  serviceScenes(nowLocal);
+  serviceAppointments(nowLocal);
+  serviceMqtt();
+  serviceSync();
+  bool realtimeActive = serviceRealtime();
+  if (!bootHoldFrame && !realtimeActive) {
+    MetricScope scope(M_HANDLE_LEDS);
+    handleLeds(nowLocal);
+  }
+  pumpFrameStreams();
+}
+
+// Anything a user is waiting on keeps the power manager at full speed.
+bool powerBusy() {
+  if (portalActive || wifiConnecting || frameCapture.running || realtime.source != RT_NONE) return true;
+  for (int c = 0; c < MAX_STREAM_CLIENTS; ++c) {
+    if (streamClients[c].active) return true;
+  }
+  return false;
+}
+
+void loop() {
+  stallPassBegin();
+  {
+    MetricScope scope(M_LOOP);
+    loopWork();
+  }
+  runtimeStats.loopIterations++;
+  sampleHeap();
+  servicePower(powerBusy());
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  stallPassEnd(tv.tv_sec);
+  waitForNextPass(powerLoopDelayMs(powerMgr.level, (tv.tv_sec % 60) * 1000UL + tv.tv_usec / 1000));
 }
@@ -0,0 +1,175 @@
+// Host tests for ical_tz.h: pio test -e native
+#include <unity.h>
+#include <stdlib.h>
+#include "ical_tz.h"
+
+// Device zone and year as the firmware would report them.
+static const char *deviceRule = "EST5EDT,M3.2.0,M11.1.0";
+static uint32_t deviceGeneration = 1;
+
+const char *tzDeviceRule(uint32_t &generation) {
+  generation = deviceGeneration;
+  return deviceRule;
+}
+
+int tzCurrentYear() {
+  return 2025;
+}
+
+void setUp() {
+  tzCache = TzCache();
+  deviceRule = "EST5EDT,M3.2.0,M11.1.0";
+  deviceGeneration++;
+}
+
+void tearDown() {}
+
+void test_posix_rule_parsing() {
+  TzRule r;
+  TEST_ASSERT_TRUE(parsePosixTz("CET-1CEST,M3.5.0,M10.5.0/3", r));
+  TEST_ASSERT_EQUAL_INT(3600, r.stdOffset);
+  TEST_ASSERT_EQUAL_INT(7200, r.dstOffset);
+  TEST_ASSERT_TRUE(r.hasDst);
+  TEST_ASSERT_EQUAL_INT(3, r.start.month);
+  TEST_ASSERT_EQUAL_INT(5, r.start.week);
+  TEST_ASSERT_EQUAL_INT(7200, r.start.time);
+  TEST_ASSERT_EQUAL_INT(10800, r.end.time);
+  TEST_ASSERT_TRUE(parsePosixTz("<+03>-3", r));
+  TEST_ASSERT_EQUAL_INT(10800, r.stdOffset);
+  TEST_ASSERT_FALSE(r.hasDst);
+  TEST_ASSERT_FALSE(parsePosixTz("", r));
+  TEST_ASSERT_FALSE(parsePosixTz("CET-1CEST,M3.5.0", r));
+  TEST_ASSERT_FALSE(parsePosixTz("CET-1CEST,J60,J300", r)); // only M-form rules
+}
+
+// 02:30 on the last Sunday of March does not exist in Berlin; it is read with
+// the winter offset, i.e. as 03:30 CEST.
+void test_spring_gap() {
+  TEST_ASSERT_EQUAL_INT64(1743296340, icalDateTimeToEpoch("20250330T015900", "Europe/Berlin")); // 00:59 UTC
+  TEST_ASSERT_EQUAL_INT64(1743298200, icalDateTimeToEpoch("20250330T023000", "Europe/Berlin")); // 01:30 UTC
+  TEST_ASSERT_EQUAL_INT64(1743298200, icalDateTimeToEpoch("20250330T033000", "Europe/Berlin"));
+}
+
+// 02:30 on the last Sunday of October happens twice; the first one (CEST) wins.
+void test_autumn_overlap() {
+  TEST_ASSERT_EQUAL_INT64(1761438600, icalDateTimeToEpoch("20251026T023000", "Europe/Berlin")); // 00:30 UTC
+  TEST_ASSERT_EQUAL_INT64(1761445800, icalDateTimeToEpoch("20251026T033000", "Europe/Berlin")); // 02:30 UTC
+}
+
+// Sydney: DST from the first Sunday of October to the first Sunday of April,
+// so January is summer time and the table starts in DST.
+void test_southern_hemisphere() {
+  TEST_ASSERT_EQUAL_INT64(1736038800, icalDateTimeToEpoch("20250105T120000", "Australia/Sydney")); // +11
+  TEST_ASSERT_EQUAL_INT64(1751680800, icalDateTimeToEpoch("20250705T120000", "Australia/Sydney")); // +10
+  TEST_ASSERT_EQUAL_INT64(1743867000, icalDateTimeToEpoch("20250406T023000", "Australia/Sydney")); // overlap, AEDT
+  TEST_ASSERT_EQUAL_INT64(1743874200, icalDateTimeToEpoch("20250406T033000", "Australia/Sydney"));
+}
+
+void test_half_hour_offset() {
+  TEST_ASSERT_EQUAL_INT64(1748759400, icalDateTimeToEpoch("20250601T120000", "Asia/Kolkata")); // 06:30 UTC
+  TzRule r;
+  TEST_ASSERT_TRUE(parsePosixTz("<+0545>-5:45", r));
+  TEST_ASSERT_EQUAL_INT(5 * 3600 + 45 * 60, r.stdOffset);
+}
+
+// A feed's own VTIMEZONE defines a zone the name table does not know.
+void test_vtimezone_block() {
+  static const char *const lines[] = {
+      "TZID:Custom Zone",
+      "BEGIN:DAYLIGHT",
+      "TZOFFSETFROM:+0100",
+      "TZOFFSETTO:+0200",
+      "DTSTART:19810329T020000",
+      "RRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=-1SU",
+      "END:DAYLIGHT",
+      "BEGIN:STANDARD",
+      "TZOFFSETFROM:+0200",
+      "TZOFFSETTO:+0100",
+      "DTSTART:19961027T030000",
+      "RRULE:FREQ=YEARLY;BYMONTH=10;BYDAY=-1SU",
+      "END:STANDARD",
+  };
+  VtimezoneReader vtz;
+  vtz.reset();
+  for (const char *line : lines) {
+    if (strcmp(line, "BEGIN:DAYLIGHT") == 0 || strcmp(line, "BEGIN:STANDARD") == 0) {
+      vtz.beginComponent(strcmp(line, "BEGIN:DAYLIGHT") == 0);
+    } else if (strncmp(line, "END:", 4) == 0) {
+      vtz.endComponent();
+    } else {
+      vtz.handleProperty(line);
+    }
+  }
+  TEST_ASSERT_TRUE(vtz.finish());
+  TEST_ASSERT_EQUAL_UINT32(1, tzCache.vtimezones);
+  TEST_ASSERT_EQUAL_INT64(1751378400, icalDateTimeToEpoch("20250701T160000", "Custom Zone")); // 14:00 UTC
+  TEST_ASSERT_EQUAL_INT64(1735743600, icalDateTimeToEpoch("20250101T160000", "Custom Zone")); // 15:00 UTC
+  TEST_ASSERT_EQUAL_UINT32(0, tzCache.unknownTzids);
+}
+
+void test_unknown_tzid_uses_device_zone() {
+  TEST_ASSERT_EQUAL_INT64(1751356800, icalDateTimeToEpoch("20250701T040000", "Mars/Olympus")); // EDT
+  TEST_ASSERT_EQUAL_UINT32(1, tzCache.unknownTzids);
+  TEST_ASSERT_EQUAL_INT64(1736931600, icalDateTimeToEpoch("20250115T040000")); // floating, EST
+  deviceRule = "CET-1CEST,M3.5.0,M10.5.0/3";
+  deviceGeneration++;
+  TEST_ASSERT_EQUAL_INT64(1736910000, icalDateTimeToEpoch("20250115T040000")); // 03:00 UTC
+}
+
+void test_utc_time() {
+  TEST_ASSERT_EQUAL_INT64(1735725600, icalDateTimeToEpoch("20250101T100000Z"));
+  TEST_ASSERT_EQUAL_INT64(1735725600, icalDateTimeToEpoch("20250101T100000Z", "Europe/Berlin")); // Z wins
+}
+
+void test_malformed_values() {
+  TEST_ASSERT_EQUAL_INT64(0, icalDateTimeToEpoch("2025"));
+  TEST_ASSERT_EQUAL_INT64(0, icalDateTimeToEpoch("20251301T000000"));
+  TEST_ASSERT_EQUAL_INT64(0, icalDateTimeToEpoch("20250101T250000"));
+  TEST_ASSERT_EQUAL_INT64(1735707600, icalDateTimeToEpoch("20250101")); // date only: device midnight
+}
+
+// Every hour of the table range against the C library's reading of the same
+// POSIX rule. Hours next to a change are skipped: there mktime() may pick
+// either side of the gap or overlap.
+void test_matches_mktime() {
+  static const char *const rules[] = {
+      "CET-1CEST,M3.5.0,M10.5.0/3", "GMT0BST,M3.5.0/1,M10.5.0",     "EST5EDT,M3.2.0,M11.1.0",
+      "PST8PDT,M3.2.0,M11.1.0",     "AEST-10AEDT,M10.1.0,M4.1.0/3", "EET-2EEST,M3.5.0/3,M10.5.0/4",
+      "IST-5:30",                   "<+03>-3",
+  };
+  for (const char *rule : rules) {
+    setenv("TZ", rule, 1);
+    tzset();
+    TzZone zone;
+    TEST_ASSERT_TRUE(parsePosixTz(rule, zone.rule));
+    buildTzTable(zone, 2025);
+    int64_t from = (int64_t)daysFromCivil(2024, 1, 1) * 86400;
+    int64_t to = (int64_t)daysFromCivil(2027, 12, 31) * 86400;
+    for (int64_t wall = from; wall < to; wall += 3600) {
+      int64_t mine = tzLocalToUtc(zone, wall);
+      if (tzOffsetAt(zone, mine) + mine != wall || tzOffsetAt(zone, mine - 3600) != tzOffsetAt(zone, mine + 3600)) continue;
+      time_t tWall = (time_t)wall;
+      struct tm t;
+      gmtime_r(&tWall, &t);
+      t.tm_isdst = -1;
+      TEST_ASSERT_EQUAL_INT64_MESSAGE((int64_t)mktime(&t), mine, rule);
+    }
+  }
+  unsetenv("TZ");
+  tzset();
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_posix_rule_parsing);
+  RUN_TEST(test_spring_gap);
+  RUN_TEST(test_autumn_overlap);
+  RUN_TEST(test_southern_hemisphere);
+  RUN_TEST(test_half_hour_offset);
+  RUN_TEST(test_vtimezone_block);
+  RUN_TEST(test_unknown_tzid_uses_device_zone);
+  RUN_TEST(test_utc_time);
+  RUN_TEST(test_malformed_values);
+  RUN_TEST(test_matches_mktime);
+  return UNITY_END();
+}
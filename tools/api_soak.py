@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Soak test for the API request-body path: hammers a sign with bodies of all
+sizes and shapes and watches the heap in /api/metrics.
+
+Every request leaves the stored state as it was: PATCH /api/config with the
+current brightness (nothing changes, nothing is written), appointment arrays
+with only invalid entries or cut off, malformed JSON, DELETE of an index that
+does not exist and bodies over the 16 KB cap (expected answer 413). The minimum free
+heap and the smallest largest block should stay flat once the first round
+has touched every path.
+
+  tools/api_soak.py 192.168.1.50 --minutes 60
+  tools/api_soak.py 192.168.1.50 --minutes 600 --sample 60 --tolerance 512
+
+Exits 1 if a response code was unexpected or the heap minimum kept falling
+after the warm-up. Only the Python standard library is used.
+"""
+import argparse
+import http.client
+import json
+import random
+import re
+import sys
+import time
+
+BODY_MAX = 16 * 1024
+METRICS = {
+    "free": "ledsign_heap_free_bytes",
+    "min_free": "ledsign_heap_min_free_bytes",
+    "min_block": "ledsign_heap_min_largest_free_block_bytes",
+    "arena": "ledsign_request_body_arena_high_water_bytes",
+}
+
+
+def request(host, method, path, body=None, timeout=10):
+    conn = http.client.HTTPConnection(host, timeout=timeout)
+    try:
+        headers = {"Content-Type": "application/json"} if body is not None else {}
+        conn.request(method, path, body=body, headers=headers)
+        resp = conn.getresponse()
+        return resp.status, resp.read()
+    finally:
+        conn.close()
+
+
+def metrics(host):
+    status, text = request(host, "GET", "/api/metrics")
+    if status != 200:
+        raise RuntimeError(f"/api/metrics answered {status}")
+    out = {}
+    for key, name in METRICS.items():
+        m = re.search(rf"^{name} (\d+)$", text.decode(), re.M)
+        out[key] = int(m.group(1)) if m else -1
+    return out
+
+
+def invalid_appointments(n):
+    return json.dumps([{"time": "not a time", "color": "ff0000"} for _ in range(n)])
+
+
+def cases(brightness):
+    """(method, path, body, expected status) tuples, one round."""
+    patch = json.dumps({"brightness": brightness})
+    padded = patch[:-1] + " " * (BODY_MAX - len(patch) - 1) + "}"  # whitespace costs no document memory
+    return [
+        ("PATCH", "/api/config", patch, 200),
+        ("PATCH", "/api/config", padded, 200),                # just under the cap
+        ("PATCH", "/api/config", "{\"brightness\":", 400),    # truncated
+        ("PATCH", "/api/config", "x" * (BODY_MAX + 1), 413),
+        ("PATCH", "/api/config", "x" * (BODY_MAX * 8), 413),
+        ("POST", "/api/appointments", invalid_appointments(1), 400),
+        ("POST", "/api/appointments", invalid_appointments(300), 400),
+        ("POST", "/api/appointments", "[{\"time\":1},", 400),
+        ("POST", "/api/appointments/import", invalid_appointments(200)[:-1], 400),  # unterminated
+        ("POST", "/api/appointments/import", "[" + "1," * (BODY_MAX // 2) + "1]", 413),
+        ("DELETE", "/api/appointments", json.dumps({"index": 100000}), 400),
+        ("POST", "/api/frames/capture", "[[[[[[[[", 400),
+    ]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("host", help="IP or host name of the sign")
+    ap.add_argument("--minutes", type=float, default=30, help="run time")
+    ap.add_argument("--sample", type=float, default=30, help="seconds between heap samples")
+    ap.add_argument("--tolerance", type=int, default=256, help="allowed heap minimum drop after warm-up, bytes")
+    args = ap.parse_args()
+
+    status, body = request(args.host, "GET", "/api/config")
+    if status != 200:
+        print(f"/api/config answered {status}", file=sys.stderr)
+        return 1
+    brightness = json.loads(body)["brightness"]
+    round_cases = cases(brightness)
+
+    # Warm-up: one round over every path, then take the baseline.
+    for method, path, data, _ in round_cases:
+        request(args.host, method, path, data)
+    base = metrics(args.host)
+    print(f"baseline: {base}")
+
+    end = time.monotonic() + args.minutes * 60
+    next_sample = time.monotonic() + args.sample
+    sent = unexpected = 0
+    last = base
+    while time.monotonic() < end:
+        method, path, data, expected = random.choice(round_cases)
+        try:
+            status, _ = request(args.host, method, path, data)
+        except (OSError, http.client.HTTPException) as e:
+            print(f"{method} {path}: {e}", file=sys.stderr)
+            unexpected += 1
+            continue
+        sent += 1
+        if status != expected:
+            unexpected += 1
+            print(f"{method} {path} ({len(data)} B): {status}, expected {expected}", file=sys.stderr)
+        if time.monotonic() >= next_sample:
+            next_sample += args.sample
+            last = metrics(args.host)
+            print(f"{sent:7d} requests  free {last['free']:6d}  min free {last['min_free']:6d} ({last['min_free'] - base['min_free']:+d})  "
+                  f"min block {last['min_block']:6d} ({last['min_block'] - base['min_block']:+d})  arena {last['arena']}")
+
+    last = metrics(args.host)
+    drop_free = base["min_free"] - last["min_free"]
+    drop_block = base["min_block"] - last["min_block"]
+    print(f"{sent} requests, {unexpected} unexpected; min free heap {drop_free:+d} B lower, "
+          f"min largest block {drop_block:+d} B lower than after warm-up")
+    if unexpected or drop_free > args.tolerance or drop_block > args.tolerance:
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
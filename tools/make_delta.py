@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+"""Build a delta firmware patch (LSD1) from the previous release's image.
+
+The device applies it in one pass: it reads the running app partition,
+writes the new image to the other OTA slot and checks SHA-256 of both ends
+(see performDeltaUpdate() in src/main.cpp). Format, little endian:
+
+  "LSD1" | u32 old size | old SHA-256 | u32 new size | new SHA-256
+  zlib stream of records:
+    0x01 COPY   varint len, zigzag varint (old pos - old cursor), len diff bytes
+                new[i] = old[pos + i] + diff[i] (mod 256); old cursor = pos + len
+    0x02 INSERT varint len, len literal bytes
+    0x00 END
+
+COPY regions are approximate matches (bsdiff style): code that only moved
+differs in address operands, so the diff bytes are mostly zero and deflate
+squeezes them down.
+
+  tools/make_delta.py prev/firmware.bin firmware.bin firmware.delta --verify
+  tools/make_delta.py --apply prev/firmware.bin firmware.delta out.bin
+
+Only the Python standard library is used.
+"""
+import argparse
+import hashlib
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"LSD1"
+OP_END, OP_COPY, OP_INSERT = 0, 1, 2
+KEY = 16          # bytes hashed per index entry
+STEP = 4          # old image is indexed every STEP bytes
+WINDOW = 32       # approximate match ends when fewer than half of the last WINDOW bytes match
+MIN_MATCH = KEY + STEP
+
+
+def varint(n):
+    out = bytearray()
+    while True:
+        b = n & 0x7F
+        n >>= 7
+        if n:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def zigzag(n):
+    return (n << 1) if n >= 0 else ((-n << 1) - 1)
+
+
+def read_varint(buf, pos):
+    shift = n = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        n |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return n, pos
+        shift += 7
+
+
+def build_index(old):
+    index = {}
+    for j in range(0, len(old) - KEY + 1, STEP):
+        index.setdefault(old[j:j + KEY], j)
+    return index
+
+
+def exact_run(old, new, j, i):
+    """Length of the exact match of new[i:] against old[j:]."""
+    n = 0
+    limit = min(len(old) - j, len(new) - i)
+    chunk = 256
+    while n + chunk <= limit and old[j + n:j + n + chunk] == new[i + n:i + n + chunk]:
+        n += chunk
+    while n < limit and old[j + n] == new[i + n]:
+        n += 1
+    return n
+
+
+def approx_run(old, new, j, i):
+    """Approximate match length from (j, i): extend while at least half of the
+    last WINDOW bytes match and cut back to the last matching byte."""
+    limit = min(len(old) - j, len(new) - i)
+    n = exact_run(old, new, j, i)
+    best = n
+    recent = [1] * WINDOW
+    hits = WINDOW
+    k = 0
+    while n < limit:
+        if old[j + n] == new[i + n]:
+            run = exact_run(old, new, j + n, i + n)
+            n += run
+            best = n
+            recent = [1] * WINDOW
+            hits = WINDOW
+            continue
+        hits -= recent[k]
+        recent[k] = 0
+        k = (k + 1) % WINDOW
+        n += 1
+        if hits < WINDOW // 2:
+            break
+    return best
+
+
+def diff(old, new):
+    """Returns (ops, stats); ops are ("copy", pos, len) and ("insert", start, len) over new."""
+    index = build_index(old)
+    ops = []
+    i = 0
+    pending = 0        # start of bytes not yet covered
+    shift = None       # old - new of the last copy, tried first
+    while i < len(new):
+        best_j, best_len = -1, 0
+        if shift is not None and 0 <= i + shift < len(old) and old[i + shift] == new[i]:
+            best_j, best_len = i + shift, approx_run(old, new, i + shift, i)
+        if best_len < MIN_MATCH:
+            j = index.get(bytes(new[i:i + KEY]))
+            if j is not None:
+                run = approx_run(old, new, j, i)
+                if run > best_len:
+                    best_j, best_len = j, run
+        if best_len < MIN_MATCH:
+            i += 1
+            continue
+        # Grow backwards into the uncovered bytes.
+        back = 0
+        while i - back > pending and best_j - back > 0 and old[best_j - back - 1] == new[i - back - 1]:
+            back += 1
+        i -= back
+        best_j -= back
+        best_len += back
+        if i > pending:
+            ops.append(("insert", pending, i - pending))
+        ops.append(("copy", best_j, best_len))
+        shift = best_j - i
+        i += best_len
+        pending = i
+    if pending < len(new):
+        ops.append(("insert", pending, len(new) - pending))
+    return ops
+
+
+def encode(old, new, ops):
+    body = bytearray()
+    cursor = 0
+    i = 0
+    for kind, a, n in ops:
+        if kind == "copy":
+            body.append(OP_COPY)
+            body += varint(n) + varint(zigzag(a - cursor))
+            body += bytes((new[i + k] - old[a + k]) & 0xFF for k in range(n))
+            cursor = a + n
+        else:
+            body.append(OP_INSERT)
+            body += varint(n) + new[a:a + n]
+        i += n
+    body.append(OP_END)
+    header = (MAGIC + struct.pack("<I", len(old)) + hashlib.sha256(old).digest()
+              + struct.pack("<I", len(new)) + hashlib.sha256(new).digest())
+    return header + zlib.compress(bytes(body), 9)
+
+
+def apply(old, patch):
+    if patch[:4] != MAGIC:
+        raise ValueError("not an LSD1 patch")
+    old_size = struct.unpack_from("<I", patch, 4)[0]
+    old_sha = patch[8:40]
+    new_size = struct.unpack_from("<I", patch, 40)[0]
+    new_sha = patch[44:76]
+    if len(old) < old_size or hashlib.sha256(old[:old_size]).digest() != old_sha:
+        raise ValueError("patch was built against a different image")
+    body = zlib.decompress(patch[76:])
+    out = bytearray()
+    pos = cursor = 0
+    while True:
+        op = body[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        n, pos = read_varint(body, pos)
+        if op == OP_COPY:
+            z, pos = read_varint(body, pos)
+            cursor += (z >> 1) ^ -(z & 1)
+            out += bytes((old[cursor + k] + body[pos + k]) & 0xFF for k in range(n))
+            cursor += n
+        elif op == OP_INSERT:
+            out += body[pos:pos + n]
+        else:
+            raise ValueError(f"bad record 0x{op:02x}")
+        pos += n
+    if len(out) != new_size or hashlib.sha256(out).digest() != new_sha:
+        raise ValueError("result does not match the target hash")
+    return bytes(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("old")
+    ap.add_argument("new", help="new image, or the patch with --apply")
+    ap.add_argument("out")
+    ap.add_argument("--apply", action="store_true", help="apply a patch instead of building one")
+    ap.add_argument("--verify", action="store_true", help="apply the built patch and compare")
+    args = ap.parse_args()
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+    if args.apply:
+        with open(args.out, "wb") as f:
+            f.write(apply(old, new))
+        return 0
+
+    start = time.perf_counter()
+    ops = diff(old, new)
+    patch = encode(old, new, ops)
+    elapsed = time.perf_counter() - start
+    with open(args.out, "wb") as f:
+        f.write(patch)
+    copied = sum(n for kind, _, n in ops if kind == "copy")
+    print(f"{args.out}: {len(patch)} B for {len(new)} B image ({len(new) / max(1, len(patch)):.1f}x smaller, "
+          f"full image deflated {len(zlib.compress(new, 9))} B), {copied * 100 // max(1, len(new))}% copied, "
+          f"{sum(1 for op in ops if op[0] == 'copy')} copies, {elapsed:.1f} s")
+    if args.verify and apply(old, patch) != new:
+        print("verify failed", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Send E1.31 (sACN) or DDP test frames to the sign.
+
+Stand-in for a lighting controller: streams a moving rainbow at a fixed rate
+and prints the sender's own timing. With --status the device's realtime
+counters (/api/status -> realtime) are fetched afterwards, so received,
+shown and dropped frames and the device-side jitter can be compared with
+what was sent.
+
+  tools/rt_sender.py 192.168.1.50 --fps 44 --seconds 10 --status
+  tools/rt_sender.py 192.168.1.50 --proto ddp --fps 120 --reorder 0.05
+  tools/rt_sender.py --proto e131 --multicast --universe 1   # 239.255.0.1
+
+Only the Python standard library is used.
+"""
+import argparse
+import colorsys
+import json
+import random
+import socket
+import struct
+import time
+import urllib.request
+import uuid
+
+E131_PORT = 5568
+DDP_PORT = 4048
+DDP_FLAG_VER1 = 0x40
+DDP_FLAG_PUSH = 0x01
+DDP_ID_DISPLAY = 1
+DDP_TYPE_RGB8 = 0x0B
+
+
+def e131_packet(seq, universe, data, cid, source="rt_sender", priority=100, terminate=False):
+    """E1.31 data packet (ANSI E1.31-2018, 126 byte header + DMX slots)."""
+    slots = len(data)
+    options = 0x40 if terminate else 0x00
+    dmp = struct.pack("!HBBHHH", 0x7000 | (10 + slots + 1), 0x02, 0xA1, 0, 1, slots + 1) + b"\x00" + data
+    framing = (struct.pack("!HI", 0x7000 | (77 + len(dmp)), 0x00000002)
+               + source.encode()[:63].ljust(64, b"\x00")
+               + struct.pack("!BHBBH", priority, 0, seq & 0xFF, options, universe)
+               + dmp)
+    root = struct.pack("!HI", 0x7000 | (22 + len(framing)), 0x00000004) + cid + framing
+    return struct.pack("!HH", 0x0010, 0x0000) + b"ASC-E1.17\x00\x00\x00" + root
+
+
+def ddp_packets(seq, data, max_payload=1440):
+    """DDP v1 packets for one frame; PUSH on the last one. Sequence 1..15."""
+    packets = []
+    for offset in range(0, len(data), max_payload):
+        chunk = data[offset:offset + max_payload]
+        last = offset + len(chunk) >= len(data)
+        flags = DDP_FLAG_VER1 | (DDP_FLAG_PUSH if last else 0)
+        packets.append(struct.pack("!BBBBIH", flags, seq, DDP_TYPE_RGB8, DDP_ID_DISPLAY, offset, len(chunk)) + chunk)
+        seq = seq % 15 + 1
+    return packets, seq
+
+
+def rainbow(leds, phase):
+    out = bytearray()
+    for i in range(leds):
+        r, g, b = colorsys.hsv_to_rgb((phase + i / leds) % 1.0, 1.0, 1.0)
+        out += bytes((int(r * 255), int(g * 255), int(b * 255)))
+    return bytes(out)
+
+
+def fetch_status(host):
+    with urllib.request.urlopen(f"http://{host}/api/status", timeout=3) as resp:
+        return json.load(resp).get("realtime", {})
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("host", nargs="?", default="127.0.0.1")
+    ap.add_argument("--proto", choices=("e131", "ddp"), default="e131")
+    ap.add_argument("--fps", type=float, default=44.0)
+    ap.add_argument("--seconds", type=float, default=10.0)
+    ap.add_argument("--leds", type=int, default=12)
+    ap.add_argument("--universe", type=int, default=1)
+    ap.add_argument("--multicast", action="store_true", help="E1.31 to 239.255.<universe> instead of the host")
+    ap.add_argument("--reorder", type=float, default=0.0, help="probability of swapping two packets")
+    ap.add_argument("--terminate", action="store_true", help="send an E1.31 stream-terminated packet at the end")
+    ap.add_argument("--status", action="store_true", help="print the device's realtime counters afterwards")
+    args = ap.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    if args.proto == "e131":
+        target = (f"239.255.{args.universe >> 8}.{args.universe & 0xFF}" if args.multicast else args.host, E131_PORT)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 4)
+    else:
+        target = (args.host, DDP_PORT)
+
+    before = fetch_status(args.host) if args.status else {}
+    cid = uuid.uuid4().bytes
+    period = 1.0 / args.fps
+    frames = int(args.seconds * args.fps)
+    seq = 1 if args.proto == "ddp" else 0
+    held = None
+    late = []
+    start = time.perf_counter()
+    for n in range(frames):
+        due = start + n * period
+        while True:
+            now = time.perf_counter()
+            if now >= due:
+                break
+            time.sleep(min(due - now, 0.002) if due - now > 0.003 else 0)
+        late.append((time.perf_counter() - due) * 1e6)
+        data = rainbow(args.leds, n / args.fps / 4.0)
+        if args.proto == "e131":
+            packets = [e131_packet(seq, args.universe, data, cid)]
+            seq = (seq + 1) & 0xFF
+        else:
+            packets, seq = ddp_packets(seq, data)
+        for pkt in packets:
+            if held is None and random.random() < args.reorder:
+                held = pkt  # goes out after the next packet, i.e. late
+                continue
+            sock.sendto(pkt, target)
+            if held is not None:
+                sock.sendto(held, target)
+                held = None
+    if args.terminate and args.proto == "e131":
+        sock.sendto(e131_packet(seq, args.universe, rainbow(args.leds, 0), cid, terminate=True), target)
+
+    elapsed = time.perf_counter() - start
+    late.sort()
+    rate = (frames - 1) / elapsed if frames > 1 else 0.0
+    print(f"sent {frames} frames in {elapsed:.2f} s = {rate:.1f} fps to {target[0]}:{target[1]} ({args.proto})")
+    print(f"sender lateness p50 {late[len(late) // 2]:.0f} us, p99 {late[int(len(late) * 0.99)]:.0f} us")
+
+    if args.status:
+        time.sleep(0.5)
+        after = fetch_status(args.host)
+        delta = {k: after.get(k, 0) - before.get(k, 0)
+                 for k in ("frames", "shown", "dropped", "outOfOrder", "lost", "invalid")}
+        print("device:", ", ".join(f"{k} {v}" for k, v in delta.items()),
+              f"| fps {after.get('fps', 0):.1f}, jitter {after.get('jitterUs', 0)} us")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Fetch the stall samples of a sign (GET /api/stalls) and print them, with
+function names and source lines if the firmware ELF of the running build is
+given.
+
+Each sample was taken by the stall watch in src/main.cpp while a loop pass
+ran over 250 ms or a render scope over 60 ms: the phase is the innermost
+instrumented scope (as in /api/metrics), the backtrace the loop task's call
+sites, innermost first. Samples from an earlier boot were taken before a
+soft reset (watchdog, panic, OTA); compare with "resetReason".
+
+  tools/stall_report.py 192.168.1.50
+  tools/stall_report.py 192.168.1.50 --elf .pio/build/esp32-wroom32/firmware.elf
+  tools/stall_report.py 192.168.1.50 --clear
+
+addr2line defaults to xtensa-esp32-elf-addr2line from PATH (PlatformIO ships
+it under ~/.platformio/packages/toolchain-xtensa-esp32/bin). Only the Python
+standard library is used.
+"""
+import argparse
+import json
+import subprocess
+import sys
+import time
+import urllib.request
+
+
+def symbolize(addr2line, elf, addrs):
+    """Returns {addr: "function at file:line"} for the given hex addresses."""
+    if not addrs:
+        return {}
+    out = subprocess.run([addr2line, "-pfiaC", "-e", elf] + addrs, capture_output=True, text=True, check=True).stdout
+    names = {}
+    current = None
+    for line in out.splitlines():
+        # "0x400d1234: func at file:line", inlined callers follow as " (inlined by) ..."
+        if line.startswith("0x") and ": " in line:
+            current, text = line.split(": ", 1)
+            current = f"0x{int(current, 16):08x}"
+            names[current] = text
+        elif current and line.strip():
+            names[current] += "\n" + " " * 14 + line.strip()
+    return names
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("host", help="IP or host name of the sign")
+    ap.add_argument("--elf", help="firmware.elf of the build running on the sign")
+    ap.add_argument("--addr2line", default="xtensa-esp32-elf-addr2line")
+    ap.add_argument("--clear", action="store_true", help="empty the ring after printing")
+    args = ap.parse_args()
+
+    with urllib.request.urlopen(f"http://{args.host}/api/stalls", timeout=10) as resp:
+        data = json.load(resp)
+    samples = data["samples"]
+    print(f"boot {data['boot']} (last reset: {data['resetReason']}), thresholds loop {data['loopMs']} ms / "
+          f"render {data['renderMs']} ms, {data['total']} samples recorded, {len(samples)} kept")
+
+    names = {}
+    if args.elf:
+        addrs = sorted({a for s in samples for a in s["backtrace"].split()})
+        names = symbolize(args.addr2line, args.elf, addrs)
+
+    for s in samples:
+        when = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(s["time"])) if s["time"] else "clock unset"
+        boot = "" if s["boot"] == data["boot"] else f"  [before reset, boot {s['boot']}]"
+        print(f"\n#{s['seq']} {s['kind']} {s['stalledMs']} ms in {s['phase']}  {when}, "
+              f"uptime {s['uptimeMs'] / 1000:.1f} s{boot}")
+        for addr in s["backtrace"].split():
+            print(f"  {addr}  {names.get(addr, '')}".rstrip())
+
+    if args.clear:
+        req = urllib.request.Request(f"http://{args.host}/api/stalls", method="DELETE")
+        urllib.request.urlopen(req, timeout=10).read()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
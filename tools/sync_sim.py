@@ -0,0 +1,317 @@
+#!/usr/bin/env python3
+"""Measure multi-sign effect sync with simulated signs.
+
+A leader sign sends a small beacon (its effect clock) to a multicast group
+every ~500 ms; followers phase-lock their effect clock to it (see "Effect
+sync" in src/main.cpp). This tool runs one leader and N followers with the
+same beacon format and the same integer PLL as the firmware and reports how
+far the followers' effect clocks are from the leader's.
+
+  tools/sync_sim.py --followers 4 --minutes 60            # virtual time, seconds to run
+  tools/sync_sim.py --followers 4 --dtim-ms 307 --loss 0.2
+  tools/sync_sim.py --udp --followers 3 --seconds 90      # real multicast on this host
+  tools/sync_sim.py --listen                              # print beacons of real signs
+
+Every simulated sign gets its own crystal error (--ppm) and boot offset.
+Virtual mode models the Wi-Fi path: a delay common to all receivers (AP
+multicast buffering until the next DTIM beacon, --dtim-ms), per-receiver
+jitter and loss. --udp runs the signs as threads on real sockets instead,
+each with a skewed clock, so the wire format and socket path are exercised.
+
+Only the Python standard library is used.
+"""
+import argparse
+import random
+import socket
+import struct
+import threading
+import time
+
+SYNC_GROUP_ADDR = "239.255.76.83"
+SYNC_PORT = 5570
+SYNC_MAGIC = 0x5953534C  # "LSSY"
+SYNC_VERSION = 1
+BEACON = struct.Struct("<IBBHIQI")  # magic, version, group, seq, leaderId, effectUs, effectKey
+
+# Keep these in step with the SYNC_* defines in src/main.cpp.
+SYNC_INTERVAL_MS = 500
+SYNC_INTERVAL_JITTER_MS = 100
+SYNC_WINDOW = 32
+SYNC_STEP_US = 50000
+SYNC_MAX_PPB = 500000
+SYNC_LOST_MS = 5000
+SYNC_LOCK_US = 2000
+
+
+def tdiv(a, b):
+    """C integer division (truncates towards zero)."""
+    q = abs(a) // abs(b)
+    return q if (a >= 0) == (b > 0) else -q
+
+
+class EffectClock:
+    """Mirror of EffectSync in src/main.cpp; all values in microseconds."""
+
+    def __init__(self):
+        self.has_anchor = False
+        self.anchor_local = 0
+        self.anchor_effect = 0
+        self.freq_ppb = 0
+        self.window_count = 0
+        self.window_best = 0
+        self.window_start = 0
+        self.last_beacon = 0
+        self.last_err = 0
+        self.locked = False
+        self.steps = 0
+        self.corrections = 0
+
+    def at(self, local):
+        if not self.has_anchor:
+            return local
+        d = local - self.anchor_local
+        return self.anchor_effect + d + tdiv(d * self.freq_ppb, 1000000000)
+
+    def rebase(self, local, effect):
+        self.anchor_local = local
+        self.anchor_effect = effect
+        self.window_start = local
+        self.window_count = 0
+
+    def on_beacon(self, local, leader):
+        self.last_beacon = local
+        if not self.has_anchor:
+            self.has_anchor = True
+            self.rebase(local, leader)
+            self.steps += 1
+            return
+        # Delay only ever makes a beacon look late, i.e. err too small: the
+        # largest error in a window is the least delayed sample.
+        err = leader - self.at(local)
+        self.window_best = err if self.window_count == 0 else max(self.window_best, err)
+        self.window_count += 1
+        if self.window_count < SYNC_WINDOW:
+            return
+        best = self.window_best
+        self.last_err = best
+        if abs(best) > SYNC_STEP_US:
+            self.rebase(local, self.at(local) + best)  # new leader or restart: jump, keep the frequency
+            self.steps += 1
+            self.locked = False
+            return
+        span = local - self.window_start
+        self.freq_ppb = max(-SYNC_MAX_PPB, min(SYNC_MAX_PPB, self.freq_ppb + tdiv(best * 7812500, span)))
+        self.rebase(local, self.at(local) + tdiv(best, 4))
+        self.locked = abs(best) < SYNC_LOCK_US
+        self.corrections += 1
+
+    def service(self, local):
+        if self.has_anchor and local - self.last_beacon > SYNC_LOST_MS * 1000:
+            self.locked = False  # free-run on the learned frequency
+
+
+class SimClock:
+    """Local microsecond clock of one sign: boot offset plus crystal error."""
+
+    def __init__(self, rng, ppm):
+        self.offset = rng.randrange(0, 600 * 1000000)
+        self.skew = rng.uniform(-ppm, ppm) * 1e-6
+
+    def local(self, true_us):
+        return int(self.offset + true_us * (1.0 + self.skew))
+
+
+def percentile(sorted_vals, p):
+    if not sorted_vals:
+        return 0
+    return sorted_vals[min(len(sorted_vals) - 1, int(len(sorted_vals) * p))]
+
+
+def report(errors, spreads, lock_s, clocks, followers):
+    errors.sort()
+    spreads.sort()
+    print(f"followers {len(followers)}, samples {len(errors)}")
+    for i, (f, c) in enumerate(zip(followers, clocks)):
+        lock = f"{lock_s[i]:.1f} s" if lock_s[i] is not None else "never"
+        print(f"  follower {i}: crystal {c.skew * 1e6:+.1f} ppm, learned {f.freq_ppb / 1000:+.1f} ppm, "
+              f"locked after {lock}, {f.steps} steps, {f.corrections} corrections")
+    print(f"leader - follower |error|: p50 {percentile(errors, 0.5) / 1000:.2f} ms, "
+          f"p99 {percentile(errors, 0.99) / 1000:.2f} ms, max {errors[-1] / 1000 if errors else 0:.2f} ms")
+    print(f"spread between followers: p50 {percentile(spreads, 0.5) / 1000:.2f} ms, "
+          f"p99 {percentile(spreads, 0.99) / 1000:.2f} ms, max {spreads[-1] / 1000 if spreads else 0:.2f} ms")
+
+
+def run_virtual(args):
+    rng = random.Random(args.seed)
+    leader_clock = SimClock(rng, args.ppm)
+    clocks = [SimClock(rng, args.ppm) for _ in range(args.followers)]
+    followers = [EffectClock() for _ in range(args.followers)]
+    lock_s = [None] * args.followers
+    end_us = int(args.minutes * 60e6)
+    warmup_us = int(args.warmup * 1e6)
+    errors, spreads = [], []
+    events = []  # (true arrival time, follower index, leader effect time)
+
+    next_beacon = 0
+    next_sample = warmup_us
+    t = 0
+    while t < end_us:
+        t = min(next_beacon, next_sample, *(e[0] for e in events)) if events else min(next_beacon, next_sample)
+        if t == next_beacon:
+            leader_us = leader_clock.local(t)
+            # Group-addressed frames wait at the AP for the next DTIM beacon,
+            # the same wait for every receiver.
+            common = args.base_ms * 1000
+            if args.dtim_ms > 0:
+                common += (args.dtim_ms * 1000) - (t + args.dtim_phase_us) % int(args.dtim_ms * 1000)
+            for i in range(args.followers):
+                if rng.random() < args.loss:
+                    continue
+                events.append((t + int(common + rng.expovariate(1.0 / (args.jitter_ms * 1000 + 1))), i, leader_us))
+            next_beacon = t + (SYNC_INTERVAL_MS + rng.randint(-SYNC_INTERVAL_JITTER_MS // 2, SYNC_INTERVAL_JITTER_MS // 2)) * 1000
+        if t == next_sample:
+            leader_us = leader_clock.local(t)
+            values = []
+            for i, f in enumerate(followers):
+                local = clocks[i].local(t)
+                f.service(local)
+                e = f.at(local) - leader_us
+                values.append(e)
+                errors.append(abs(e))
+            spreads.append(max(values) - min(values))
+            next_sample = t + args.sample_ms * 1000
+        due = [e for e in events if e[0] <= t]
+        if due:
+            events = [e for e in events if e[0] > t]
+            for arrival, i, leader_us in sorted(due):
+                f = followers[i]
+                f.on_beacon(clocks[i].local(arrival), leader_us)
+                if f.locked and lock_s[i] is None:
+                    lock_s[i] = arrival / 1e6
+    print(f"virtual run: {args.minutes:g} min, beacon every {SYNC_INTERVAL_MS} ms, crystals +-{args.ppm:g} ppm, "
+          f"DTIM wait up to {args.dtim_ms:g} ms, jitter {args.jitter_ms:g} ms, loss {args.loss * 100:.0f}%")
+    report(errors, spreads, lock_s, clocks, followers)
+
+
+def multicast_socket(group):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if hasattr(socket, "SO_REUSEPORT"):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.bind(("", SYNC_PORT))
+    mreq = struct.pack("4s4s", socket.inet_aton(group), socket.inet_aton("0.0.0.0"))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+    return sock
+
+
+def run_udp(args):
+    rng = random.Random(args.seed)
+    start = time.monotonic_ns() // 1000
+    true_us = lambda: time.monotonic_ns() // 1000 - start
+    leader_clock = SimClock(rng, args.ppm)
+    clocks = [SimClock(rng, args.ppm) for _ in range(args.followers)]
+    followers = [EffectClock() for _ in range(args.followers)]
+    lock_s = [None] * args.followers
+    lock = threading.Lock()
+    stop = threading.Event()
+
+    def leader():
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+        seq = 0
+        while not stop.is_set():
+            pkt = BEACON.pack(SYNC_MAGIC, SYNC_VERSION, args.group, seq & 0xFFFF, 0x51D, leader_clock.local(true_us()), 0)
+            sock.sendto(pkt, (SYNC_GROUP_ADDR, SYNC_PORT))
+            seq += 1
+            stop.wait((SYNC_INTERVAL_MS + rng.randint(-SYNC_INTERVAL_JITTER_MS // 2, SYNC_INTERVAL_JITTER_MS // 2)) / 1000)
+
+    def follower(i):
+        sock = multicast_socket(SYNC_GROUP_ADDR)
+        sock.settimeout(0.2)
+        while not stop.is_set():
+            try:
+                pkt = sock.recv(64)
+            except socket.timeout:
+                continue
+            arrival = true_us()
+            if len(pkt) < BEACON.size:
+                continue
+            magic, version, group, _, _, effect_us, _ = BEACON.unpack_from(pkt)
+            if magic != SYNC_MAGIC or version != SYNC_VERSION or group != args.group or random.random() < args.loss:
+                continue
+            with lock:
+                followers[i].on_beacon(clocks[i].local(arrival), effect_us)
+                if followers[i].locked and lock_s[i] is None:
+                    lock_s[i] = arrival / 1e6
+
+    threads = [threading.Thread(target=follower, args=(i,), daemon=True) for i in range(args.followers)]
+    threads.append(threading.Thread(target=leader, daemon=True))
+    for th in threads:
+        th.start()
+    errors, spreads = [], []
+    end = args.seconds * 1e6
+    while true_us() < end:
+        time.sleep(args.sample_ms / 1000)
+        t = true_us()
+        if t < args.warmup * 1e6:
+            continue
+        with lock:
+            values = [f.at(clocks[i].local(t)) - leader_clock.local(t) for i, f in enumerate(followers)]
+        errors += [abs(v) for v in values]
+        spreads.append(max(values) - min(values))
+    stop.set()
+    print(f"udp run on {SYNC_GROUP_ADDR}:{SYNC_PORT}: {args.seconds:g} s, crystals +-{args.ppm:g} ppm, loss {args.loss * 100:.0f}%")
+    report(errors, spreads, lock_s, clocks, followers)
+
+
+def run_listen(args):
+    sock = multicast_socket(SYNC_GROUP_ADDR)
+    last = {}
+    print(f"listening on {SYNC_GROUP_ADDR}:{SYNC_PORT}")
+    while True:
+        pkt, addr = sock.recvfrom(64)
+        now = time.monotonic_ns() // 1000
+        if len(pkt) < BEACON.size:
+            continue
+        magic, version, group, seq, leader_id, effect_us, key = BEACON.unpack_from(pkt)
+        if magic != SYNC_MAGIC:
+            continue
+        prev = last.get(leader_id)
+        rate = ""
+        if prev:
+            # Leader clock advance vs ours over the last beacon: its crystal error plus path jitter.
+            rate = f" interval {(now - prev[0]) / 1000:.0f} ms, leader-local {(effect_us - prev[1]) - (now - prev[0]):+d} us"
+        last[leader_id] = (now, effect_us)
+        print(f"{addr[0]} v{version} group {group} leader {leader_id:06x} seq {seq} effect {effect_us / 1e6:.3f} s "
+              f"key {key:08x}{rate}")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--followers", type=int, default=4)
+    ap.add_argument("--minutes", type=float, default=30.0, help="virtual run length")
+    ap.add_argument("--seconds", type=float, default=90.0, help="--udp run length")
+    ap.add_argument("--warmup", type=float, default=60.0, help="seconds before errors are sampled")
+    ap.add_argument("--sample-ms", type=int, default=100)
+    ap.add_argument("--ppm", type=float, default=20.0, help="crystal error range of each sign")
+    ap.add_argument("--base-ms", type=float, default=1.5, help="fixed path delay")
+    ap.add_argument("--jitter-ms", type=float, default=2.0, help="mean of the per-receiver exponential jitter")
+    ap.add_argument("--dtim-ms", type=float, default=102.4, help="AP multicast buffering period, 0 = none")
+    ap.add_argument("--dtim-phase-us", type=int, default=37000)
+    ap.add_argument("--loss", type=float, default=0.05, help="beacon loss per receiver")
+    ap.add_argument("--group", type=int, default=1)
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--udp", action="store_true", help="run the signs as threads on real multicast sockets")
+    ap.add_argument("--listen", action="store_true", help="print beacons seen on the network")
+    args = ap.parse_args()
+    if args.listen:
+        run_listen(args)
+    elif args.udp:
+        run_udp(args)
+    else:
+        run_virtual(args)
+
+
+if __name__ == "__main__":
+    main()